@@ -0,0 +1,73 @@
+// Imported sparse density grid (BrickVolume in brick_volume.h). Only bricks
+// holding density are in the atlas, each in a slot of 10³ texels: its 8³
+// voxels plus a one voxel apron, so the trilinear filter stays in the slot.
+// The brick table maps every brick of the grid to its slot. Included after
+// utils.glsl.
+
+layout(binding = 25) uniform sampler3D brickAtlas;
+
+layout(std430, binding = 26) readonly buffer BrickVolumeSSBO {
+    vec4 brickVolumeMin;     // w: density scale, 1 / largest density
+    vec4 brickVolumeMax;     // of the whole bricks
+    uvec4 brickCount;        // w: bricks in the atlas
+    uvec4 brickAtlasSlots;
+    uint brickSlots[];       // per brick, x fastest, BRICK_EMPTY if not stored
+};
+
+const int BRICK_SIZE = 8;
+const int BRICK_APRON = 1;
+const int BRICK_SLOT_SIZE = BRICK_SIZE + 2 * BRICK_APRON;
+const uint BRICK_EMPTY = 0xffffffffu;
+
+vec3 brickVolumeVoxelSize() {
+    return (brickVolumeMax.xyz - brickVolumeMin.xyz) / vec3(brickCount.xyz * BRICK_SIZE);
+}
+
+bool insideBrickVolume(vec3 p) {
+    return all(greaterThanEqual(p, brickVolumeMin.xyz)) && all(lessThan(p, brickVolumeMax.xyz));
+}
+
+ivec3 brickVolumeBrick(vec3 p) {
+    ivec3 brick = ivec3(floor((p - brickVolumeMin.xyz) / (brickVolumeVoxelSize() * float(BRICK_SIZE))));
+    return clamp(brick, ivec3(0), ivec3(brickCount.xyz) - 1);
+}
+
+uint brickVolumeSlot(ivec3 brick) {
+    return brickSlots[brick.x + int(brickCount.x) * (brick.y + int(brickCount.y) * brick.z)];
+}
+
+vec3 brickVolumeBrickMin(ivec3 brick) {
+    return brickVolumeMin.xyz + vec3(brick * BRICK_SIZE) * brickVolumeVoxelSize();
+}
+
+// Density scaled to [0, 1], 0 outside the volume and in bricks not stored
+float sampleBrickVolume(vec3 p) {
+    if (!insideBrickVolume(p)) return 0.0;
+    ivec3 brick = brickVolumeBrick(p);
+    uint slot = brickVolumeSlot(brick);
+    if (slot == BRICK_EMPTY) return 0.0;
+
+    uvec3 slotCoord = uvec3(slot % brickAtlasSlots.x,
+                            (slot / brickAtlasSlots.x) % brickAtlasSlots.y,
+                            slot / (brickAtlasSlots.x * brickAtlasSlots.y));
+    // Voxel centers are at +0.5 like texel centers, past the apron
+    vec3 local = (p - brickVolumeBrickMin(brick)) / brickVolumeVoxelSize();
+    vec3 texel = vec3(slotCoord * uint(BRICK_SLOT_SIZE)) + float(BRICK_APRON) + local;
+    vec3 uvw = texel / vec3(brickAtlasSlots.xyz * uint(BRICK_SLOT_SIZE));
+    return texture(brickAtlas, uvw).r * brickVolumeMin.w;
+}
+
+// Lower bound of the distance to density: to the volume from outside, to
+// the sides of an empty brick inside it, a voxel in a stored brick
+float brickVolumeDistance(vec3 p) {
+    vec3 halfExtent = 0.5 * (brickVolumeMax.xyz - brickVolumeMin.xyz);
+    vec3 center = brickVolumeMin.xyz + halfExtent;
+    if (!insideBrickVolume(p)) return sdRoundBox(p - center, halfExtent, 0.0);
+
+    vec3 voxelSize = brickVolumeVoxelSize();
+    ivec3 brick = brickVolumeBrick(p);
+    if (brickVolumeSlot(brick) != BRICK_EMPTY) return min(min(voxelSize.x, voxelSize.y), voxelSize.z);
+    vec3 brickMin = brickVolumeBrickMin(brick);
+    vec3 sides = min(p - brickMin, brickMin + voxelSize * float(BRICK_SIZE) - p);
+    return min(min(sides.x, sides.y), sides.z);
+}
@@ -0,0 +1,31 @@
+// Sun transmittance and soft shadow of the smoke scene, baked by
+// light_volume.comp whenever the sun, the particles or the noise change. A
+// lit march sample reads both with one fetch instead of running lightmarch()
+// and softshadow(). Included after utils.glsl.
+
+// rgba16f like the particle field: r = transmittance, g = soft shadow
+layout(binding = 22, rgba16f) uniform writeonly image3D lightVolumeImage;
+layout(binding = 23) uniform sampler3D lightVolume;
+
+// LightVolume in config.h: 0.25 unit voxels around the smoke grid, down to
+// just below the ground
+const ivec3 LIGHT_VOLUME_SIZE = ivec3(64, 48, 64);
+const vec3 LIGHT_VOLUME_MIN = vec3(-8.0, -5.0, -8.0);
+const vec3 LIGHT_VOLUME_MAX = vec3(8.0, 7.0, 8.0);
+
+// Center of a voxel, where the bake marches toward the sun
+vec3 lightVolumePosition(ivec3 voxel) {
+    return LIGHT_VOLUME_MIN + (vec3(voxel) + 0.5) / vec3(LIGHT_VOLUME_SIZE) * (LIGHT_VOLUME_MAX - LIGHT_VOLUME_MIN);
+}
+
+bool insideLightVolume(vec3 p) {
+    return all(greaterThanEqual(p, LIGHT_VOLUME_MIN)) && all(lessThan(p, LIGHT_VOLUME_MAX));
+}
+
+// x: transmittance, y: soft shadow
+vec2 sampleLightVolume(vec3 p) {
+    // The sampler repeats, keep the filter off the opposite border
+    vec3 halfVoxel = 0.5 / vec3(LIGHT_VOLUME_SIZE);
+    vec3 uvw = clamp((p - LIGHT_VOLUME_MIN) / (LIGHT_VOLUME_MAX - LIGHT_VOLUME_MIN), halfVoxel, 1.0 - halfVoxel);
+    return texture(lightVolume, uvw).rg;
+}
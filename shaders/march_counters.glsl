@@ -0,0 +1,26 @@
+// Per frame totals of the smoke pipeline, MarchCounters in config.h. Cleared
+// before the particle step, summed by particles.comp and smoke.comp and read
+// back by the host once the frame retires.
+
+#define COUNTER_RAYS 0
+#define COUNTER_MARCH_SAMPLES 1
+#define COUNTER_LIGHT_SAMPLES 2
+#define COUNTER_SHADOW_SAMPLES 3
+#define COUNTER_SAVED_SAMPLES 4     // below the fixed MAX_STEPS march
+#define COUNTER_TERMINATED_RAYS 5   // stopped by the transmittance cutoff
+#define COUNTER_EXHAUSTED_RAYS 6    // stopped by the sample budget
+#define COUNTER_MOVED_PARTICLES 7   // particles.comp, keeps the light volume baking
+#define COUNTER_COUNT 8
+
+// Low and high word per counter: a frame adds up to pixels * sampleBudget
+// samples, past 2^32 at high resolutions
+layout(std430, binding = 21) buffer MarchCounterSSBO {
+    uint marchCounters[COUNTER_COUNT * 2];
+};
+
+// 64-bit add out of two 32-bit atomics, the add that wraps the low word
+// carries into the high one
+void addMarchCounter(int counter, uint value) {
+    uint previous = atomicAdd(marchCounters[2 * counter], value);
+    if (previous + value < previous) atomicAdd(marchCounters[2 * counter + 1], 1u);
+}
@@ -0,0 +1,28 @@
+// Distance to the particles of the active pipeline, baked once per frame by
+// smoke_field.comp or fluid_field.comp over that pipeline's domain. The
+// marches sample it trilinearly instead of blending particles at every step
+// and only evaluate the particles exactly close to the surface. Included
+// after utils.glsl.
+
+// rgba16f is guaranteed for both storage and linear filtering, only r is used
+layout(binding = 19, rgba16f) uniform writeonly image3D particleFieldImage;
+layout(binding = 20) uniform sampler3D particleField;
+
+// ParticleField::size in config.h
+const int PARTICLE_FIELD_SIZE = 64;
+
+// Center of a voxel, where the bake evaluates the particles
+vec3 particleFieldPosition(ivec3 voxel, vec3 domainMin, vec3 domainMax) {
+    return domainMin + (vec3(voxel) + 0.5) / float(PARTICLE_FIELD_SIZE) * (domainMax - domainMin);
+}
+
+bool insideParticleField(vec3 p, vec3 domainMin, vec3 domainMax) {
+    return all(greaterThanEqual(p, domainMin)) && all(lessThan(p, domainMax));
+}
+
+float sampleParticleField(vec3 p, vec3 domainMin, vec3 domainMax) {
+    // The sampler repeats, keep the filter off the opposite border
+    const float halfVoxel = 0.5 / float(PARTICLE_FIELD_SIZE);
+    vec3 uvw = clamp((p - domainMin) / (domainMax - domainMin), halfVoxel, 1.0 - halfVoxel);
+    return texture(particleField, uvw).r;
+}
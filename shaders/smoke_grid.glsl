@@ -0,0 +1,94 @@
+// Uniform grid of the smoke particles, built every frame by the
+// smoke_grid_*.comp passes and read by scene() in smoke_scene.glsl. A
+// particle is listed in every cell its sphere plus smooth union width
+// overlaps, so a sample only has to blend the particles of its own cell.
+// Included after utils.glsl.
+
+struct SmokeCell {
+    uint count;
+    uint start;   // first entry of the cell in smokeCellParticles
+    uint filled;  // entries written so far by smoke_grid_fill.comp
+};
+
+// Cleared to zero every frame
+layout(std430, binding = 17) buffer SmokeGridSSBO {
+    SmokeCell smokeCells[];
+};
+// Particle indices in cell order. Sized on the host for the particle scales,
+// entries past its end are dropped.
+layout(std430, binding = 18) buffer SmokeCellParticleSSBO {
+    uint smokeCellParticles[];
+};
+
+// scene() places a particle at -position, so the grid spans the simulation
+// box mirrored and grown by the reach of a unit particle. SmokeGrid in
+// config.h, keep in sync.
+const vec3 SMOKE_GRID_MIN = vec3(-5.0, -5.0, -5.0);
+const float SMOKE_CELL_SIZE = 0.5;
+const ivec3 SMOKE_GRID = ivec3(20, 16, 20);
+const uint SMOKE_CELL_COUNT = 20 * 16 * 20;
+const vec3 SMOKE_GRID_MAX = SMOKE_GRID_MIN + vec3(SMOKE_GRID) * SMOKE_CELL_SIZE;
+
+// Smooth union width per unit of particle scale, 2 for the unit particles
+const float SMOKE_BLEND_SCALE = 2.0;
+// Bound of the noise scene() adds to the density. fbm(p, 6) sums octaves of
+// noise() in [-1, 1] at amplitudes 1/2, 1/4, ... so it stays below 1;
+// fbmVolume() holds 7/8 of that in a texel plus 1/8 from the second fetch,
+// below 1 as well.
+const float SMOKE_NOISE_AMPLITUDE = 1.0;
+// Distance returned where no particle reaches, half a unit past the noise
+// so it can not turn into density. The march skips empty cells on that.
+const float SMOKE_EMPTY_DISTANCE = SMOKE_NOISE_AMPLITUDE + 0.5;
+
+vec3 smokeParticleCenter(Particle particle) {
+    return -particle.position.xyz;
+}
+
+// Radius around the center where the particle changes the blended distance
+float smokeParticleReach(Particle particle) {
+    return particle.position.w * (1.0 + SMOKE_BLEND_SCALE);
+}
+
+ivec3 smokeCell(vec3 p) {
+    return ivec3(floor((p - SMOKE_GRID_MIN) / SMOKE_CELL_SIZE));
+}
+
+uint smokeCellIndex(ivec3 cell) {
+    return uint(cell.x + SMOKE_GRID.x * (cell.y + SMOKE_GRID.y * cell.z));
+}
+
+bool smokeCellInGrid(ivec3 cell) {
+    return all(greaterThanEqual(cell, ivec3(0))) && all(lessThan(cell, SMOKE_GRID));
+}
+
+// No particle reaches into the cell, the cell must be in the grid
+bool smokeCellEmpty(ivec3 cell) {
+    return smokeCells[smokeCellIndex(cell)].count == 0u;
+}
+
+// Cells overlapped by the particle's reach, inclusive
+void smokeParticleCells(Particle particle, out ivec3 cellMin, out ivec3 cellMax) {
+    vec3 center = smokeParticleCenter(particle);
+    float reach = smokeParticleReach(particle);
+    cellMin = max(smokeCell(center - reach), ivec3(0));
+    cellMax = min(smokeCell(center + reach), SMOKE_GRID - 1);
+}
+
+// Smooth union of the particles listed in p's grid cell
+float sdSmokeParticles(vec3 p) {
+    ivec3 cell = smokeCell(p);
+    if (!smokeCellInGrid(cell)) return SMOKE_EMPTY_DISTANCE;
+    SmokeCell cellParticles = smokeCells[smokeCellIndex(cell)];
+    uint begin = cellParticles.start;
+    uint end = min(begin + cellParticles.count, uint(smokeCellParticles.length()));
+    if (begin >= end) return SMOKE_EMPTY_DISTANCE;
+
+    Particle particle = particles[smokeCellParticles[begin]];
+    float distance = sdSphere(p + particle.position.xyz, particle.position.w);
+    for (uint i = begin + 1; i < end; ++i) {
+        particle = particles[smokeCellParticles[i]];
+        float d = sdSphere(p + particle.position.xyz, particle.position.w);
+        distance = opSmoothUnion(d, distance, SMOKE_BLEND_SCALE * particle.position.w);
+    }
+    return distance;
+}
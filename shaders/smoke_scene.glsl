@@ -0,0 +1,115 @@
+// Density of the smoke scene and its lighting toward the sun, shared by the
+// smoke march and the light volume bake. Included after utils.glsl,
+// smoke_grid.glsl, particle_field.glsl and brick_volume.glsl.
+
+const float Tmin = 0.5;
+const float Tmax = 10;
+const float Ka  = 0.2;
+
+#define MAX_STEPS_LIGHTS 6
+#define ABSORPTION_COEFFICIENT 0.9
+
+// Baked distances are trilinear between voxels of ~0.16, closer to the
+// surface than this the particles are evaluated exactly
+const float SMOKE_FIELD_REFINE_DISTANCE = 0.25;
+
+// scene()'s ground plane, the only density outside the particles' cells
+// lies beyond it (+y points down)
+const float GROUND_Y = 6.0;
+
+// soft shadow
+const int K  = 32;
+
+// Distance to the smoke particles, from the baked field away from the
+// surface and the particles of p's grid cell close to it
+float smokeParticleDistance(vec3 p) {
+    ivec3 cell = smokeCell(p);
+    if (!smokeCellInGrid(cell) || smokeCellEmpty(cell)) return SMOKE_EMPTY_DISTANCE;
+    if (ubo.useParticleField == 1) {
+        float baked = sampleParticleField(p, SMOKE_GRID_MIN, SMOKE_GRID_MAX);
+        if (abs(baked) > SMOKE_FIELD_REFINE_DISTANCE) return baked;
+    }
+    return sdSmokeParticles(p);
+}
+
+// scene() with the imported volume as the smoke: its density where there is
+// any, the negated distance to the ground or the nearest stored brick
+// elsewhere
+float brickVolumeScene(vec3 p, inout int flag) {
+    float ground = sdPlane(p, vec3(0, -0.5, 0), 3);
+    float density = ground > 0.0 ? sampleBrickVolume(p) : 0.0;
+    if (density > 0.0) {
+        flag = 1;
+        return density;
+    }
+    float distance = min(brickVolumeDistance(p), ground);
+    flag = distance == ground ? 0 : 1;
+    return -distance;
+}
+
+// flag: 0 = ground, 1 = smoke
+float scene(vec3 p, inout int flag) {
+    if (ubo.useBrickVolume == 1) return brickVolumeScene(p, flag);
+
+    float distance = smokeParticleDistance(p);
+
+    float overlap = min(distance, sdPlane(p, vec3(0, -0.5, 0), 3));
+
+    if (overlap == distance) {
+        flag = 1;// Flag indicating the point is above the ground
+    } else {
+        flag = 0;// Flag indicating the point is on or below the ground
+    }
+
+    distance = overlap;
+
+    // Add noise only when above the ground
+    if (flag == 1) {
+        vec3 fbmCoord = (p + 2 * vec3(ubo.totalTime * 0.5, 0.0, ubo.totalTime * 0.5)) / 1.5;
+        float f = 5.0 * fbm(fbmCoord / 3.2, 6);
+        return -distance + (ubo.useNoiseVolume == 1 ? fbmVolume(p) : fbm(p, 6));
+    } else {
+        return -distance;
+    }
+}
+
+// Both marches below take at most `budget` scene() samples and subtract the
+// ones they take
+float lightmarch(vec3 position, inout int budget) {
+    vec3 sunDirection = normalize(ubo.sunPosition);
+    float totalDensity = 0.0;
+    float marchSize = 0.03;
+    int flag = 0;
+
+    for (int step = 0; step < MAX_STEPS_LIGHTS; step++) {
+        if (budget <= 0) break;
+        --budget;
+        position += sunDirection * marchSize * float(step);
+
+        float lightSample = scene(position, flag);
+        totalDensity += lightSample;
+        if (flag == 0) {
+            return BeersLaw(totalDensity, ABSORPTION_COEFFICIENT);
+        }
+    }
+
+    float transmittance = BeersLaw(totalDensity, ABSORPTION_COEFFICIENT);
+    return transmittance;
+}
+
+float softshadow(in vec3 ro, in vec3 rd, inout int budget)
+{
+    float res = 1.0;
+    int flag  = 0;
+    for (float t=Tmin; t<Tmax;)
+    {
+        if (budget <= 0) break;
+        --budget;
+        float h = -scene(ro + rd*t, flag);
+        if (h<0.001)
+        return 0.0;
+        res = min(res, K*h/t);
+        t += h;
+    }
+    return res;
+}
@@ -0,0 +1,117 @@
+// SPH fluid shared by the sph_*.comp passes and volumetric.comp. Included
+// after utils.glsl.
+
+struct FluidParticle {
+    vec4 position;  // w: density
+    vec4 velocity;  // w: pressure
+};
+
+// This frame's simulation result and the previous one, the two buffers swap
+// roles every frame like the smoke particles
+layout(std430, binding = 12) buffer FluidParticleSSBO {
+    FluidParticle fluidParticles[];
+};
+layout(std430, binding = 13) readonly buffer PreviousFluidParticleSSBO {
+    FluidParticle previousFluidParticles[];
+};
+// Previous particles in cell order, sphCells[c].start indexes into it
+layout(std430, binding = 14) buffer SortedFluidParticleSSBO {
+    FluidParticle sortedFluidParticles[];
+};
+
+struct SphCell {
+    uint count;
+    uint start;  // first particle of the cell in sortedFluidParticles
+};
+
+// Cleared to zero every frame. The occupied bounds are kept as maxima only,
+// the minimum is stored mirrored (SPH_GRID - 1 - cell) so both start at 0.
+layout(std430, binding = 15) buffer SphGridSSBO {
+    uint fluidCellMax[3];
+    uint fluidCellMinMirrored[3];
+    SphCell sphCells[];
+};
+// Per previous particle: x = cell, y = rank inside the cell
+layout(std430, binding = 16) buffer FluidParticleCellSSBO {
+    uvec2 fluidParticleCells[];
+};
+
+// Simulation domain, boxMin* / boxMax* in application.cpp. +y points down on
+// screen, so the fluid pools at BOX_MAX.y.
+const vec3 SPH_BOX_MIN = vec3(-2.0, 0.0, -2.0);
+const vec3 SPH_BOX_MAX = vec3(2.0, 2.0, 2.0);
+
+// Smoothing length, also the edge of a hash grid cell (SphGrid in config.h)
+const float SPH_H = 0.1;
+const ivec3 SPH_GRID = ivec3(40, 20, 40);
+const uint SPH_CELL_COUNT = 40 * 20 * 40;
+
+const float SPH_PARTICLE_MASS = 0.125;  // 0.05 spacing at rest density
+const float SPH_REST_DENSITY = 1000.0;
+const float SPH_STIFFNESS = 40.0;
+const float SPH_VISCOSITY = 2.5;
+const vec3 SPH_GRAVITY = vec3(0.0, 9.81, 0.0);
+// Simulated seconds per frame, the CFL limit for the stiffness above
+const float SPH_TIME_STEP = 0.005;
+const float SPH_MAX_SPEED = 8.0;
+// Velocity kept when bouncing off the domain walls
+const float SPH_WALL_RESTITUTION = 0.3;
+
+// Rendered as spheres per particle, smooth unioned with their neighbours
+const float FLUID_PARTICLE_RADIUS = 0.06;     // at 0.05 rest spacing
+const float FLUID_PARTICLE_BLEND = 0.04;      // smooth union range
+const float FLUID_PARTICLE_SMOOTHNESS = 1.75; // sminN exponent
+
+// Müller et al. 2003 kernels
+const float SPH_POLY6 = 315.0 / (64.0 * PI * pow(SPH_H, 9.0));
+const float SPH_SPIKY_GRAD = -45.0 / (PI * pow(SPH_H, 6.0));
+const float SPH_VISC_LAPLACIAN = 45.0 / (PI * pow(SPH_H, 6.0));
+
+ivec3 sphCell(vec3 p) {
+    return clamp(ivec3(floor((p - SPH_BOX_MIN) / SPH_H)), ivec3(0), SPH_GRID - 1);
+}
+
+uint sphCellIndex(ivec3 cell) {
+    return uint(cell.x + SPH_GRID.x * (cell.y + SPH_GRID.y * cell.z));
+}
+
+bool sphCellInGrid(ivec3 cell) {
+    return all(greaterThanEqual(cell, ivec3(0))) && all(lessThan(cell, SPH_GRID));
+}
+
+// World space box around the occupied cells, empty when there are no particles
+void fluidBounds(out vec3 boundsMin, out vec3 boundsMax) {
+    ivec3 cellMax = ivec3(fluidCellMax[0], fluidCellMax[1], fluidCellMax[2]);
+    ivec3 cellMin = SPH_GRID - 1 - ivec3(fluidCellMinMirrored[0], fluidCellMinMirrored[1], fluidCellMinMirrored[2]);
+    boundsMin = SPH_BOX_MIN + vec3(cellMin) * SPH_H;
+    boundsMax = SPH_BOX_MIN + vec3(cellMax + 1) * SPH_H;
+}
+
+// Smooth union of the particles within `reach` cells of p, the distance only
+// of sdFluidParticles() in volumetric.comp. Particles further away are at
+// least reach * SPH_H - FLUID_PARTICLE_RADIUS away, the result is capped there.
+float fluidParticleDistance(vec3 p, int reach) {
+    float cap = float(reach) * SPH_H - FLUID_PARTICLE_RADIUS;
+
+    vec3 boundsMin, boundsMax;
+    fluidBounds(boundsMin, boundsMax);
+    float boundsDistance = sdRoundBox(p - 0.5 * (boundsMin + boundsMax), 0.5 * (boundsMax - boundsMin), 0.0);
+    if (boundsDistance > float(reach) * SPH_H) return boundsDistance - FLUID_PARTICLE_RADIUS;
+
+    ivec3 cell = ivec3(floor((p - SPH_BOX_MIN) / SPH_H));
+    float distance = cap;
+    bool found = false;
+    for (int z = -reach; z <= reach; ++z)
+    for (int y = -reach; y <= reach; ++y)
+    for (int x = -reach; x <= reach; ++x) {
+        ivec3 neighbourCell = cell + ivec3(x, y, z);
+        if (!sphCellInGrid(neighbourCell)) continue;
+        SphCell range = sphCells[sphCellIndex(neighbourCell)];
+        for (uint i = range.start; i < range.start + range.count; ++i) {
+            float d = length(p - sortedFluidParticles[i].position.xyz) - FLUID_PARTICLE_RADIUS;
+            distance = found ? sminN(distance, d, FLUID_PARTICLE_BLEND, FLUID_PARTICLE_SMOOTHNESS).x : d;
+            found = true;
+        }
+    }
+    return min(distance, cap);
+}
@@ -9,6 +9,21 @@ layout (binding = 1) uniform ParameterUBO {
     int frame;
     int particleBasedFluid;
     float rotationAngle;
+    int useNoiseVolume;
+    // Temporal accumulation (temporal.comp)
+    vec3 prevCameraPosition;
+    float prevRotationAngle;
+    float temporalBlend;    // weight of the current frame, 1 = off
+    int historyValid;
+    int useParticleField;   // particle_field.glsl instead of every particle
+    // Adaptive smoke march (smoke.comp)
+    float transmittanceCutoff;
+    float stepGrowth;
+    int sampleBudget;       // scene() calls per ray, 1 to MarchPolicy::maxSampleBudget
+    int useLightVolume;     // light_volume.glsl instead of lightmarch/softshadow
+    // Render on demand (accumulate.comp): samples already accumulated, 0 = restart
+    int accumulatedFrames;
+    int useBrickVolume;     // brick_volume.glsl as the smoke density
 } ubo;
 
 struct Particle {
@@ -21,16 +36,45 @@ layout(std140, binding = 2) buffer ParticleSSBO {
     Particle particles[];
 };
 
-layout(binding = 3) uniform sampler2D noiseTexture;
+layout(binding = 3) uniform sampler3D noiseVolume;
 layout(binding = 4) uniform sampler2D blueNoiseTexture;
 layout (binding = 5, rgba8) uniform image2D causticTexture;
+// Per march pixel: r = distance to the first hit, g = transmittance. Guides
+// the bilateral upsample (upsample.comp) when marching below full resolution.
+layout(binding = 6, rgba16f) uniform image2D marchAuxImage;
 
 #define PI 3.14159265359
+// World units covered by one tile of the noise volume (NoiseVolume::extent)
+#define NOISE_VOLUME_EXTENT 8.0
+// Depth stored in marchAuxImage for rays that hit nothing
+#define MARCH_FAR_DEPTH 1000.0
+
+void storeMarchAux(float depth, float transmittance) {
+    imageStore(marchAuxImage, ivec2(gl_GlobalInvocationID.xy), vec4(depth, transmittance, 0.0, 0.0));
+}
 
 float sdSphere(vec3 p, float radius) {
     return length(p) - radius;
 }
 
+// Radical inverse of index in base, the Halton sequence
+float halton(int index, int base) {
+    float f = 1.0;
+    float r = 0.0;
+    for (int i = index; i > 0; i /= base) {
+        f /= float(base);
+        r += f * float(i % base);
+    }
+    return r;
+}
+
+// Sub-pixel offset of the primary ray while a still image accumulates, so the
+// average also resolves the edges. The first sample stays at the center.
+vec2 pixelJitter() {
+    if (ubo.accumulatedFrames <= 0) return vec2(0.0);
+    return vec2(halton(ubo.accumulatedFrames, 2), halton(ubo.accumulatedFrames, 3)) - 0.5;
+}
+
 float BeersLaw (float dist, float absorption) {
     return exp(-dist * absorption);
 }
@@ -147,6 +191,14 @@ float fbm(vec3 p, in int iterations) {
     return f;
 }
 
+// Approximates fbm(p, 6) from the baked noise volume: each texel holds
+// octaves 1-3, the second fetch at 8x the frequency adds octaves 4-6. The
+// octaves double exactly so the volume tiles, the lattice differs from fbm()
+float fbmVolume(vec3 p) {
+    vec3 uvw = (p + ubo.totalTime * 0.5 * ubo.windDirection) / NOISE_VOLUME_EXTENT;
+    return texture(noiseVolume, uvw).r + 0.125 * texture(noiseVolume, uvw * 8.0).r;
+}
+
 // Taken from Inigo Quilez's Rainforest ShaderToy:
 // https://www.shadertoy.com/view/4ttSWf
 float fbm_4( in vec3 x )
@@ -0,0 +1,374 @@
+#include "allocator.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+void GpuAllocator::Init(VkDevice device, VkPhysicalDevice physicalDevice)
+{
+    this->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+void GpuAllocator::Cleanup()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t leaked = dedicatedCount;
+    for (auto& pool : pools) {
+        for (auto& block : pool.blocks) {
+            if (!block) continue;
+            leaked += block->orders.size();
+            vkFreeMemory(device, block->memory, nullptr);
+        }
+    }
+    pools.clear();
+    if (leaked > 0) {
+        fmt::print("[WARN] {} GPU allocations were never freed\n", leaked);
+    }
+}
+
+Allocation GpuAllocator::AllocateBuffer(VkBuffer buffer,
+                                        VkMemoryPropertyFlags properties)
+{
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType =
+        VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+    VkBufferMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    info.buffer = buffer;
+    vkGetBufferMemoryRequirements2(device, &info, &requirements);
+
+    Allocation allocation =
+        allocate(requirements.memoryRequirements, properties, false,
+                 dedicatedRequirements.prefersDedicatedAllocation, buffer,
+                 VK_NULL_HANDLE);
+    if (vkBindBufferMemory(device, buffer, allocation.memory,
+                           allocation.offset) != VK_SUCCESS) {
+        Free(allocation);
+        throw std::runtime_error("failed to bind buffer memory!");
+    }
+    return allocation;
+}
+
+Allocation GpuAllocator::AllocateImage(VkImage image,
+                                       VkMemoryPropertyFlags properties)
+{
+    VkMemoryDedicatedRequirements dedicatedRequirements{};
+    dedicatedRequirements.sType =
+        VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+    VkMemoryRequirements2 requirements{};
+    requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    requirements.pNext = &dedicatedRequirements;
+    VkImageMemoryRequirementsInfo2 info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    info.image = image;
+    vkGetImageMemoryRequirements2(device, &info, &requirements);
+
+    Allocation allocation =
+        allocate(requirements.memoryRequirements, properties, true,
+                 dedicatedRequirements.prefersDedicatedAllocation,
+                 VK_NULL_HANDLE, image);
+    if (vkBindImageMemory(device, image, allocation.memory,
+                          allocation.offset) != VK_SUCCESS) {
+        Free(allocation);
+        throw std::runtime_error("failed to bind image memory!");
+    }
+    return allocation;
+}
+
+void GpuAllocator::Free(const Allocation& allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (allocation.dedicated) {
+        vkFreeMemory(device, allocation.memory, nullptr);
+        --dedicatedCount;
+        dedicatedBytes -= allocation.size;
+        return;
+    }
+
+    Pool& pool = pools[allocation.pool];
+    auto& block = pool.blocks[allocation.block];
+    block->Free(allocation.offset);
+    block->requestedBytes -= allocation.size;
+
+    // Keep one block per pool around so alternating create/destroy does not
+    // hit vkAllocateMemory every time
+    if (block->IsEmpty()) {
+        size_t liveBlocks =
+            std::count_if(pool.blocks.begin(), pool.blocks.end(),
+                          [](const auto& b) { return b != nullptr; });
+        if (liveBlocks > 1) {
+            vkFreeMemory(device, block->memory, nullptr);
+            block.reset();
+        }
+    }
+}
+
+uint32_t GpuAllocator::FindMemoryType(uint32_t typeFilter,
+                                      VkMemoryPropertyFlags properties) const
+{
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i)) &&
+            (memoryProperties.memoryTypes[i].propertyFlags & properties) ==
+                properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+GpuAllocator::Statistics GpuAllocator::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Statistics statistics;
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize fragmentedBytes = 0;
+    for (const auto& pool : pools) {
+        for (const auto& block : pool.blocks) {
+            if (!block) continue;
+            ++statistics.blockCount;
+            statistics.allocationCount +=
+                static_cast<uint32_t>(block->orders.size());
+            statistics.reservedBytes += pool.blockSize;
+            statistics.allocatedBytes += block->allocatedBytes;
+            statistics.requestedBytes += block->requestedBytes;
+
+            VkDeviceSize blockFree = pool.blockSize - block->allocatedBytes;
+            freeBytes += blockFree;
+            fragmentedBytes += blockFree - block->LargestFree();
+        }
+    }
+    statistics.dedicatedCount = dedicatedCount;
+    statistics.allocationCount += dedicatedCount;
+    statistics.reservedBytes += dedicatedBytes;
+    statistics.allocatedBytes += dedicatedBytes;
+    statistics.requestedBytes += dedicatedBytes;
+    if (freeBytes > 0) {
+        statistics.fragmentation = static_cast<float>(fragmentedBytes) /
+                                   static_cast<float>(freeBytes);
+    }
+    return statistics;
+}
+
+void GpuAllocator::PrintStatistics() const
+{
+    Statistics statistics = GetStatistics();
+    const double mib = 1024.0 * 1024.0;
+    fmt::print(
+        "[INFO] GPU memory: {} blocks + {} dedicated, {:.1f} MiB reserved, "
+        "{:.1f} MiB allocated ({:.1f} MiB requested) in {} allocations, "
+        "{:.1f}% of free space fragmented\n",
+        statistics.blockCount, statistics.dedicatedCount,
+        statistics.reservedBytes / mib, statistics.allocatedBytes / mib,
+        statistics.requestedBytes / mib, statistics.allocationCount,
+        statistics.fragmentation * 100.0f);
+}
+
+Allocation GpuAllocator::allocate(const VkMemoryRequirements& requirements,
+                                  VkMemoryPropertyFlags properties,
+                                  bool images, bool dedicated, VkBuffer buffer,
+                                  VkImage image)
+{
+    uint32_t memoryType =
+        FindMemoryType(requirements.memoryTypeBits, properties);
+
+    // Buddies are aligned to their size, so alignment only rounds up
+    VkDeviceSize size =
+        std::max({requirements.size, requirements.alignment, minAllocation});
+    uint32_t order = 0;
+    while ((minAllocation << order) < size) ++order;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    uint32_t poolIndex = findPool(memoryType, images);
+    Pool& pool = pools[poolIndex];
+    if (dedicated || requirements.size > dedicatedThreshold ||
+        (minAllocation << order) > pool.blockSize) {
+        lock.unlock();
+        return allocateDedicated(requirements.size, memoryType, buffer, image);
+    }
+
+    Allocation allocation;
+    allocation.size = requirements.size;
+    allocation.pool = poolIndex;
+
+    auto fill = [&](uint32_t blockIndex, VkDeviceSize offset) {
+        Block& block = *pool.blocks[blockIndex];
+        block.requestedBytes += requirements.size;
+        allocation.memory = block.memory;
+        allocation.offset = offset;
+        allocation.block = blockIndex;
+        allocation.mapped = block.mapped != nullptr
+                                ? static_cast<char *>(block.mapped) + offset
+                                : nullptr;
+        return allocation;
+    };
+
+    for (uint32_t i = 0; i < pool.blocks.size(); ++i) {
+        VkDeviceSize offset;
+        if (pool.blocks[i] && pool.blocks[i]->Allocate(order, offset)) {
+            return fill(i, offset);
+        }
+    }
+
+    // No room, add a block (reusing a released slot keeps indices stable)
+    auto block = std::make_unique<Block>();
+    uint32_t maxOrder = 0;
+    while ((minAllocation << maxOrder) < pool.blockSize) ++maxOrder;
+    block->Reset(maxOrder);
+    block->memory = allocateMemory(pool.blockSize, memoryType, VK_NULL_HANDLE,
+                                   VK_NULL_HANDLE, &block->mapped);
+
+    auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+    uint32_t blockIndex = static_cast<uint32_t>(slot - pool.blocks.begin());
+    if (slot == pool.blocks.end()) {
+        pool.blocks.push_back(std::move(block));
+    } else {
+        *slot = std::move(block);
+    }
+
+    VkDeviceSize offset;
+    pool.blocks[blockIndex]->Allocate(order, offset);
+    return fill(blockIndex, offset);
+}
+
+Allocation GpuAllocator::allocateDedicated(VkDeviceSize size,
+                                           uint32_t memoryType,
+                                           VkBuffer buffer, VkImage image)
+{
+    Allocation allocation;
+    allocation.size = size;
+    allocation.dedicated = true;
+    allocation.memory =
+        allocateMemory(size, memoryType, buffer, image, &allocation.mapped);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++dedicatedCount;
+    dedicatedBytes += size;
+    return allocation;
+}
+
+VkDeviceMemory GpuAllocator::allocateMemory(VkDeviceSize size,
+                                            uint32_t memoryType,
+                                            VkBuffer buffer, VkImage image,
+                                            void **mapped)
+{
+    VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.buffer = buffer;
+    dedicatedInfo.image = image;
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+    if (buffer != VK_NULL_HANDLE || image != VK_NULL_HANDLE) {
+        allocInfo.pNext = &dedicatedInfo;
+    }
+
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate device memory!");
+    }
+
+    *mapped = nullptr;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) !=
+            VK_SUCCESS) {
+            vkFreeMemory(device, memory, nullptr);
+            throw std::runtime_error("failed to map device memory!");
+        }
+    }
+    return memory;
+}
+
+uint32_t GpuAllocator::findPool(uint32_t memoryType, bool images)
+{
+    for (uint32_t i = 0; i < pools.size(); ++i) {
+        if (pools[i].memoryType == memoryType && pools[i].images == images) {
+            return i;
+        }
+    }
+
+    // Small heaps (e.g. the 256 MiB host visible VRAM window) get smaller
+    // blocks so a few of them cannot exhaust the heap
+    uint32_t heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+    VkDeviceSize heapSize = memoryProperties.memoryHeaps[heap].size;
+    VkDeviceSize poolBlockSize = blockSize;
+    while (poolBlockSize > heapSize / 8 && poolBlockSize > minAllocation) {
+        poolBlockSize >>= 1;
+    }
+
+    Pool pool;
+    pool.memoryType = memoryType;
+    pool.images = images;
+    pool.blockSize = poolBlockSize;
+    pools.push_back(std::move(pool));
+    return static_cast<uint32_t>(pools.size() - 1);
+}
+
+void GpuAllocator::Block::Reset(uint32_t maxOrder)
+{
+    this->maxOrder = maxOrder;
+    freeLists.assign(maxOrder + 1, {});
+    freeLists[maxOrder].insert(0);
+    orders.clear();
+    allocatedBytes = 0;
+    requestedBytes = 0;
+}
+
+bool GpuAllocator::Block::Allocate(uint32_t order, VkDeviceSize& offset)
+{
+    uint32_t k = order;
+    while (k <= maxOrder && freeLists[k].empty()) ++k;
+    if (k > maxOrder) return false;
+
+    offset = *freeLists[k].begin();
+    freeLists[k].erase(freeLists[k].begin());
+    // Split, the upper halves stay free
+    while (k > order) {
+        --k;
+        freeLists[k].insert(offset + (minAllocation << k));
+    }
+
+    orders[offset] = order;
+    allocatedBytes += minAllocation << order;
+    return true;
+}
+
+void GpuAllocator::Block::Free(VkDeviceSize offset)
+{
+    auto it = orders.find(offset);
+    if (it == orders.end()) {
+        throw std::runtime_error("freeing unknown GPU allocation!");
+    }
+    uint32_t order = it->second;
+    orders.erase(it);
+    allocatedBytes -= minAllocation << order;
+
+    // Merge with the buddy as long as it is free as a whole
+    while (order < maxOrder) {
+        VkDeviceSize buddy = offset ^ (minAllocation << order);
+        auto free = freeLists[order].find(buddy);
+        if (free == freeLists[order].end()) break;
+        freeLists[order].erase(free);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    freeLists[order].insert(offset);
+}
+
+VkDeviceSize GpuAllocator::Block::LargestFree() const
+{
+    for (uint32_t k = maxOrder + 1; k-- > 0;) {
+        if (!freeLists[k].empty()) return minAllocation << k;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// A piece of device memory handed out by GpuAllocator. Host visible memory
+// is mapped once per block, `mapped` points at this allocation's bytes.
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void *mapped = nullptr;
+
+    uint32_t pool = 0;
+    uint32_t block = 0;
+    bool dedicated = false;
+};
+
+// Sub-allocates buffers and images from large vkAllocateMemory blocks with a
+// buddy allocator, one pool of blocks per memory type and resource kind
+// (linear buffers and optimal images never share a block, which keeps
+// bufferImageGranularity out of the picture). Large resources and those the
+// driver asks for get a dedicated allocation.
+class GpuAllocator {
+public:
+    static constexpr VkDeviceSize blockSize = VkDeviceSize{64} << 20;
+    static constexpr VkDeviceSize minAllocation = 256;
+    // Anything bigger is not worth rounding up to a power of two
+    static constexpr VkDeviceSize dedicatedThreshold = blockSize / 4;
+
+    struct Statistics {
+        uint32_t blockCount = 0;
+        uint32_t dedicatedCount = 0;
+        uint32_t allocationCount = 0;
+        VkDeviceSize reservedBytes = 0;   // vkAllocateMemory total
+        VkDeviceSize allocatedBytes = 0;  // handed out, rounded to buddies
+        VkDeviceSize requestedBytes = 0;  // asked for by the resources
+        // Share of free bytes outside the largest free buddy of their block
+        float fragmentation = 0.0f;
+    };
+
+    void Init(VkDevice device, VkPhysicalDevice physicalDevice);
+    // Frees every block, reports allocations that were never freed
+    void Cleanup();
+
+    // Allocate memory for the resource and bind it
+    Allocation AllocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+    Allocation AllocateImage(VkImage image, VkMemoryPropertyFlags properties);
+    void Free(const Allocation& allocation);
+
+    uint32_t FindMemoryType(uint32_t typeFilter,
+                            VkMemoryPropertyFlags properties) const;
+    Statistics GetStatistics() const;
+    void PrintStatistics() const;
+
+private:
+    // Buddy allocator over [0, size), size = minAllocation << maxOrder
+    struct Block {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        void *mapped = nullptr;
+        uint32_t maxOrder = 0;
+        std::vector<std::set<VkDeviceSize>> freeLists;  // offsets per order
+        std::map<VkDeviceSize, uint32_t> orders;  // allocated offset -> order
+        VkDeviceSize allocatedBytes = 0;
+        VkDeviceSize requestedBytes = 0;
+
+        void Reset(uint32_t maxOrder);
+        bool Allocate(uint32_t order, VkDeviceSize& offset);
+        void Free(VkDeviceSize offset);
+        VkDeviceSize LargestFree() const;
+        bool IsEmpty() const { return orders.empty(); }
+    };
+
+    struct Pool {
+        uint32_t memoryType = 0;
+        bool images = false;
+        VkDeviceSize blockSize = 0;
+        std::vector<std::unique_ptr<Block>> blocks;  // null = released slot
+    };
+
+    Allocation allocate(const VkMemoryRequirements& requirements,
+                        VkMemoryPropertyFlags properties, bool images,
+                        bool dedicated, VkBuffer buffer, VkImage image);
+    Allocation allocateDedicated(VkDeviceSize size, uint32_t memoryType,
+                                 VkBuffer buffer, VkImage image);
+    VkDeviceMemory allocateMemory(VkDeviceSize size, uint32_t memoryType,
+                                  VkBuffer buffer, VkImage image,
+                                  void **mapped);
+    uint32_t findPool(uint32_t memoryType, bool images);
+
+    VkDevice device = VK_NULL_HANDLE;
+    VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+    mutable std::mutex mutex;
+    std::vector<Pool> pools;
+    uint32_t dedicatedCount = 0;
+    VkDeviceSize dedicatedBytes = 0;
+};
@@ -1,10 +1,9 @@
 #include "application.h"
 
+#include <fmt/format.h>
+
 uint32_t WIDTH = 800;
 uint32_t HEIGHT = 600;
-const uint32_t PARTICLE_COUNT = 5;
-
-const int MAX_FRAMES_IN_FLIGHT = 2;
 
 const float boxMinX = -2.0;
 const float boxMaxX = 2.0;
@@ -13,15 +12,24 @@ const float boxMaxY = 2.0;
 const float boxMinZ = -2.0;
 const float boxMaxZ = 2.0;
 
-
+// FNV-1a over the bytes of a value without padding
+template <typename T>
+static void hashValue(uint64_t& hash, const T& value)
+{
+    const auto *bytes = reinterpret_cast<const unsigned char *>(&value);
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+}
 
 void Application::initWindow()
 {
     glfwInit();
 
     const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
-    WIDTH = mode->width * 0.5f;
-    HEIGHT = mode->height * 0.5f;
+    WIDTH = options.width != 0 ? options.width : mode->width * 0.5f;
+    HEIGHT = options.height != 0 ? options.height : mode->height * 0.5f;
+    core.CurrentPipeline = options.pipeline;
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
@@ -34,80 +42,203 @@ void Application::initWindow()
     glfwSetCursorPosCallback(core.window, cursorPositionCallback);
 }
 
+void Application::initHeadless()
+{
+    // No GLFW at all: farm nodes have neither a display nor a monitor
+    WIDTH = options.width != 0 ? options.width : 1280;
+    HEIGHT = options.height != 0 ? options.height : 720;
+    core.headless = true;
+    core.CurrentPipeline = options.pipeline;
+    std::cout << "[INFO] Headless mode " << WIDTH << "x" << HEIGHT << "..."
+              << std::endl;
+}
+
 void Application::initVulkan()
 {
     createInstance();
     setupDebugMessenger();
-    createSurface();
+    if (!options.headless) createSurface();
     core.CreateDevices();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
+    core.CreatePipelineCache(FilePath::pipelineCacheDirectory);
+    if (!options.headless) {
+        createSwapChain();
+        createImageViews();
+        createRenderPass();
+        createGraphicsDescriptorSetLayout();
+    }
     createComputeDescriptorSetLayout();
-    createGraphicsDescriptorSetLayout();
     createComputePipeline(FilePath::computeFluidShaderPath,
                           computeFluidPipelineLayout, computeFluidPipeline);
     createComputePipeline(FilePath::computeSmokeShaderPath,
                           computeSmokePipelineLayout, computeSmokePipeline);
-    createGraphicsPipeline();
-    createFramebuffers();
+    createComputePipeline(FilePath::computeUpsampleShaderPath,
+                          upsamplePipelineLayout, upsamplePipeline);
+    createComputePipeline(FilePath::computeTemporalShaderPath,
+                          temporalPipelineLayout, temporalPipeline);
+    createComputePipeline(FilePath::computeParticlesShaderPath,
+                          particlesPipelineLayout, particlesPipeline);
+    const std::array<std::string, 5> sphShaderPaths{
+        FilePath::computeSphHashShaderPath, FilePath::computeSphScanShaderPath,
+        FilePath::computeSphSortShaderPath,
+        FilePath::computeSphDensityShaderPath,
+        FilePath::computeSphForceShaderPath};
+    for (size_t i = 0; i < sphShaderPaths.size(); ++i) {
+        createComputePipeline(sphShaderPaths[i], sphPipelineLayouts[i],
+                              sphPipelines[i]);
+    }
+    const std::array<std::string, 3> smokeGridShaderPaths{
+        FilePath::computeSmokeGridCountShaderPath,
+        FilePath::computeSmokeGridScanShaderPath,
+        FilePath::computeSmokeGridFillShaderPath};
+    for (size_t i = 0; i < smokeGridShaderPaths.size(); ++i) {
+        createComputePipeline(smokeGridShaderPaths[i],
+                              smokeGridPipelineLayouts[i],
+                              smokeGridPipelines[i]);
+    }
+    createComputePipeline(FilePath::computeFluidFieldShaderPath,
+                          particleFieldPipelineLayouts[0],
+                          particleFieldPipelines[0]);
+    createComputePipeline(FilePath::computeSmokeFieldShaderPath,
+                          particleFieldPipelineLayouts[1],
+                          particleFieldPipelines[1]);
+    createComputePipeline(FilePath::computeLightVolumeShaderPath,
+                          lightVolumePipelineLayout, lightVolumePipeline);
+    createComputePipeline(FilePath::computeAccumulateShaderPath,
+                          accumulatePipelineLayout, accumulatePipeline);
+    if (!options.headless) {
+        createGraphicsPipeline();
+        createFramebuffers();
+    }
     createCommandPool();
     createShaderStorageBuffers();
+    createBrickVolume();
     createUniformBuffers();
     createDescriptorPool();
     createComputeDescriptorSets();
-    createGraphicsDescriptorSets();
-    createCommandBuffers();
+    if (options.headless) {
+        createReadbackBuffers();
+    } else {
+        createGraphicsDescriptorSets();
+        createCommandBuffers();
+    }
     createComputeCommandBuffers();
     createSyncObjects();
+    profiler.Init(options.framesInFlight);
+    if (options.benchmark && !profiler.IsEnabled()) {
+        throw std::runtime_error("benchmark requires timestamp queries!");
+    }
+    // One batch for every upload and layout transition above, waited for so
+    // the first frame finds them on its queue
+    core.uploader.Wait(core.uploader.Flush());
+    core.allocator.PrintStatistics();
 }
 
 void Application::cleanup()
 {
-    cleanupSwapChain();
-
-    uiInterface.Cleanup();
+    if (!options.headless) {
+        cleanupSwapChain();
+        uiInterface.Cleanup();
+    }
 
-    computeStorageTexture.Cleanup();
+    for (auto& computeStorageTexture : computeStorageTextures) {
+        computeStorageTexture.Cleanup();
+    }
+    marchColorTexture.Cleanup();
+    marchAuxTexture.Cleanup();
+    for (auto& historyTexture : historyTextures) historyTexture.Cleanup();
     causticTexture.Cleanup();
-    computeCloudNoiseTexture.Cleanup();
+    noiseVolumeTexture.Cleanup();
+    emptyNoiseTexture.Cleanup();
+    brickAtlasTexture.Cleanup();
+    particleFieldTexture.Cleanup();
+    lightVolumeTexture.Cleanup();
+    accumulationTexture.Cleanup();
     computeCloudBlueNoiseTexture.Cleanup();
 
-    vkDestroyPipeline(core.device, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(core.device, graphicsPipelineLayout, nullptr);
+    if (!options.headless) {
+        vkDestroyPipeline(core.device, graphicsPipeline, nullptr);
+        vkDestroyPipelineLayout(core.device, graphicsPipelineLayout, nullptr);
+    }
 
     vkDestroyPipeline(core.device, computeFluidPipeline, nullptr);
     vkDestroyPipelineLayout(core.device, computeFluidPipelineLayout, nullptr);
     vkDestroyPipeline(core.device, computeSmokePipeline, nullptr);
     vkDestroyPipelineLayout(core.device, computeSmokePipelineLayout, nullptr);
+    vkDestroyPipeline(core.device, upsamplePipeline, nullptr);
+    vkDestroyPipelineLayout(core.device, upsamplePipelineLayout, nullptr);
+    vkDestroyPipeline(core.device, temporalPipeline, nullptr);
+    vkDestroyPipelineLayout(core.device, temporalPipelineLayout, nullptr);
+    vkDestroyPipeline(core.device, particlesPipeline, nullptr);
+    vkDestroyPipelineLayout(core.device, particlesPipelineLayout, nullptr);
+    for (size_t i = 0; i < sphPipelines.size(); ++i) {
+        vkDestroyPipeline(core.device, sphPipelines[i], nullptr);
+        vkDestroyPipelineLayout(core.device, sphPipelineLayouts[i], nullptr);
+    }
+    for (size_t i = 0; i < smokeGridPipelines.size(); ++i) {
+        vkDestroyPipeline(core.device, smokeGridPipelines[i], nullptr);
+        vkDestroyPipelineLayout(core.device, smokeGridPipelineLayouts[i],
+                                nullptr);
+    }
+    for (size_t i = 0; i < particleFieldPipelines.size(); ++i) {
+        vkDestroyPipeline(core.device, particleFieldPipelines[i], nullptr);
+        vkDestroyPipelineLayout(core.device, particleFieldPipelineLayouts[i],
+                                nullptr);
+    }
+    vkDestroyPipeline(core.device, lightVolumePipeline, nullptr);
+    vkDestroyPipelineLayout(core.device, lightVolumePipelineLayout, nullptr);
+    vkDestroyPipeline(core.device, accumulatePipeline, nullptr);
+    vkDestroyPipelineLayout(core.device, accumulatePipelineLayout, nullptr);
 
-    vkDestroyRenderPass(core.device, renderPass, nullptr);
+    if (!options.headless) {
+        vkDestroyRenderPass(core.device, renderPass, nullptr);
+    }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        uniformBuffers[i].Cleanup();
+    for (auto& uniformBuffer : uniformBuffers) {
+        uniformBuffer.Cleanup();
+    }
+    for (auto& marchCounterBuffer : marchCounterBuffers) {
+        marchCounterBuffer.Cleanup();
+    }
+
+    for (auto& readbackBuffer : readbackBuffers) {
+        readbackBuffer.Cleanup();
     }
 
+    profiler.Cleanup();
+
     vkDestroyDescriptorPool(core.device, descriptorPool, nullptr);
 
     vkDestroyDescriptorSetLayout(core.device, computeDescriptorSetLayout,
                                  nullptr);
-    vkDestroyDescriptorSetLayout(core.device, graphicsDescriptorSetLayout,
-                                 nullptr);
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        shaderStorageBuffers[i].Cleanup();
+    if (!options.headless) {
+        vkDestroyDescriptorSetLayout(core.device, graphicsDescriptorSetLayout,
+                                     nullptr);
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroySemaphore(core.device, renderFinishedSemaphores[i], nullptr);
-        vkDestroySemaphore(core.device, imageAvailableSemaphores[i], nullptr);
-        vkDestroySemaphore(core.device, computeFinishedSemaphores[i], nullptr);
-        vkDestroyFence(core.device, inFlightFences[i], nullptr);
-        vkDestroyFence(core.device, computeInFlightFences[i], nullptr);
+    for (auto& shaderStorageBuffer : shaderStorageBuffers) {
+        shaderStorageBuffer.Cleanup();
+    }
+    for (auto& fluidParticleBuffer : fluidParticleBuffers) {
+        fluidParticleBuffer.Cleanup();
+    }
+    sortedFluidParticleBuffer.Cleanup();
+    sphGridBuffer.Cleanup();
+    fluidParticleCellBuffer.Cleanup();
+    smokeGridBuffer.Cleanup();
+    smokeCellParticleBuffer.Cleanup();
+    brickTableBuffer.Cleanup();
+    volumeStream.Cleanup();
+
+    frameScheduler.Cleanup();
+
+    if (core.computeCommandPool != core.commandPool) {
+        vkDestroyCommandPool(core.device, core.computeCommandPool, nullptr);
     }
-
     vkDestroyCommandPool(core.device, core.commandPool, nullptr);
 
+    core.uploader.Cleanup();
+    core.allocator.Cleanup();
+    core.CleanupPipelineCache();
     vkDestroyDevice(core.device, nullptr);
 
     if (enableValidationLayers) {
@@ -115,17 +246,24 @@ void Application::cleanup()
                                             nullptr);
     }
 
-    vkDestroySurfaceKHR(core.instance, core.surface, nullptr);
+    if (!options.headless) {
+        vkDestroySurfaceKHR(core.instance, core.surface, nullptr);
+    }
     vkDestroyInstance(core.instance, nullptr);
 
-    glfwDestroyWindow(core.window);
+    if (core.window != nullptr) glfwDestroyWindow(core.window);
 }
 
 void Application::mainLoop()
 {
     while (!glfwWindowShouldClose(core.window)) {
-        glfwPollEvents();
-        if (core.CurrentPipeline == 1) UpdateParticle(particles);
+        // Nothing to refine once an on-demand image converged, sleep until
+        // the next input
+        if (renderCompute) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(0.1);
+        }
         uiInterface.Render();
         drawFrame();
         double currentTime = glfwGetTime();
@@ -136,6 +274,164 @@ void Application::mainLoop()
     vkDeviceWaitIdle(core.device);
 }
 
+void Application::headlessLoop()
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.frames; ++i) {
+        drawHeadlessFrame();
+        double currentTime = getTime();
+        lastFrameTime = (currentTime - lastTime) * 1000.0;
+        lastTime = currentTime;
+    }
+
+    frameScheduler.WaitIdle();
+
+    // currentFrame is still the slot of the most recent submission
+    if (readbackPending[currentFrame]) retireFrame(currentFrame);
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cout << "[INFO] Rendered " << options.frames << " headless frames in "
+              << seconds << " s (" << options.frames / seconds << " fps)"
+              << std::endl;
+
+    if (!options.outputPath.empty()) writeFramePPM(options.outputPath);
+}
+
+void Application::benchmarkLoop()
+{
+    Benchmark benchmark{WIDTH, HEIGHT, options.warmupFrames,
+                        options.renderScale};
+    const uint32_t totalFrames = options.warmupFrames + options.frames;
+
+    for (int pipeline : {0, 1}) {
+        core.CurrentPipeline = pipeline;
+        frames = 0;
+        gpuFrameTimesMs.assign(totalFrames, 0.0);
+        marchCounterTotals = {};
+        lastFrameTime = Benchmark::frameTime * 1000.0f;
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < totalFrames; ++i) {
+            drawHeadlessFrame();
+        }
+        frameScheduler.WaitIdle();
+        for (uint32_t slot = 0; slot < options.framesInFlight; ++slot) {
+            if (readbackPending[slot]) retireFrame(slot);
+        }
+
+        BenchmarkResult result;
+        result.pipeline = pipeline == 0 ? "fluid" : "smoke";
+        result.shader = pipeline == 0 ? "volumetric.comp" : "smoke.comp";
+        result.wallSeconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        result.gpuTimesMs.assign(
+            gpuFrameTimesMs.begin() + options.warmupFrames,
+            gpuFrameTimesMs.end());
+        result.marchCounters = marchCounterTotals;
+        benchmark.AddResult(std::move(result));
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(core.physicalDevice, &properties);
+
+    benchmark.PrintSummary();
+    benchmark.WriteJson(options.reportPath, properties.deviceName,
+                        properties.driverVersion);
+}
+
+void Application::initCpu()
+{
+    threadPool = std::make_unique<ThreadPool>(options.threads);
+    cpuFluidRenderer = std::make_unique<CpuFluidRenderer>(threadPool.get());
+    cpuSmokeRenderer = std::make_unique<CpuSmokeRenderer>(threadPool.get());
+    particleIntegrator = std::make_unique<ParticleIntegrator>(
+        glm::vec3(boxMinX, boxMinY, boxMinZ),
+        glm::vec3(boxMaxX, boxMaxY, boxMaxZ));
+    initParticles();
+    cpuSmokeRenderer->SetNoiseVolume(&noiseVolume);
+    headlessFrame.resize(static_cast<size_t>(WIDTH) * HEIGHT * 4);
+    fmt::print("[INFO] CPU renderer, {} x {} lanes on {} threads...\n",
+               simd::name, simd::width, threadPool->GetWorkerCount());
+}
+
+void Application::drawCpuFrame()
+{
+    UniformBufferObject ubo = buildUniformBufferObject();
+    if (ubo.useNoiseVolume == 1 && noiseVolume.IsEmpty()) {
+        noiseVolume.LoadOrBake(FilePath::noiseVolumeCachePath, *threadPool);
+    }
+    if (core.CurrentPipeline == 0) {
+        cpuFluidRenderer->Render(ubo, WIDTH, HEIGHT, headlessFrame.data());
+    } else {
+        cpuSmokeRenderer->Render(ubo, particles, WIDTH, HEIGHT,
+                                 headlessFrame.data());
+    }
+    ++frames;
+}
+
+void Application::cpuLoop()
+{
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.frames; ++i) {
+        if (core.CurrentPipeline == 1) advanceParticles();
+        drawCpuFrame();
+        double currentTime = getTime();
+        lastFrameTime = (currentTime - lastTime) * 1000.0;
+        lastTime = currentTime;
+    }
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    double rays = static_cast<double>(WIDTH) * HEIGHT * options.frames;
+    fmt::print("[INFO] Rendered {} CPU frames in {:.3f} s ({:.2f} fps, "
+               "{:.2f} Mrays/s)\n",
+               options.frames, seconds, options.frames / seconds,
+               rays / seconds / 1e6);
+
+    if (!options.outputPath.empty()) writeFramePPM(options.outputPath);
+}
+
+void Application::cpuBenchmarkLoop()
+{
+    Benchmark benchmark{WIDTH, HEIGHT, options.warmupFrames};
+    const uint32_t totalFrames = options.warmupFrames + options.frames;
+
+    for (int pipeline : {0, 1}) {
+        core.CurrentPipeline = pipeline;
+        frames = 0;
+        lastFrameTime = Benchmark::frameTime * 1000.0f;
+
+        BenchmarkResult result;
+        result.pipeline = pipeline == 0 ? "fluid" : "smoke";
+        result.shader = pipeline == 0 ? "volumetric.comp" : "smoke.comp";
+
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < totalFrames; ++i) {
+            if (pipeline == 1) advanceParticles();
+            auto frameStart = std::chrono::steady_clock::now();
+            drawCpuFrame();
+            double ms = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - frameStart)
+                            .count();
+            if (i >= options.warmupFrames) result.gpuTimesMs.push_back(ms);
+        }
+        result.wallSeconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+        benchmark.AddResult(std::move(result));
+    }
+
+    benchmark.PrintSummary();
+    benchmark.WriteJson(options.reportPath,
+                        fmt::format("CPU {} x{}", simd::name,
+                                    threadPool->GetWorkerCount()),
+                        0);
+}
+
 void Application::recreateSwapChain()
 {
     int width = 0, height = 0;
@@ -390,7 +686,7 @@ void Application::createRenderPass()
 
 void Application::createComputeDescriptorSetLayout()
 {
-    std::array<VkDescriptorSetLayoutBinding, 6> layoutBindings{};
+    std::array<VkDescriptorSetLayoutBinding, 27> layoutBindings{};
 
     // Storage texture
     layoutBindings[0].binding = 0;
@@ -437,6 +733,118 @@ void Application::createComputeDescriptorSetLayout()
     layoutBindings[5].pImmutableSamplers = nullptr;
     layoutBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+    // Ray march depth and transmittance
+    layoutBindings[6].binding = 6;
+    layoutBindings[6].descriptorCount = 1;
+    layoutBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[6].pImmutableSamplers = nullptr;
+    layoutBindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Full resolution upsample output
+    layoutBindings[7].binding = 7;
+    layoutBindings[7].descriptorCount = 1;
+    layoutBindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[7].pImmutableSamplers = nullptr;
+    layoutBindings[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Temporal history of the previous frame
+    layoutBindings[8].binding = 8;
+    layoutBindings[8].descriptorCount = 1;
+    layoutBindings[8].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[8].pImmutableSamplers = nullptr;
+    layoutBindings[8].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Temporal history of this frame
+    layoutBindings[9].binding = 9;
+    layoutBindings[9].descriptorCount = 1;
+    layoutBindings[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[9].pImmutableSamplers = nullptr;
+    layoutBindings[9].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Upsample input
+    layoutBindings[10].binding = 10;
+    layoutBindings[10].descriptorCount = 1;
+    layoutBindings[10].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[10].pImmutableSamplers = nullptr;
+    layoutBindings[10].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Particles of the previous frame, simulation input
+    layoutBindings[11].binding = 11;
+    layoutBindings[11].descriptorCount = 1;
+    layoutBindings[11].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[11].pImmutableSamplers = nullptr;
+    layoutBindings[11].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // SPH fluid: particles of this and the previous frame, the previous ones
+    // sorted by cell, the hash grid and each particle's cell. Then the smoke
+    // particle grid and its cell lists.
+    for (uint32_t binding = 12; binding <= 18; ++binding) {
+        layoutBindings[binding].binding = binding;
+        layoutBindings[binding].descriptorCount = 1;
+        layoutBindings[binding].descriptorType =
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        layoutBindings[binding].pImmutableSamplers = nullptr;
+        layoutBindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    // Baked particle field, written by the bake and sampled by the marches
+    layoutBindings[19].binding = 19;
+    layoutBindings[19].descriptorCount = 1;
+    layoutBindings[19].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[19].pImmutableSamplers = nullptr;
+    layoutBindings[19].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    layoutBindings[20].binding = 20;
+    layoutBindings[20].descriptorCount = 1;
+    layoutBindings[20].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[20].pImmutableSamplers = nullptr;
+    layoutBindings[20].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Smoke march counters of the frame in flight
+    layoutBindings[21].binding = 21;
+    layoutBindings[21].descriptorCount = 1;
+    layoutBindings[21].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[21].pImmutableSamplers = nullptr;
+    layoutBindings[21].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Smoke light volume, written by its bake and sampled by the march
+    layoutBindings[22].binding = 22;
+    layoutBindings[22].descriptorCount = 1;
+    layoutBindings[22].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[22].pImmutableSamplers = nullptr;
+    layoutBindings[22].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    layoutBindings[23].binding = 23;
+    layoutBindings[23].descriptorCount = 1;
+    layoutBindings[23].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[23].pImmutableSamplers = nullptr;
+    layoutBindings[23].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Render on demand accumulator, windowed only
+    layoutBindings[24].binding = 24;
+    layoutBindings[24].descriptorCount = 1;
+    layoutBindings[24].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    layoutBindings[24].pImmutableSamplers = nullptr;
+    layoutBindings[24].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    // Imported brick volume: atlas and brick table
+    layoutBindings[25].binding = 25;
+    layoutBindings[25].descriptorCount = 1;
+    layoutBindings[25].descriptorType =
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    layoutBindings[25].pImmutableSamplers = nullptr;
+    layoutBindings[25].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    layoutBindings[26].binding = 26;
+    layoutBindings[26].descriptorCount = 1;
+    layoutBindings[26].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[26].pImmutableSamplers = nullptr;
+    layoutBindings[26].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutInfo.bindingCount = layoutBindings.size();
@@ -606,8 +1014,9 @@ void Application::createGraphicsPipeline()
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(core.device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                  nullptr, &graphicsPipeline) != VK_SUCCESS) {
+    if (vkCreateGraphicsPipelines(core.device, core.pipelineCache, 1,
+                                  &pipelineInfo, nullptr,
+                                  &graphicsPipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
@@ -649,8 +1058,9 @@ void Application::createComputePipeline(std::string computeShaderPath,
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;  // Optional
     pipelineInfo.basePipelineIndex = -1;               // Optional
 
-    if (vkCreateComputePipelines(core.device, VK_NULL_HANDLE, 1, &pipelineInfo,
-                                 nullptr, &computePipeline) != VK_SUCCESS) {
+    if (vkCreateComputePipelines(core.device, core.pipelineCache, 1,
+                                 &pipelineInfo, nullptr,
+                                 &computePipeline) != VK_SUCCESS) {
         throw std::runtime_error("failed to create compute pipeline!");
     }
 
@@ -697,23 +1107,37 @@ void Application::createCommandPool()
                             &core.commandPool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create command pool!");
     }
+
+    core.computeCommandPool = core.commandPool;
+    if (core.computeQueueFamily != core.graphicsQueueFamily) {
+        poolInfo.queueFamilyIndex = core.computeQueueFamily;
+        if (vkCreateCommandPool(core.device, &poolInfo, nullptr,
+                                &core.computeCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create compute command pool!");
+        }
+    }
     std::cout << "[INFO] Vulkan command pool created..." << std::endl;
 }
 
-void Application::createShaderStorageBuffers()
+void Application::initParticles()
 {
     // Initialize particles
     //std::default_random_engine rndEngine((unsigned)time(nullptr));
     //std::uniform_real_distribution<float> rndDist(0.0f, 1.0f);
     std::random_device rd;
-    std::mt19937 mt(rd());
+    // Benchmarks need the same particle motion on every run
+    std::mt19937 mt(options.benchmark ? 1337u : rd());
     std::uniform_real_distribution<double> dist(-0.1, 0.1);
 
-    // Initial particle positions on a circle
-    particles.resize(PARTICLE_COUNT);
-    int z = 0;
+    // The first particles in a row, any further ones spread over the box
+    std::uniform_real_distribution<float> boxX(boxMinX, boxMaxX);
+    std::uniform_real_distribution<float> boxY(boxMinY, boxMaxY);
+    std::uniform_real_distribution<float> boxZ(boxMinZ, boxMaxZ);
+    const int rowLength = 5;
+
+    particles.Resize(options.particleCount);
     float stepX = 0.1;
-    for (auto& particle : particles) {
+    for (uint32_t z = 0; z < particles.Size(); ++z) {
         // float r = 0.25f * sqrt(rndDist(rndEngine));
         // float theta = rndDist(rndEngine) * 2.0f * 3.14159265358979323846f;
         // float x = r * cos(theta) * HEIGHT / WIDTH;
@@ -723,46 +1147,166 @@ void Application::createShaderStorageBuffers()
         // particle.velocity = glm::normalize(glm::vec3(x, y, z)) * 0.00025f;
         // particle.color = glm::vec4(rndDist(rndEngine), rndDist(rndEngine),
         //                            rndDist(rndEngine), 1.0f);
-        particle.position = glm::vec4(-0.3 + z *stepX, 1 ,0,1);
-        particle.velocity = glm::vec3(dist(mt), dist(mt), dist(mt));
-        particle.color = glm::vec4(1, 1, 1, 1);
-        ++z;
+        glm::vec4 position;
+        if (z < rowLength) {
+            position = glm::vec4(-0.3 + z *stepX, 1 ,0,1);
+        } else {
+            position = glm::vec4(boxX(mt), boxY(mt), boxZ(mt), 0.25f);
+        }
+        glm::vec3 velocity = glm::vec3(dist(mt), dist(mt), dist(mt));
+        particles.Set(z, position, velocity, glm::vec4(1, 1, 1, 1));
     }
+}
 
-    VkDeviceSize bufferSize = sizeof(Particle) * PARTICLE_COUNT;
+void Application::createShaderStorageBuffers()
+{
+    initParticles();
+
+    std::vector<Particle> packedParticles = particles.Pack();
+    VkDeviceSize bufferSize = sizeof(Particle) * packedParticles.size();
+
+    // Both ping-pong buffers start from the initial particles, after that
+    // they only change on the GPU
+    for (auto& shaderStorageBuffer : shaderStorageBuffers) {
+        shaderStorageBuffer = Buffer{&core, bufferSize,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+        core.uploader.UploadBuffer(shaderStorageBuffer.GetBuffer(),
+                                   packedParticles.data(), bufferSize);
+    }
 
-    // Create a staging buffer used to upload data to the gpu
-    Buffer stagingBuffer{&core, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+    std::vector<FluidParticle> fluidParticles;
+    initFluidParticles(fluidParticles);
+    VkDeviceSize fluidBufferSize = sizeof(FluidParticle) * fluidParticles.size();
+    for (auto& fluidParticleBuffer : fluidParticleBuffers) {
+        fluidParticleBuffer = Buffer{&core, fluidBufferSize,
+                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+        core.uploader.UploadBuffer(fluidParticleBuffer.GetBuffer(),
+                                   fluidParticles.data(), fluidBufferSize);
+    }
 
-    void *data;
-    vkMapMemory(core.device, stagingBuffer.GetDeviceMemory(), 0, bufferSize, 0,
-                &data);
-    memcpy(data, particles.data(), (size_t)bufferSize);
-    vkUnmapMemory(core.device, stagingBuffer.GetDeviceMemory());
+    // Filled on the GPU every step before they are read
+    sortedFluidParticleBuffer =
+        Buffer{&core, fluidBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    sphGridBuffer = Buffer{&core, SphGrid::bufferSize,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    fluidParticleCellBuffer = Buffer{
+        &core, sizeof(uint32_t) * 2 * fluidParticles.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+
+    smokeGridBuffer = Buffer{&core, SmokeGrid::bufferSize,
+                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    smokeCellParticleBuffer = Buffer{
+        &core, sizeof(uint32_t) * smokeCellParticleCapacity(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+}
 
-    // Copy initial particle data to all storage buffers
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        Buffer shaderStorageBuffer{&core, bufferSize,
-                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                                       VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
-        copyBuffer(stagingBuffer.GetBuffer(), shaderStorageBuffer.GetBuffer(),
-                   bufferSize);
-        shaderStorageBuffers.push_back(shaderStorageBuffer);
+uint32_t Application::smokeCellParticleCapacity() const
+{
+    // The scales never change, so the cells a particle can overlap wherever
+    // it moves are known up front
+    uint64_t capacity = 0;
+    for (uint32_t i = 0; i < particles.Size(); ++i) {
+        const float reach =
+            particles.scale[i] * (1.0f + SmokeGrid::blendScale);
+        const auto span = static_cast<uint32_t>(
+            std::floor(2.0f * reach / SmokeGrid::cellSize)) + 2;
+        capacity += static_cast<uint64_t>(std::min(span, SmokeGrid::width)) *
+                    std::min(span, SmokeGrid::height) *
+                    std::min(span, SmokeGrid::depth);
+    }
+    if (capacity > SmokeGrid::maxCellParticles) {
+        fmt::print("[WARN] Smoke grid needs {} cell entries, keeping {}; "
+                   "crowded cells lose particles\n",
+                   capacity, SmokeGrid::maxCellParticles);
+        capacity = SmokeGrid::maxCellParticles;
     }
+    return static_cast<uint32_t>(capacity);
+}
 
-    stagingBuffer.Cleanup();
+void Application::initFluidParticles(
+    std::vector<FluidParticle>& fluidParticles) const
+{
+    // Dam break: a block at rest spacing against the -x wall, filling the
+    // depth of the box and half its height, growing along x with the count
+    const float spacing = SphGrid::particleSpacing;
+    const auto rows = static_cast<uint32_t>((boxMaxZ - boxMinZ) / spacing);
+    const auto layers =
+        static_cast<uint32_t>(0.5f * (boxMaxY - boxMinY) / spacing);
+
+    // Breaks the symmetry of the lattice, same block on every run
+    std::mt19937 mt(42u);
+    std::uniform_real_distribution<float> jitter(-0.05f * spacing,
+                                                 0.05f * spacing);
+
+    fluidParticles.resize(options.fluidParticleCount);
+    for (uint32_t i = 0; i < fluidParticles.size(); ++i) {
+        uint32_t row = i % rows;
+        uint32_t layer = i / rows % layers;
+        uint32_t column = i / (rows * layers);
+        // +y points down on screen, the block rests on boxMaxY
+        glm::vec3 position{boxMinX + (column + 0.5f) * spacing,
+                           boxMaxY - (layer + 0.5f) * spacing,
+                           boxMinZ + (row + 0.5f) * spacing};
+        position += glm::vec3(jitter(mt), jitter(mt), jitter(mt));
+        fluidParticles[i].position = glm::vec4(position, 0.0f);
+        fluidParticles[i].velocity = glm::vec4(0.0f);
+    }
+}
+
+void Application::createBrickVolume()
+{
+    // Single empty slot, keeps the descriptors valid without a volume
+    BrickVolume placeholder;
+    {
+        ThreadPool pool{1};
+        placeholder.Pack(pool, BrickVolume::slotSize);
+    }
+
+    const glm::uvec3 extent = placeholder.GetAtlasExtent();
+    const auto& atlasTexels = placeholder.GetAtlasTexels();
+    brickAtlasTexture = Texture{&core,
+                                extent.x,
+                                extent.y,
+                                extent.z,
+                                VK_FORMAT_R16_SFLOAT,
+                                atlasTexels.data(),
+                                atlasTexels.size() * sizeof(uint16_t)};
+    brickAtlasTexture.CreateImageView().CreateImageSampler();
+
+    const auto& brickTable = placeholder.GetBrickTable();
+    brickTableBuffer = Buffer{&core, brickTable.size(),
+                              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    core.uploader.UploadBuffer(brickTableBuffer.GetBuffer(), brickTable.data(),
+                               brickTable.size());
+
+    // Headless runs wait for every frame so the images are reproducible
+    if (!options.volumePath.empty()) {
+        volumeStream.Init(&core, options.volumePath, options.volumePlayback,
+                          options.framesInFlight, options.threads,
+                          options.headless);
+    }
 }
 
 void Application::createUniformBuffers()
 {
     VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-    uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    uniformBuffersMapped.resize(options.framesInFlight);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < options.framesInFlight; i++) {
         Buffer uniformBuffer{
             &core,
             bufferSize,
@@ -771,22 +1315,62 @@ void Application::createUniformBuffers()
                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         };
 
-        vkMapMemory(core.device, uniformBuffer.GetDeviceMemory(), 0, bufferSize,
-                    0, &uniformBuffersMapped[i]);
+        uniformBuffersMapped[i] = uniformBuffer.GetMappedData();
 
         uniformBuffers.push_back(uniformBuffer);
     }
+
+    // Cleared on the GPU before every smoke march, read on the host once the
+    // slot comes around again
+    marchCounterBuffersMapped.resize(options.framesInFlight);
+    marchCountersPending.assign(options.framesInFlight, false);
+    for (size_t i = 0; i < options.framesInFlight; i++) {
+        Buffer marchCounterBuffer{
+            &core,
+            MarchCounters::words * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        };
+
+        marchCounterBuffersMapped[i] = marchCounterBuffer.GetMappedData();
+
+        marchCounterBuffers.push_back(marchCounterBuffer);
+    }
+}
+
+void Application::createReadbackBuffers()
+{
+    VkDeviceSize bufferSize = static_cast<VkDeviceSize>(WIDTH) * HEIGHT * 4;
+
+    readbackPending.assign(options.framesInFlight, false);
+    pendingFrameNumbers.assign(options.framesInFlight, 0);
+    if (!readbackEnabled()) return;
+
+    readbackBuffersMapped.resize(options.framesInFlight);
+
+    for (size_t i = 0; i < options.framesInFlight; i++) {
+        Buffer readbackBuffer{&core, bufferSize,
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+
+        readbackBuffersMapped[i] = readbackBuffer.GetMappedData();
+
+        readbackBuffers.push_back(readbackBuffer);
+    }
+    std::cout << "[INFO] Vulkan readback buffers created..." << std::endl;
 }
 
 void Application::createDescriptorPool()
 {
     std::array<VkDescriptorPoolSize, 4> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[0].descriptorCount = computeDescriptorSetCount();
 
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[1].descriptorCount =
-        static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * 2;
+    poolSizes[1].descriptorCount = computeDescriptorSetCount() * 11;
 
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
     poolSizes[2].descriptorCount = 1000;
@@ -809,71 +1393,138 @@ void Application::createDescriptorPool()
 
 void Application::createComputeDescriptorSets()
 {
-    computeStorageTexture =
-        Texture{&core, WIDTH, HEIGHT, VK_FORMAT_R8G8B8A8_UNORM}
+    // One presented image per frame in flight, so the next frame's compute
+    // does not wait for this frame's blit
+    computeStorageTextures.resize(options.framesInFlight);
+    for (auto& computeStorageTexture : computeStorageTextures) {
+        computeStorageTexture =
+            Texture{&core, WIDTH, HEIGHT, VK_FORMAT_R8G8B8A8_UNORM, true}
+                .CreateImageView()
+                .CreateImageSampler();
+        computeStorageTexture.TransitionImageLayout(
+            computeStorageTexture.GetImage(),
+            computeStorageTexture.GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    // With a resolve pass the march writes its own image and upsample.comp
+    // fills computeStorageTextures
+    if (resolveEnabled()) {
+        marchColorTexture = Texture{&core, marchWidth(), marchHeight(),
+                                    VK_FORMAT_R8G8B8A8_UNORM}
+                                .CreateImageView()
+                                .CreateImageSampler();
+        marchColorTexture.TransitionImageLayout(
+            marchColorTexture.GetImage(), marchColorTexture.GetFormat(),
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    }
+
+    if (options.temporalFrames > 0) {
+        for (auto& historyTexture : historyTextures) {
+            historyTexture = Texture{&core, marchWidth(), marchHeight(),
+                                     VK_FORMAT_R16G16B16A16_SFLOAT}
+                                 .CreateImageView()
+                                 .CreateImageSampler();
+            historyTexture.TransitionImageLayout(
+                historyTexture.GetImage(), historyTexture.GetFormat(),
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        }
+    }
+
+    marchAuxTexture = Texture{&core, marchWidth(), marchHeight(),
+                              VK_FORMAT_R16G16B16A16_SFLOAT}
+                          .CreateImageView()
+                          .CreateImageSampler();
+    marchAuxTexture.TransitionImageLayout(
+        marchAuxTexture.GetImage(), marchAuxTexture.GetFormat(),
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+    // Single texel, keeps the descriptors valid until the noise volume is
+    // enabled
+    const uint16_t emptyNoise = 0;
+    emptyNoiseTexture = Texture{&core, 1, 1, 1, VK_FORMAT_R16_SFLOAT,
+                                &emptyNoise, sizeof(emptyNoise)};
+    emptyNoiseTexture.CreateImageView().CreateImageSampler();
+    if (options.noiseVolume) createNoiseVolume();
+
+    particleFieldTexture =
+        Texture{&core, ParticleField::size, ParticleField::size,
+                ParticleField::size, VK_FORMAT_R16G16B16A16_SFLOAT}
             .CreateImageView()
             .CreateImageSampler();
-    computeStorageTexture.TransitionImageLayout(
-        computeStorageTexture.GetImage(), computeStorageTexture.GetFormat(),
+    particleFieldTexture.TransitionImageLayout(
+        particleFieldTexture.GetImage(), particleFieldTexture.GetFormat(),
         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
 
-    computeCloudNoiseTexture = Texture{
-        &core, FilePath::computeCloudNoiseTexturePath, VK_FORMAT_R8G8B8A8_SRGB};
-    computeCloudNoiseTexture.CreateImageView().CreateImageSampler();
-    computeCloudNoiseTexture.TransitionImageLayout(
-        computeCloudNoiseTexture.GetImage(),
-        computeCloudNoiseTexture.GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    lightVolumeTexture =
+        Texture{&core, LightVolume::width, LightVolume::height,
+                LightVolume::depth, VK_FORMAT_R16G16B16A16_SFLOAT}
+            .CreateImageView()
+            .CreateImageSampler();
+    lightVolumeTexture.TransitionImageLayout(
+        lightVolumeTexture.GetImage(), lightVolumeTexture.GetFormat(),
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
+    // Full resolution running mean for render on demand, only windowed
+    if (!options.headless) {
+        accumulationTexture = Texture{&core, WIDTH, HEIGHT,
+                                      VK_FORMAT_R32G32B32A32_SFLOAT}
+                                  .CreateImageView();
+        accumulationTexture.TransitionImageLayout(
+            accumulationTexture.GetImage(), accumulationTexture.GetFormat(),
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    }
 
     computeCloudBlueNoiseTexture =
         Texture{&core, FilePath::computeCloudBlueNoiseTexturePath,
                 VK_FORMAT_R8G8B8A8_SRGB};
     computeCloudBlueNoiseTexture.CreateImageView().CreateImageSampler();
-    computeCloudBlueNoiseTexture.TransitionImageLayout(
-        computeCloudBlueNoiseTexture.GetImage(),
-        computeCloudBlueNoiseTexture.GetFormat(), VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     causticTexture =
         Texture{&core, FilePath::causticTexturePath, VK_FORMAT_R8G8B8A8_SRGB};
     causticTexture.CreateImageView().CreateImageSampler();
-    causticTexture.TransitionImageLayout(
-        causticTexture.GetImage(), causticTexture.GetFormat(),
-        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+    std::vector<VkDescriptorSetLayout> layouts(computeDescriptorSetCount(),
                                                computeDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = computeDescriptorSetCount();
     allocInfo.pSetLayouts = layouts.data();
 
-    computeDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    computeDescriptorSets.resize(computeDescriptorSetCount());
+    boundVolumeIds.assign(computeDescriptorSets.size(), 0);
+    noiseVolumeBound.assign(computeDescriptorSets.size(),
+                            !noiseVolume.IsEmpty());
     if (vkAllocateDescriptorSets(core.device, &allocInfo,
                                  computeDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        std::array<VkWriteDescriptorSet, 6> descriptorWrites{};
+    for (size_t i = 0; i < computeDescriptorSets.size(); i++) {
+        // Set i is bound by the frames of slot i % framesInFlight
+        size_t slot = i % options.framesInFlight;
+        // Bindings 8-10 are only written when their passes run
+        std::vector<VkWriteDescriptorSet> descriptorWrites(8);
+        Texture& computeStorageTexture = computeStorageTextures[slot];
 
-        VkDescriptorImageInfo computeStorageTextureInfo{};
-        computeStorageTextureInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-        computeStorageTextureInfo.imageView =
-            computeStorageTexture.GetImageView();
-        computeStorageTextureInfo.sampler = computeStorageTexture.GetSampler();
+        Texture& marchTexture =
+            resolveEnabled() ? marchColorTexture : computeStorageTexture;
+        VkDescriptorImageInfo marchTextureInfo{};
+        marchTextureInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+        marchTextureInfo.imageView = marchTexture.GetImageView();
+        marchTextureInfo.sampler = marchTexture.GetSampler();
 
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[0].dstSet = computeDescriptorSets[i];
         descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
         descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].pImageInfo = &computeStorageTextureInfo;
+        descriptorWrites[0].pImageInfo = &marchTextureInfo;
         descriptorWrites[0].descriptorCount = 1;
 
         VkDescriptorBufferInfo uniformBufferInfo{};
-        uniformBufferInfo.buffer = uniformBuffers[i].GetBuffer();
+        uniformBufferInfo.buffer = uniformBuffers[slot].GetBuffer();
         uniformBufferInfo.offset = 0;
         uniformBufferInfo.range = sizeof(UniformBufferObject);
 
@@ -885,12 +1536,12 @@ void Application::createComputeDescriptorSets()
         descriptorWrites[1].descriptorCount = 1;
         descriptorWrites[1].pBufferInfo = &uniformBufferInfo;
 
-        // Particles storage buffer
+        // Particles storage buffer, this frame's simulation output
         VkDescriptorBufferInfo particlesStorageBuffer{};
         particlesStorageBuffer.buffer =
-            shaderStorageBuffers[(i - 1) % MAX_FRAMES_IN_FLIGHT].GetBuffer();
+            shaderStorageBuffers[i % 2].GetBuffer();
         particlesStorageBuffer.offset = 0;
-        particlesStorageBuffer.range = sizeof(Particle) * PARTICLE_COUNT;
+        particlesStorageBuffer.range = sizeof(Particle) * particles.Size();
 
         descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[2].dstSet = computeDescriptorSets[i];
@@ -900,10 +1551,121 @@ void Application::createComputeDescriptorSets()
         descriptorWrites[2].descriptorCount = 1;
         descriptorWrites[2].pBufferInfo = &particlesStorageBuffer;
 
-        // Noise texture sampler
+        // and its input
+        VkDescriptorBufferInfo previousParticlesStorageBuffer{};
+        previousParticlesStorageBuffer.buffer =
+            shaderStorageBuffers[(i + 1) % 2].GetBuffer();
+        previousParticlesStorageBuffer.offset = 0;
+        previousParticlesStorageBuffer.range =
+            sizeof(Particle) * particles.Size();
+
+        VkWriteDescriptorSet previousParticlesWrite{};
+        previousParticlesWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        previousParticlesWrite.dstSet = computeDescriptorSets[i];
+        previousParticlesWrite.dstBinding = 11;
+        previousParticlesWrite.descriptorType =
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        previousParticlesWrite.descriptorCount = 1;
+        previousParticlesWrite.pBufferInfo = &previousParticlesStorageBuffer;
+        descriptorWrites.push_back(previousParticlesWrite);
+
+        // SPH fluid, ping-pong like the smoke particles, and the smoke grid
+        const VkDeviceSize fluidRange =
+            sizeof(FluidParticle) * options.fluidParticleCount;
+        std::array<VkDescriptorBufferInfo, 7> simulationBufferInfos{{
+            {fluidParticleBuffers[i % 2].GetBuffer(), 0, fluidRange},
+            {fluidParticleBuffers[(i + 1) % 2].GetBuffer(), 0, fluidRange},
+            {sortedFluidParticleBuffer.GetBuffer(), 0, fluidRange},
+            {sphGridBuffer.GetBuffer(), 0, VK_WHOLE_SIZE},
+            {fluidParticleCellBuffer.GetBuffer(), 0, VK_WHOLE_SIZE},
+            {smokeGridBuffer.GetBuffer(), 0, VK_WHOLE_SIZE},
+            {smokeCellParticleBuffer.GetBuffer(), 0, VK_WHOLE_SIZE},
+        }};
+        for (uint32_t j = 0; j < simulationBufferInfos.size(); ++j) {
+            VkWriteDescriptorSet write{};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = computeDescriptorSets[i];
+            write.dstBinding = 12 + j;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write.descriptorCount = 1;
+            write.pBufferInfo = &simulationBufferInfos[j];
+            descriptorWrites.push_back(write);
+        }
+
+        VkDescriptorBufferInfo marchCounterInfo{
+            marchCounterBuffers[slot].GetBuffer(), 0, VK_WHOLE_SIZE};
+        VkWriteDescriptorSet marchCounterWrite{};
+        marchCounterWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        marchCounterWrite.dstSet = computeDescriptorSets[i];
+        marchCounterWrite.dstBinding = 21;
+        marchCounterWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        marchCounterWrite.descriptorCount = 1;
+        marchCounterWrite.pBufferInfo = &marchCounterInfo;
+        descriptorWrites.push_back(marchCounterWrite);
+
+        // Baked particle field
+        VkDescriptorImageInfo particleFieldInfo{
+            particleFieldTexture.GetSampler(),
+            particleFieldTexture.GetImageView(), VK_IMAGE_LAYOUT_GENERAL};
+        VkWriteDescriptorSet particleFieldWrite{};
+        particleFieldWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        particleFieldWrite.dstSet = computeDescriptorSets[i];
+        particleFieldWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        particleFieldWrite.pImageInfo = &particleFieldInfo;
+        particleFieldWrite.dstBinding = 19;
+        particleFieldWrite.descriptorCount = 1;
+        descriptorWrites.push_back(particleFieldWrite);
+
+        particleFieldWrite.descriptorType =
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        particleFieldWrite.dstBinding = 20;
+        descriptorWrites.push_back(particleFieldWrite);
+
+        // Smoke light volume
+        VkDescriptorImageInfo lightVolumeInfo{
+            lightVolumeTexture.GetSampler(),
+            lightVolumeTexture.GetImageView(), VK_IMAGE_LAYOUT_GENERAL};
+        VkWriteDescriptorSet lightVolumeWrite{};
+        lightVolumeWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        lightVolumeWrite.dstSet = computeDescriptorSets[i];
+        lightVolumeWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        lightVolumeWrite.pImageInfo = &lightVolumeInfo;
+        lightVolumeWrite.dstBinding = 22;
+        lightVolumeWrite.descriptorCount = 1;
+        descriptorWrites.push_back(lightVolumeWrite);
+
+        lightVolumeWrite.descriptorType =
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        lightVolumeWrite.dstBinding = 23;
+        descriptorWrites.push_back(lightVolumeWrite);
+
+        // Imported brick volume
+        VkDescriptorImageInfo brickAtlasInfo{
+            brickAtlasTexture.GetSampler(), brickAtlasTexture.GetImageView(),
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        VkWriteDescriptorSet brickVolumeWrite{};
+        brickVolumeWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        brickVolumeWrite.dstSet = computeDescriptorSets[i];
+        brickVolumeWrite.descriptorType =
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        brickVolumeWrite.pImageInfo = &brickAtlasInfo;
+        brickVolumeWrite.dstBinding = 25;
+        brickVolumeWrite.descriptorCount = 1;
+        descriptorWrites.push_back(brickVolumeWrite);
+
+        VkDescriptorBufferInfo brickTableInfo{brickTableBuffer.GetBuffer(), 0,
+                                              VK_WHOLE_SIZE};
+        brickVolumeWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        brickVolumeWrite.pImageInfo = nullptr;
+        brickVolumeWrite.pBufferInfo = &brickTableInfo;
+        brickVolumeWrite.dstBinding = 26;
+        descriptorWrites.push_back(brickVolumeWrite);
+
+        // Noise volume sampler
+        const Texture& noiseTexture =
+            noiseVolume.IsEmpty() ? emptyNoiseTexture : noiseVolumeTexture;
         VkDescriptorImageInfo noiseTextureInfo{
-            computeCloudNoiseTexture.GetSampler(),
-            computeCloudNoiseTexture.GetImageView(),
+            noiseTexture.GetSampler(), noiseTexture.GetImageView(),
             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
 
         descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -940,21 +1702,101 @@ void Application::createComputeDescriptorSets()
         descriptorWrites[5].dstBinding = 5;
         descriptorWrites[5].descriptorCount = 1;
 
+        // Ray march depth and transmittance
+        VkDescriptorImageInfo marchAuxTextureInfo{
+            marchAuxTexture.GetSampler(), marchAuxTexture.GetImageView(),
+            VK_IMAGE_LAYOUT_GENERAL};
+
+        descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[6].dstSet = computeDescriptorSets[i];
+        descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[6].pImageInfo = &marchAuxTextureInfo;
+        descriptorWrites[6].dstBinding = 6;
+        descriptorWrites[6].descriptorCount = 1;
+
+        // Upsample output, the presented image
+        VkDescriptorImageInfo computeStorageTextureInfo{
+            computeStorageTexture.GetSampler(),
+            computeStorageTexture.GetImageView(), VK_IMAGE_LAYOUT_GENERAL};
+
+        descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[7].dstSet = computeDescriptorSets[i];
+        descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        descriptorWrites[7].pImageInfo = &computeStorageTextureInfo;
+        descriptorWrites[7].dstBinding = 7;
+        descriptorWrites[7].descriptorCount = 1;
+
+        // Temporal history ping-pong
+        Texture& historyOutput = historyTextures[i % 2];
+        Texture& historyInput = historyTextures[(i + 1) % 2];
+        VkDescriptorImageInfo historyInputInfo{historyInput.GetSampler(),
+                                               historyInput.GetImageView(),
+                                               VK_IMAGE_LAYOUT_GENERAL};
+        VkDescriptorImageInfo historyOutputInfo{historyOutput.GetSampler(),
+                                                historyOutput.GetImageView(),
+                                                VK_IMAGE_LAYOUT_GENERAL};
+        if (options.temporalFrames > 0) {
+            VkWriteDescriptorSet write{};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = computeDescriptorSets[i];
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.pImageInfo = &historyInputInfo;
+            write.dstBinding = 8;
+            write.descriptorCount = 1;
+            descriptorWrites.push_back(write);
+
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            write.pImageInfo = &historyOutputInfo;
+            write.dstBinding = 9;
+            descriptorWrites.push_back(write);
+        }
+
+        // Upsample input: this frame's history or the plain march
+        Texture& upsampleInput =
+            options.temporalFrames > 0 ? historyOutput : marchColorTexture;
+        VkDescriptorImageInfo upsampleInputInfo{upsampleInput.GetSampler(),
+                                                upsampleInput.GetImageView(),
+                                                VK_IMAGE_LAYOUT_GENERAL};
+        if (resolveEnabled()) {
+            VkWriteDescriptorSet write{};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = computeDescriptorSets[i];
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.pImageInfo = &upsampleInputInfo;
+            write.dstBinding = 10;
+            write.descriptorCount = 1;
+            descriptorWrites.push_back(write);
+        }
+
+        VkDescriptorImageInfo accumulationInfo{
+            VK_NULL_HANDLE, accumulationTexture.GetImageView(),
+            VK_IMAGE_LAYOUT_GENERAL};
+        if (!options.headless) {
+            VkWriteDescriptorSet write{};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = computeDescriptorSets[i];
+            write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            write.pImageInfo = &accumulationInfo;
+            write.dstBinding = 24;
+            write.descriptorCount = 1;
+            descriptorWrites.push_back(write);
+        }
+
         vkUpdateDescriptorSets(core.device, descriptorWrites.size(),
                                descriptorWrites.data(), 0, nullptr);
     }
 }
 void Application::createGraphicsDescriptorSets()
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT,
+    std::vector<VkDescriptorSetLayout> layouts(options.framesInFlight,
                                                graphicsDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    allocInfo.descriptorSetCount = options.framesInFlight;
     allocInfo.pSetLayouts = layouts.data();
 
-    graphicsDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
+    graphicsDescriptorSets.resize(options.framesInFlight);
 
     if (vkAllocateDescriptorSets(core.device, &allocInfo,
                                  graphicsDescriptorSets.data()) != VK_SUCCESS) {
@@ -963,12 +1805,13 @@ void Application::createGraphicsDescriptorSets()
                   << std::endl;
         throw std::runtime_error("failed to allocate descriptor sets!");
     }
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    for (size_t i = 0; i < options.framesInFlight; ++i) {
         VkDescriptorImageInfo computeStorageTextureInfo{};
         computeStorageTextureInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
         computeStorageTextureInfo.imageView =
-            computeStorageTexture.GetImageView();
-        computeStorageTextureInfo.sampler = computeStorageTexture.GetSampler();
+            computeStorageTextures[i].GetImageView();
+        computeStorageTextureInfo.sampler =
+            computeStorageTextures[i].GetSampler();
 
 
         std::array<VkWriteDescriptorSet, 1> descriptorWrites{};
@@ -987,7 +1830,7 @@ void Application::createGraphicsDescriptorSets()
 
 void Application::createCommandBuffers()
 {
-    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    commandBuffers.resize(options.framesInFlight);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1004,11 +1847,11 @@ void Application::createCommandBuffers()
 
 void Application::createComputeCommandBuffers()
 {
-    computeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    computeCommandBuffers.resize(options.framesInFlight);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = core.commandPool;
+    allocInfo.commandPool = core.computeCommandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = (uint32_t)computeCommandBuffers.size();
 
@@ -1064,11 +1907,17 @@ void Application::recordCommandBuffer(VkCommandBuffer commandBuffer,
     scissor.extent = swapChainExtent;
     vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-    VkDeviceSize offsets[] = {0};
-
+    profiler.BeginScope(commandBuffer, currentFrame, "Blit",
+                        GpuProfiler::Queue::Graphics);
     vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+    profiler.EndScope(commandBuffer, currentFrame,
+                      GpuProfiler::Queue::Graphics);
 
+    profiler.BeginScope(commandBuffer, currentFrame, "UI",
+                        GpuProfiler::Queue::Graphics);
     uiInterface.RecordToCommandBuffer(commandBuffer);
+    profiler.EndScope(commandBuffer, currentFrame,
+                      GpuProfiler::Queue::Graphics);
 
     vkCmdEndRenderPass(commandBuffer);
 
@@ -1079,39 +1928,9 @@ void Application::recordCommandBuffer(VkCommandBuffer commandBuffer,
 
 void Application::createSyncObjects()
 {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    computeFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-    computeInFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-
-    VkSemaphoreCreateInfo semaphoreInfo{};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        if (vkCreateSemaphore(core.device, &semaphoreInfo, nullptr,
-                              &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(core.device, &semaphoreInfo, nullptr,
-                              &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-            vkCreateFence(core.device, &fenceInfo, nullptr,
-                          &inFlightFences[i]) != VK_SUCCESS) {
-            throw std::runtime_error(
-                "failed to create graphics synchronization objects for a "
-                "frame!");
-        }
-        if (vkCreateSemaphore(core.device, &semaphoreInfo, nullptr,
-                              &computeFinishedSemaphores[i]) != VK_SUCCESS ||
-            vkCreateFence(core.device, &fenceInfo, nullptr,
-                          &computeInFlightFences[i]) != VK_SUCCESS) {
-            throw std::runtime_error(
-                "failed to create compute synchronization objects for a "
-                "frame!");
-        }
-    }
+    frameScheduler.Init(core.device, options.framesInFlight);
+    fmt::print("[INFO] Frame scheduler created, {} frames in flight...\n",
+               options.framesInFlight);
 }
 
 void Application::recordComputeCommandBuffer(VkCommandBuffer commandBuffer)
@@ -1124,9 +1943,64 @@ void Application::recordComputeCommandBuffer(VkCommandBuffer commandBuffer)
             "failed to begin recording compute command buffer!");
     }
 
-    vkCmdUpdateBuffer(commandBuffer,
-                      shaderStorageBuffers[currentFrame].GetBuffer(), 0,
-                      sizeof(Particle) * PARTICLE_COUNT, particles.data());
+    const bool countMarch = core.CurrentPipeline == 1;
+    if (countMarch) {
+        // The host read the slot's previous counters before recording,
+        // particles.comp is the first to add to them
+        vkCmdFillBuffer(commandBuffer,
+                        marchCounterBuffers[currentFrame].GetBuffer(), 0,
+                        VK_WHOLE_SIZE, 0);
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    if (timePaused) {
+        recordFrozenSimulation(commandBuffer);
+    } else {
+        if (core.CurrentPipeline == 1) recordParticleSimulation(commandBuffer);
+        if (simulateFluid) recordFluidSimulation(commandBuffer);
+        if (core.CurrentPipeline == 1 || simulateFluid) ++simulationSteps;
+    }
+    if (bakeParticleField) recordParticleField(commandBuffer);
+    if (bakeLightVolume) recordLightVolume(commandBuffer);
+
+    if (readbackEnabled()) {
+        // This slot's previous readback copy must finish before we overwrite
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = computeStorageTextures[currentFrame].GetImage();
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0,
+                             nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    if (resolveEnabled()) {
+        // The previous frame's passes must be done with the march images, and
+        // its history written before it is reprojected
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask =
+            VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &barrier, 0, nullptr, 0, nullptr);
+    }
 
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
                       core.CurrentPipeline == 0 ? computeFluidPipeline
@@ -1136,91 +2010,602 @@ void Application::recordComputeCommandBuffer(VkCommandBuffer commandBuffer)
         commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
         core.CurrentPipeline == 0 ? computeFluidPipelineLayout
                                   : computeSmokePipelineLayout,
-        0, 1, &computeDescriptorSets[currentFrame], 0, nullptr);
+        0, 1, &currentComputeDescriptorSet(), 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "Ray march");
+    vkCmdDispatch(commandBuffer, marchWidth() / 16 + 1, marchHeight() / 16 + 1,
+                  1);
+    profiler.EndScope(commandBuffer, currentFrame);
+
+    if (countMarch) {
+        VkBufferMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.buffer = marchCounterBuffers[currentFrame].GetBuffer();
+        hostBarrier.offset = 0;
+        hostBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                             &hostBarrier, 0, nullptr);
+    }
+    marchCountersPending[currentFrame] = countMarch;
+
+    if (resolveEnabled()) {
+        // Ray march color and aux images are read by the following passes
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                             &barrier, 0, nullptr, 0, nullptr);
+
+        if (options.temporalFrames > 0) {
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                              temporalPipeline);
+            vkCmdBindDescriptorSets(commandBuffer,
+                                    VK_PIPELINE_BIND_POINT_COMPUTE,
+                                    temporalPipelineLayout, 0, 1,
+                                    &currentComputeDescriptorSet(), 0,
+                                    nullptr);
+
+            profiler.BeginScope(commandBuffer, currentFrame, "Temporal");
+            vkCmdDispatch(commandBuffer, marchWidth() / 16 + 1,
+                          marchHeight() / 16 + 1, 1);
+            profiler.EndScope(commandBuffer, currentFrame);
+
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                 &barrier, 0, nullptr, 0, nullptr);
+        }
 
-    vkCmdDispatch(commandBuffer, WIDTH / 16 + 1, HEIGHT / 16 + 1, 1);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          upsamplePipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                upsamplePipelineLayout, 0, 1,
+                                &currentComputeDescriptorSet(), 0,
+                                nullptr);
+
+        profiler.BeginScope(commandBuffer, currentFrame, "Upsample");
+        vkCmdDispatch(commandBuffer, WIDTH / 16 + 1, HEIGHT / 16 + 1, 1);
+        profiler.EndScope(commandBuffer, currentFrame);
+    }
+
+    if (accumulateFrame) recordAccumulation(commandBuffer);
+
+    if (readbackEnabled()) {
+        profiler.BeginScope(commandBuffer, currentFrame, "Readback");
+        recordReadback(commandBuffer);
+        profiler.EndScope(commandBuffer, currentFrame);
+    }
 
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record compute command buffer!");
     }
 }
 
-void Application::drawFrame()
+void Application::recordParticleSimulation(VkCommandBuffer commandBuffer)
 {
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    // The previous frame's simulation has to be written, and the march two
+    // frames back done reading the buffer we are about to overwrite
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
 
-    // Compute submission
-    vkWaitForFences(core.device, 1, &computeInFlightFences[currentFrame],
-                    VK_TRUE, UINT64_MAX);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      particlesPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            particlesPipelineLayout, 0, 1,
+                            &currentComputeDescriptorSet(), 0, nullptr);
 
-    updateUniformBuffer(currentFrame);
+    profiler.BeginScope(commandBuffer, currentFrame, "Particles");
+    vkCmdDispatch(commandBuffer,
+                  (particles.Size() + 255) / 256, 1, 1);
+    profiler.EndScope(commandBuffer, currentFrame);
 
-    vkResetFences(core.device, 1, &computeInFlightFences[currentFrame]);
+    recordSmokeGrid(commandBuffer);
+}
 
-    vkResetCommandBuffer(computeCommandBuffers[currentFrame],
-                         /*VkCommandBufferResetFlagBits*/ 0);
-    recordComputeCommandBuffer(computeCommandBuffers[currentFrame]);
+void Application::recordSmokeGrid(VkCommandBuffer commandBuffer)
+{
+    const uint32_t particleGroups = (particles.Size() + 255) / 256;
+    // The scan is a single workgroup over all cells
+    const std::array<uint32_t, 3> groupCounts{particleGroups, 1,
+                                              particleGroups};
+
+    // The particles have to be written, and the previous march done reading
+    // the grid we are about to clear
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                            VK_ACCESS_SHADER_WRITE_BIT |
+                            VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "Smoke grid");
+    vkCmdFillBuffer(commandBuffer, smokeGridBuffer.GetBuffer(), 0,
+                    VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier clearBarrier{};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &clearBarrier, 0, nullptr, 0, nullptr);
+
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    for (size_t i = 0; i < smokeGridPipelines.size(); ++i) {
+        if (i > 0) {
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                 &barrier, 0, nullptr, 0, nullptr);
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          smokeGridPipelines[i]);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                smokeGridPipelineLayouts[i], 0, 1,
+                                &currentComputeDescriptorSet(), 0, nullptr);
+        vkCmdDispatch(commandBuffer, groupCounts[i], 1, 1);
+    }
+    profiler.EndScope(commandBuffer, currentFrame);
+
+    // The march reads the particles and the grid
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+}
+
+void Application::recordFluidSimulation(VkCommandBuffer commandBuffer)
+{
+    const uint32_t particleGroups = (options.fluidParticleCount + 255) / 256;
+    // Workgroups per pass, the scan is a single workgroup over all cells
+    const std::array<uint32_t, 5> groupCounts{particleGroups, 1, particleGroups,
+                                              particleGroups, particleGroups};
+
+    // The previous frame's step has to be written, and its march done
+    // reading the grid we are about to clear
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                            VK_ACCESS_SHADER_WRITE_BIT |
+                            VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "SPH");
+    vkCmdFillBuffer(commandBuffer, sphGridBuffer.GetBuffer(), 0, VK_WHOLE_SIZE,
+                    0);
+
+    VkMemoryBarrier clearBarrier{};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &clearBarrier, 0, nullptr, 0, nullptr);
+
+    // Hash, scan and sort are the counting sort that makes the neighbour
+    // search of density and force O(n)
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    for (size_t i = 0; i < sphPipelines.size(); ++i) {
+        if (i > 0) {
+            vkCmdPipelineBarrier(commandBuffer,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                                 &barrier, 0, nullptr, 0, nullptr);
+        }
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          sphPipelines[i]);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                sphPipelineLayouts[i], 0, 1,
+                                &currentComputeDescriptorSet(), 0, nullptr);
+        vkCmdDispatch(commandBuffer, groupCounts[i], 1, 1);
+    }
+    profiler.EndScope(commandBuffer, currentFrame);
+
+    // The march reads the sorted particles and the grid
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+}
+
+void Application::recordParticleField(VkCommandBuffer commandBuffer)
+{
+    // The simulation barriers already made the particles visible, only the
+    // previous march has to be done sampling the field
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+
+    const uint32_t pipeline = core.CurrentPipeline;
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      particleFieldPipelines[pipeline]);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            particleFieldPipelineLayouts[pipeline], 0, 1,
+                            &currentComputeDescriptorSet(), 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "Particle field");
+    const uint32_t groups = ParticleField::size / 4;
+    vkCmdDispatch(commandBuffer, groups, groups, groups);
+    profiler.EndScope(commandBuffer, currentFrame);
+
+    // The march samples the field
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+}
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &computeCommandBuffers[currentFrame];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &computeFinishedSemaphores[currentFrame];
+void Application::recordLightVolume(VkCommandBuffer commandBuffer)
+{
+    // The scene inputs are visible already, only the previous march has to
+    // be done sampling the volume
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      lightVolumePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            lightVolumePipelineLayout, 0, 1,
+                            &currentComputeDescriptorSet(), 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "Light volume");
+    vkCmdDispatch(commandBuffer, LightVolume::width / 4,
+                  LightVolume::height / 4, LightVolume::depth / 4);
+    profiler.EndScope(commandBuffer, currentFrame);
+
+    // The march samples the volume
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+}
+
+void Application::recordFrozenSimulation(VkCommandBuffer commandBuffer)
+{
+    // This frame's descriptor set reads the particles from [frameIndex % 2],
+    // carry the last step over so paused frames see the same particles
+    const uint32_t current = frameScheduler.GetFrameIndex() % 2;
+    const uint32_t previous = (current + 1) % 2;
+
+    // The last step has to be written, and the previous frame done reading
+    // the buffer we overwrite
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+
+    if (core.CurrentPipeline == 1) {
+        VkBufferCopy region{0, 0, sizeof(Particle) * particles.Size()};
+        vkCmdCopyBuffer(commandBuffer,
+                        shaderStorageBuffers[previous].GetBuffer(),
+                        shaderStorageBuffers[current].GetBuffer(), 1, &region);
+    }
+    if (simulateFluid) {
+        VkBufferCopy region{0, 0,
+                            sizeof(FluidParticle) * options.fluidParticleCount};
+        vkCmdCopyBuffer(commandBuffer,
+                        fluidParticleBuffers[previous].GetBuffer(),
+                        fluidParticleBuffers[current].GetBuffer(), 1, &region);
+    }
 
-    if (vkQueueSubmit(core.computeQueue, 1, &submitInfo,
-                      computeInFlightFences[currentFrame]) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit compute command buffer!");
-    };
+    // The smoke grid and the SPH grid still hold the last step
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+}
+
+void Application::recordAccumulation(VkCommandBuffer commandBuffer)
+{
+    // The presented image is complete, and the previous frame done with the
+    // accumulator
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                         0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      accumulatePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            accumulatePipelineLayout, 0, 1,
+                            &currentComputeDescriptorSet(), 0, nullptr);
+
+    profiler.BeginScope(commandBuffer, currentFrame, "Accumulate");
+    vkCmdDispatch(commandBuffer, WIDTH / 16 + 1, HEIGHT / 16 + 1, 1);
+    profiler.EndScope(commandBuffer, currentFrame);
+}
+
+void Application::updateVolumeStream(UniformBufferObject& ubo)
+{
+    // The sequence only plays while the smoke shows it
+    VolumeStream::Frame *frame = nullptr;
+    if (volumeStream.IsOpen() && core.CurrentPipeline == 1 &&
+        uiInterface.GetUseBrickVolume()) {
+        frame = volumeStream.Update(ubo.totalTime,
+                                    frameScheduler.GetFrameIndex());
+        uiInterface.SetVolumeStreamStats(volumeStream.GetStats());
+    }
+    ubo.useBrickVolume = frame != nullptr;
+    shownVolumeId = frame != nullptr ? frame->id : 0;
+
+    // No frame in flight uses the current set any more. Sets are rebound to
+    // the empty slot too, so none is bound with an evicted frame.
+    const size_t set =
+        frameScheduler.GetFrameIndex() % computeDescriptorSets.size();
+    if (boundVolumeIds[set] == shownVolumeId) return;
+    boundVolumeIds[set] = shownVolumeId;
+
+    Texture& atlas = frame != nullptr ? frame->atlas : brickAtlasTexture;
+    Buffer& table = frame != nullptr ? frame->table : brickTableBuffer;
+    VkDescriptorImageInfo atlasInfo{atlas.GetSampler(), atlas.GetImageView(),
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkDescriptorBufferInfo tableInfo{table.GetBuffer(), 0, VK_WHOLE_SIZE};
+    std::array<VkWriteDescriptorSet, 2> writes{};
+    for (auto& write : writes) {
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = computeDescriptorSets[set];
+        write.descriptorCount = 1;
+    }
+    writes[0].dstBinding = 25;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[0].pImageInfo = &atlasInfo;
+    writes[1].dstBinding = 26;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[1].pBufferInfo = &tableInfo;
+    vkUpdateDescriptorSets(core.device, static_cast<uint32_t>(writes.size()),
+                           writes.data(), 0, nullptr);
+}
+
+void Application::createNoiseVolume()
+{
+    {
+        ThreadPool pool{options.threads};
+        noiseVolume.LoadOrBake(FilePath::noiseVolumeCachePath, pool);
+    }
+    const auto& noiseTexels = noiseVolume.GetTexels();
+    noiseVolumeTexture =
+        Texture{&core,
+                noiseVolume.GetSize(),
+                noiseVolume.GetSize(),
+                noiseVolume.GetSize(),
+                VK_FORMAT_R16_SFLOAT,
+                noiseTexels.data(),
+                noiseTexels.size() * sizeof(uint16_t)};
+    noiseVolumeTexture.CreateImageView().CreateImageSampler();
+    core.uploader.Wait(core.uploader.Flush());
+}
+
+void Application::updateNoiseVolume(const UniformBufferObject& ubo)
+{
+    // Baked the first time it is enabled. Frames in flight keep sampling the
+    // empty texture, each set is rewritten once no frame uses it any more.
+    if (ubo.useNoiseVolume != 1) return;
+    if (noiseVolume.IsEmpty()) createNoiseVolume();
+
+    const size_t set =
+        frameScheduler.GetFrameIndex() % computeDescriptorSets.size();
+    if (noiseVolumeBound[set]) return;
+    noiseVolumeBound[set] = true;
+
+    VkDescriptorImageInfo noiseTextureInfo{
+        noiseVolumeTexture.GetSampler(), noiseVolumeTexture.GetImageView(),
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = computeDescriptorSets[set];
+    write.dstBinding = 3;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = &noiseTextureInfo;
+    vkUpdateDescriptorSets(core.device, 1, &write, 0, nullptr);
+}
+
+uint64_t Application::hashSceneState(const UniformBufferObject& ubo) const
+{
+    // Everything the presented image depends on. Frame numbers and the
+    // previous camera only drive the jitter and the temporal history.
+    uint64_t hash = 14695981039346656037ull;
+    hashValue(hash, core.CurrentPipeline);
+    hashValue(hash, simulationSteps);
+    hashValue(hash, ubo.totalTime);
+    hashValue(hash, ubo.sunPosition);
+    hashValue(hash, ubo.cameraPosition);
+    hashValue(hash, ubo.windDirection);
+    hashValue(hash, ubo.particleBasedFluid);
+    hashValue(hash, ubo.rotationY);
+    hashValue(hash, ubo.useNoiseVolume);
+    hashValue(hash, ubo.temporalBlend);
+    hashValue(hash, ubo.useParticleField);
+    hashValue(hash, ubo.transmittanceCutoff);
+    hashValue(hash, ubo.stepGrowth);
+    hashValue(hash, ubo.sampleBudget);
+    hashValue(hash, ubo.useLightVolume);
+    hashValue(hash, ubo.useBrickVolume);
+    hashValue(hash, shownVolumeId);
+    return hash;
+}
+
+void Application::updateOnDemand(UniformBufferObject& ubo)
+{
+    renderCompute = true;
+    accumulateFrame = false;
+    if (options.headless || !uiInterface.GetRenderOnDemand()) {
+        sceneHashValid = false;
+        return;
+    }
+
+    uint64_t hash = hashSceneState(ubo);
+    if (!sceneHashValid || hash != sceneHash) {
+        sceneHash = hash;
+        sceneHashValid = true;
+        accumulatedFrames = 0;
+    } else if (accumulatedFrames >= ProgressiveAccumulation::maxSamples) {
+        // Converged, every slot keeps presenting its last mean
+        renderCompute = false;
+    }
+
+    if (renderCompute) {
+        ubo.accumulatedFrames = static_cast<int>(accumulatedFrames++);
+        accumulateFrame = true;
+    }
+    uiInterface.SetAccumulatedFrames(accumulatedFrames);
+}
+
+void Application::recordReadback(VkCommandBuffer commandBuffer)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = computeStorageTextures[currentFrame].GetImage();
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {WIDTH, HEIGHT, 1};
+
+    vkCmdCopyImageToBuffer(commandBuffer,
+                           computeStorageTextures[currentFrame].GetImage(),
+                           VK_IMAGE_LAYOUT_GENERAL,
+                           readbackBuffers[currentFrame].GetBuffer(), 1,
+                           &region);
+
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = readbackBuffers[currentFrame].GetBuffer();
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &hostBarrier, 0, nullptr);
+}
+
+void Application::drawFrame()
+{
+    // Both queues have to be done with this slot before its timings are read,
+    // later frames may still be running
+    currentFrame = frameScheduler.BeginFrame();
+    profiler.Collect(currentFrame);
+    collectMarchCounters(currentFrame, false);
+
+    // Compute submission, none once an on-demand image has converged. The
+    // graphics submission then waits for the slot's last compute work,
+    // which is already done.
+
+    updateUniformBuffer(currentFrame);
+
+    if (renderCompute) {
+        vkResetCommandBuffer(computeCommandBuffers[currentFrame],
+                             /*VkCommandBufferResetFlagBits*/ 0);
+        recordComputeCommandBuffer(computeCommandBuffers[currentFrame]);
+    }
+    // Submits uploads staged since the last frame, resources are usable once
+    // their ticket completes
+    core.uploader.Flush();
+
+    if (renderCompute) {
+        frameScheduler.SubmitCompute(core.computeQueue,
+                                     computeCommandBuffers[currentFrame]);
+    }
 
     // Graphics submission
-    vkWaitForFences(core.device, 1, &inFlightFences[currentFrame], VK_TRUE,
-                    UINT64_MAX);
 
     uint32_t imageIndex;
     VkResult result = vkAcquireNextImageKHR(
         core.device, swapChain, UINT64_MAX,
-        imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        frameScheduler.GetImageAvailableSemaphore(), VK_NULL_HANDLE,
+        &imageIndex);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        // The compute work is submitted, the frame still takes its value
+        frameScheduler.EndFrame();
         recreateSwapChain();
         return;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
-    vkResetFences(core.device, 1, &inFlightFences[currentFrame]);
-
     vkResetCommandBuffer(commandBuffers[currentFrame],
                          /*VkCommandBufferResetFlagBits*/ 0);
     recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
 
-    VkSemaphore waitSemaphores[] = {computeFinishedSemaphores[currentFrame],
-                                    imageAvailableSemaphores[currentFrame]};
-    VkPipelineStageFlags waitStages[] = {
-        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-    submitInfo.waitSemaphoreCount = 2;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &renderFinishedSemaphores[currentFrame];
-
-    if (vkQueueSubmit(core.graphicsQueue, 1, &submitInfo,
-                      inFlightFences[currentFrame]) != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit draw command buffer!");
-    }
+    // Only the fragment shader samples the compute output, the rest of the
+    // frame may start while compute is still running
+    frameScheduler.SubmitGraphics(core.graphicsQueue,
+                                  commandBuffers[currentFrame],
+                                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
+    VkSemaphore renderFinishedSemaphore =
+        frameScheduler.GetRenderFinishedSemaphore();
     presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = &renderFinishedSemaphores[currentFrame];
+    presentInfo.pWaitSemaphores = &renderFinishedSemaphore;
 
     VkSwapchainKHR swapChains[] = {swapChain};
     presentInfo.swapchainCount = 1;
@@ -1229,6 +2614,8 @@ void Application::drawFrame()
     presentInfo.pImageIndices = &imageIndex;
 
     result = vkQueuePresentKHR(core.presentQueue, &presentInfo);
+    frameScheduler.EndFrame();
+    ++frames;
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
         framebufferResized) {
@@ -1237,11 +2624,86 @@ void Application::drawFrame()
     } else if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to present swap chain image!");
     }
+}
+
+void Application::drawHeadlessFrame()
+{
+    currentFrame = frameScheduler.BeginFrame();
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    // The slot's previous frame is done, grab its results before reuse
+    if (readbackPending[currentFrame]) retireFrame(currentFrame);
+
+    updateUniformBuffer(currentFrame);
+
+    vkResetCommandBuffer(computeCommandBuffers[currentFrame],
+                         /*VkCommandBufferResetFlagBits*/ 0);
+    recordComputeCommandBuffer(computeCommandBuffers[currentFrame]);
+    // Submits uploads staged since the last frame, resources are usable once
+    // their ticket completes
+    core.uploader.Flush();
+
+    frameScheduler.SubmitCompute(core.computeQueue,
+                                 computeCommandBuffers[currentFrame]);
+    readbackPending[currentFrame] = true;
+    pendingFrameNumbers[currentFrame] = frames;
+
+    frameScheduler.EndFrame();
     ++frames;
 }
 
+void Application::retireFrame(uint32_t frameIndex)
+{
+    readbackPending[frameIndex] = false;
+
+    profiler.Collect(frameIndex);
+    uint32_t frameNumber = pendingFrameNumbers[frameIndex];
+    if (frameNumber < gpuFrameTimesMs.size()) {
+        gpuFrameTimesMs[frameNumber] = profiler.GetLatest("Particles") +
+                                       profiler.GetLatest("Smoke grid") +
+                                       profiler.GetLatest("SPH") +
+                                       profiler.GetLatest("Particle field") +
+                                       profiler.GetLatest("Light volume") +
+                                       profiler.GetLatest("Ray march") +
+                                       profiler.GetLatest("Temporal") +
+                                       profiler.GetLatest("Upsample");
+    }
+    collectMarchCounters(frameIndex, frameNumber >= options.warmupFrames);
+
+    if (readbackEnabled()) {
+        headlessFrame.resize(static_cast<size_t>(WIDTH) * HEIGHT * 4);
+        memcpy(headlessFrame.data(), readbackBuffersMapped[frameIndex],
+               headlessFrame.size());
+    }
+}
+
+void Application::collectMarchCounters(uint32_t frameIndex, bool measured)
+{
+    if (!marchCountersPending[frameIndex]) return;
+    marchCountersPending[frameIndex] = false;
+
+    const auto *counters =
+        static_cast<const uint32_t *>(marchCounterBuffersMapped[frameIndex]);
+    MarchCounters frameCounters;
+    frameCounters.Add(counters);
+    uiInterface.SetMarchCounters(frameCounters);
+    particlesMoving = frameCounters.movedParticles > 0;
+    if (options.benchmark && measured) marchCounterTotals.Add(counters);
+}
+
+void Application::writeFramePPM(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    file << "P6\n" << WIDTH << " " << HEIGHT << "\n255\n";
+    for (size_t i = 0; i < headlessFrame.size(); i += 4) {
+        file.write(reinterpret_cast<const char *>(&headlessFrame[i]), 3);
+    }
+    std::cout << "[INFO] Frame written to " << path << std::endl;
+}
+
 VkShaderModule Application::createShaderModule(
     const std::vector<char>& code) const
 {
@@ -1311,14 +2773,15 @@ VkExtent2D Application::chooseSwapExtent(
     }
 }
 
-std::vector<const char *> Application::getRequiredExtensions()
+std::vector<const char *> Application::getRequiredExtensions() const
 {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-    std::vector<const char *> extensions(glfwExtensions,
-                                         glfwExtensions + glfwExtensionCount);
+    std::vector<const char *> extensions;
+    if (!options.headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions;
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
     if (enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -1332,32 +2795,11 @@ std::vector<const char *> Application::getRequiredExtensions()
     return extensions;
 }
 
-void Application::UpdateParticle(std::vector<Particle>& particles)
+void Application::advanceParticles()
 {
-     // TODO: Change to SPH if have more time, particle bouncing as fake effect
-    for (auto& particle : particles) {
-        particle.position += glm::vec4(glm::vec3(uiInterface.GetWindDirectionFromUIInput()[0],
-                      uiInterface.GetWindDirectionFromUIInput()[1],
-                      uiInterface.GetWindDirectionFromUIInput()[2]),0) * 0.09f;
-        particle.position += glm::vec4(particle.velocity, 0);
-        if (particle.position.x >= boxMaxX) {
-            particle.position.x = boxMaxX;
-        }
-        else if (particle.position.x <= boxMinX) {
-            particle.position.x = boxMinX;
-        }
-        if (particle.position.y >= boxMaxY) {
-            particle.position.y = boxMaxY;
-        }
-        else if (particle.position.y <= boxMinY) {
-            particle.position.y = boxMinY;
-        }
-        if (particle.position.z >= boxMaxZ) {
-            particle.position.z = boxMaxZ;
-        }
-        else if (particle.position.z <= boxMinZ)
-        {
-            particle.position.z = boxMinZ;
-        }
-    }
+    // Smoke only, the particle based fluid is simulated by sph_*.comp
+    auto wind = uiInterface.GetWindDirectionFromUIInput();
+    particleIntegrator->Advance(particles, *threadPool,
+                                glm::vec3(wind[0], wind[1], wind[2]),
+                                lastFrameTime / 1000.0f);
 }
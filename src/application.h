@@ -9,6 +9,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <optional>
 #include <random>
 #include <set>
@@ -26,11 +27,22 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include "benchmark.h"
+#include "brick_volume.h"
 #include "buffer.h"
 #include "config.h"
 #include "core.h"
+#include "cpu_fluid.h"
+#include "cpu_smoke.h"
+#include "frame_scheduler.h"
+#include "noise_volume.h"
+#include "particle_store.h"
+#include "profiler.h"
+#include "simd.h"
 #include "texture.h"
+#include "thread_pool.h"
 #include "ui.h"
+#include "volume_stream.h"
 
 static float rotatingAngle = 0;
 static double lastX = 0.0;
@@ -61,22 +73,60 @@ static void cursorPositionCallback(GLFWwindow* window, double xpos, double ypos)
 
 class Application {
 public:
+    Application() = default;
+    explicit Application(const RenderOptions& options) : options{options} {}
     ~Application() { glfwTerminate();}
     void run()
     {
-        initWindow();
-        initVulkan();
-        uiInterface.Init(2, renderPass);
-        mainLoop();
+        uiInterface.SetParticleBasedFluid(options.particleFluid);
+        uiInterface.SetMarchPolicy(options.marchPolicy);
+        uiInterface.SetRenderOnDemand(options.renderOnDemand);
+        uiInterface.SetUseNoiseVolume(options.noiseVolume);
+        uiInterface.SetBrickVolumeLoaded(!options.volumePath.empty());
+        if (options.cpu) {
+            initHeadless();
+            initCpu();
+            if (options.benchmark) {
+                cpuBenchmarkLoop();
+            } else {
+                cpuLoop();
+            }
+            return;
+        }
+        if (options.headless) {
+            initHeadless();
+            initVulkan();
+            if (options.benchmark) {
+                benchmarkLoop();
+            } else {
+                headlessLoop();
+            }
+        } else {
+            initWindow();
+            initVulkan();
+            uiInterface.Init(2, renderPass);
+            mainLoop();
+        }
         cleanup();
     }
 
+    // RGBA8 pixels of the last frame read back in headless mode
+    const std::vector<uint8_t>& GetHeadlessFrame() const
+    {
+        return headlessFrame;
+    }
+
 private:
     //----------------------------------------------------
     // Initialization
     //----------------------------------------------------
     void initWindow();
+    void initHeadless();
     void initVulkan();
+    void initCpu();
+    void initParticles();
+    void initFluidParticles(std::vector<FluidParticle>& fluidParticles) const;
+    uint32_t smokeCellParticleCapacity() const;
     void cleanup();
     void mainLoop();
     void recreateSwapChain();
@@ -97,6 +147,7 @@ private:
     void createFramebuffers();
     void createCommandPool();
     void createShaderStorageBuffers();
+    void createBrickVolume();
     void createUniformBuffers();
     void createDescriptorPool();
     void createComputeDescriptorSets();
@@ -107,10 +158,33 @@ private:
     void recordCommandBuffer(VkCommandBuffer commandBuffer,
                              uint32_t imageIndex);
     void createSyncObjects();
+    void createReadbackBuffers();
     //----------------------------------------------------
     // Rendering
     //----------------------------------------------------
     void drawFrame();
+    void headlessLoop();
+    void benchmarkLoop();
+    void drawHeadlessFrame();
+    void recordReadback(VkCommandBuffer commandBuffer);
+    void recordParticleSimulation(VkCommandBuffer commandBuffer);
+    void recordSmokeGrid(VkCommandBuffer commandBuffer);
+    void recordFluidSimulation(VkCommandBuffer commandBuffer);
+    void recordParticleField(VkCommandBuffer commandBuffer);
+    void recordLightVolume(VkCommandBuffer commandBuffer);
+    void recordFrozenSimulation(VkCommandBuffer commandBuffer);
+    void recordAccumulation(VkCommandBuffer commandBuffer);
+    void updateVolumeStream(UniformBufferObject& ubo);
+    void createNoiseVolume();
+    void updateNoiseVolume(const UniformBufferObject& ubo);
+    void updateOnDemand(UniformBufferObject& ubo);
+    uint64_t hashSceneState(const UniformBufferObject& ubo) const;
+    void retireFrame(uint32_t frameIndex);
+    void collectMarchCounters(uint32_t frameIndex, bool measured);
+    void writeFramePPM(const std::string& path) const;
+    void cpuLoop();
+    void cpuBenchmarkLoop();
+    void drawCpuFrame();
     [[nodiscard]] VkShaderModule createShaderModule(
         const std::vector<char>& code) const;
     static VkSurfaceFormatKHR chooseSwapSurfaceFormat(
@@ -119,7 +193,7 @@ private:
         const std::vector<VkPresentModeKHR>& availablePresentModes);
     [[nodiscard]] VkExtent2D chooseSwapExtent(
         const VkSurfaceCapabilitiesKHR& capabilities) const;
-    static std::vector<const char *> getRequiredExtensions();
+    [[nodiscard]] std::vector<const char *> getRequiredExtensions() const;
 
     static void framebufferResizeCallback(GLFWwindow *window, int width,
                                           int height)
@@ -146,31 +220,76 @@ private:
     // Physics
     //----------------------------------------------------
 
-    void UpdateParticle(std::vector<Particle>& particles);
+    // CPU renderer only, the GPU pipelines simulate in particles.comp
+    void advanceParticles();
 
     //----------------------------------------------------
     // Util
     //----------------------------------------------------
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+    // Ray march resolution, rounded up so the upsample never reads past it
+    uint32_t marchWidth() const
+    {
+        return (WIDTH + options.renderScale - 1) / options.renderScale;
+    }
+    uint32_t marchHeight() const
+    {
+        return (HEIGHT + options.renderScale - 1) / options.renderScale;
+    }
+
+    // The march does not write the presented image directly, upsample.comp
+    // resolves it (also at full resolution, after temporal accumulation)
+    bool resolveEnabled() const
     {
-        VkCommandBuffer commandBuffer = core.beginSingleTimeCommands();
+        return options.renderScale > 1 || options.temporalFrames > 0;
+    }
 
-        VkBufferCopy copyRegion{};
-        copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    // An odd number of frames in flight gets two descriptor sets per slot,
+    // so consecutive frames always alternate between the history textures
+    uint32_t computeDescriptorSetCount() const
+    {
+        return options.framesInFlight % 2 == 0 ? options.framesInFlight
+                                               : options.framesInFlight * 2;
+    }
+    VkDescriptorSet& currentComputeDescriptorSet()
+    {
+        return computeDescriptorSets[frameScheduler.GetFrameIndex() %
+                                     computeDescriptorSets.size()];
+    }
 
-        core.endSingleTimeCommands(commandBuffer);
+    // Benchmarks only time the march, pixels are not copied back
+    bool readbackEnabled() const
+    {
+        return options.headless && !options.benchmark;
     }
 
     bool isKeyPressed(GLFWwindow* window, int key) {
-        return glfwGetKey(window, key) == GLFW_PRESS;
+        return window != nullptr && glfwGetKey(window, key) == GLFW_PRESS;
     }
 
-    void updateUniformBuffer(uint32_t currentImage)
+    double getTime() const
+    {
+        if (!options.headless) return glfwGetTime();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             startTime)
+            .count();
+    }
+
+    // Clock of the animations, stands still while "Pause time" is checked
+    double sceneTime()
+    {
+        const bool paused = uiInterface.GetPauseTime();
+        const double now = getTime();
+        if (paused && !timePaused) pauseStart = now;
+        if (!paused && timePaused) pausedSeconds += now - pauseStart;
+        timePaused = paused;
+        return (paused ? pauseStart : now) - pausedSeconds;
+    }
+
+    UniformBufferObject buildUniformBufferObject()
     {
         UniformBufferObject ubo{};
         ubo.deltaTime = lastFrameTime * 2.0f;
-        ubo.totalTime = static_cast<float_t>(glfwGetTime());
+        ubo.totalTime = static_cast<float_t>(sceneTime());
         ubo.sunPosition = glm::vec3(uiInterface.GetSunPositionFromUIInput()[0], uiInterface.GetSunPositionFromUIInput()[1] - 5, uiInterface.GetSunPositionFromUIInput()[2]);
         ubo.frame = frames;
         ubo.windDirection =
@@ -178,6 +297,13 @@ private:
                       uiInterface.GetWindDirectionFromUIInput()[1],
                       uiInterface.GetWindDirectionFromUIInput()[2]);
         ubo.particleBasedFluid = uiInterface.GetParticleBasedFluid();
+        ubo.useNoiseVolume = uiInterface.GetUseNoiseVolume();
+        ubo.useParticleField = uiInterface.GetUseParticleField();
+        MarchPolicy marchPolicy = uiInterface.GetMarchPolicy();
+        ubo.transmittanceCutoff = marchPolicy.transmittanceCutoff;
+        ubo.stepGrowth = marchPolicy.stepGrowth;
+        ubo.sampleBudget = static_cast<int>(marchPolicy.sampleBudget);
+        ubo.useLightVolume = uiInterface.GetUseLightVolume();
         if (!ubo.particleBasedFluid && core.CurrentPipeline == 0)
             ubo.rotationY = rotatingAngle;
         else {
@@ -205,11 +331,67 @@ private:
 
         ubo.cameraPosition = cameraPos;
 
+        if (options.benchmark) {
+            // Fixed camera path, sun and clock so runs stay comparable
+            Benchmark::ApplyFrameState(ubo, frames, core.CurrentPipeline);
+        }
+
+        // Only the jittered smoke march is accumulated, history from the
+        // other pipeline or a restarted run is dropped
+        if (options.temporalFrames > 0 && core.CurrentPipeline == 1) {
+            ubo.temporalBlend =
+                1.0f / static_cast<float>(options.temporalFrames);
+        }
+        ubo.historyValid =
+            frames > 0 && historyPipeline == core.CurrentPipeline;
+        ubo.prevCameraPosition =
+            ubo.historyValid ? prevCameraPosition : ubo.cameraPosition;
+        ubo.prevRotationY = ubo.historyValid ? prevRotationY : ubo.rotationY;
+        prevCameraPosition = ubo.cameraPosition;
+        prevRotationY = ubo.rotationY;
+        historyPipeline = core.CurrentPipeline;
+        return ubo;
+    }
+
+    void updateUniformBuffer(uint32_t currentImage)
+    {
+        UniformBufferObject ubo = buildUniformBufferObject();
+        updateVolumeStream(ubo);
+        updateNoiseVolume(ubo);
+        updateOnDemand(ubo);
+        if (!renderCompute) return;
+
+        // The SPH passes only run while the fluid march reads them
+        simulateFluid = core.CurrentPipeline == 0 && ubo.particleBasedFluid;
+        bakeParticleField = ubo.useParticleField &&
+                            (core.CurrentPipeline == 1 || simulateFluid);
+        // The light volume is kept until the sun or the smoke scene changes,
+        // paused time stops the noise and the particles
+        LightVolumeInputs lightInputs{ubo.sunPosition, ubo.windDirection,
+                                      ubo.useNoiseVolume,
+                                      ubo.useParticleField,
+                                      ubo.useBrickVolume,
+                                      shownVolumeId};
+        const bool smokeAnimated =
+            !timePaused &&
+            (lightInputs.windDirection != glm::vec3(0.0f) || particlesMoving);
+        bakeLightVolume =
+            core.CurrentPipeline == 1 && ubo.useLightVolume &&
+            (!lightVolumeValid || lightInputs != lightVolumeInputs ||
+             smokeAnimated);
+        if (bakeLightVolume) {
+            lightVolumeInputs = lightInputs;
+            lightVolumeValid = true;
+        } else if (smokeAnimated) {
+            // Moved on while the light volume was off or not shown
+            lightVolumeValid = false;
+        }
         memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
     }
 
 
 private:
+    RenderOptions options;
     Core core;
     VkDebugUtilsMessengerEXT debugMessenger;
 
@@ -229,15 +411,79 @@ private:
     VkPipeline computeFluidPipeline;
     VkPipelineLayout computeSmokePipelineLayout; // pipeline flag 1
     VkPipeline computeSmokePipeline;
+    VkPipelineLayout upsamplePipelineLayout;  // only used by resolveEnabled()
+    VkPipeline upsamplePipeline;
+    VkPipelineLayout temporalPipelineLayout;  // only used with temporalFrames
+    VkPipeline temporalPipeline;
+    VkPipelineLayout particlesPipelineLayout;  // smoke particle simulation
+    VkPipeline particlesPipeline;
+    // SPH fluid passes in dispatch order: hash, scan, sort, density, force
+    std::array<VkPipelineLayout, 5> sphPipelineLayouts;
+    std::array<VkPipeline, 5> sphPipelines;
+    // Smoke particle grid passes in dispatch order: count, scan, fill
+    std::array<VkPipelineLayout, 3> smokeGridPipelineLayouts;
+    std::array<VkPipeline, 3> smokeGridPipelines;
+    // Particle field bake per pipeline flag: 0 = fluid, 1 = smoke
+    std::array<VkPipelineLayout, 2> particleFieldPipelineLayouts;
+    std::array<VkPipeline, 2> particleFieldPipelines;
+    VkPipelineLayout lightVolumePipelineLayout;  // smoke only
+    VkPipeline lightVolumePipeline;
+    VkPipelineLayout accumulatePipelineLayout;  // windowed, render on demand
+    VkPipeline accumulatePipeline;
 
     VkPipelineLayout graphicsPipelineLayout;
     VkPipeline graphicsPipeline;
 
-    std::vector<Buffer> shaderStorageBuffers;
+    // Particle ping-pong, descriptor set i simulates into [i % 2] from the
+    // other
+    std::array<Buffer, 2> shaderStorageBuffers;
+    // SPH fluid ping-pong in the same way, plus the counting sort scratch
+    std::array<Buffer, 2> fluidParticleBuffers;
+    Buffer sortedFluidParticleBuffer;
+    Buffer sphGridBuffer;
+    Buffer fluidParticleCellBuffer;
+    bool simulateFluid = false;
+    // Smoke particle grid, rebuilt after every particle step
+    Buffer smokeGridBuffer;
+    Buffer smokeCellParticleBuffer;
+    // Baked by the active pipeline after its simulation
+    Texture particleFieldTexture;
+    bool bakeParticleField = false;
+    // Smoke sun lighting, rebaked only when its inputs change
+    Texture lightVolumeTexture;
+    bool bakeLightVolume = false;
+    bool lightVolumeValid = false;
+    LightVolumeInputs lightVolumeInputs;
+    // Last retired smoke frame still moved particles, assumed until known
+    bool particlesMoving = true;
+
+    // Paused time freezes the clock and the simulations
+    bool timePaused = false;
+    double pauseStart = 0.0;
+    double pausedSeconds = 0.0;
+    uint64_t simulationSteps = 0;  // recorded particle or SPH steps
+    // Render on demand: the compute passes are skipped once the accumulator
+    // holds maxSamples of an unchanged scene
+    Texture accumulationTexture;  // windowed only
+    bool renderCompute = true;
+    bool accumulateFrame = false;
+    bool sceneHashValid = false;
+    uint64_t sceneHash = 0;
+    uint32_t accumulatedFrames = 0;
 
     glm::vec3 cameraPos = glm::vec3(0, 0, 10);
+    // Camera of the previous frame for the temporal reprojection
+    glm::vec3 prevCameraPosition = glm::vec3(0, 0, 10);
+    float prevRotationY = 0.0f;
+    int historyPipeline = -1;
     std::vector<Buffer> uniformBuffers;
     std::vector<void *> uniformBuffersMapped;
+    // Smoke march counters per frame in flight, pending until the slot's
+    // frame is retired
+    std::vector<Buffer> marchCounterBuffers;
+    std::vector<void *> marchCounterBuffersMapped;
+    std::vector<bool> marchCountersPending;
+    MarchCounters marchCounterTotals;  // benchmark frames after the warmup
 
     VkDescriptorPool descriptorPool;
     std::vector<VkDescriptorSet> computeDescriptorSets;
@@ -245,24 +491,57 @@ private:
 
     std::vector<VkCommandBuffer> commandBuffers;
     std::vector<VkCommandBuffer> computeCommandBuffers;
-    Texture computeStorageTexture;
+    // Presented / read back image, one per frame in flight
+    std::vector<Texture> computeStorageTextures;
+    Texture marchColorTexture;  // march output when resolveEnabled()
+    Texture marchAuxTexture;
+    // Temporal accumulation, descriptor set i writes [i % 2] and reads the
+    // other
+    std::array<Texture, 2> historyTextures;
     Texture causticTexture;
-    Texture computeCloudNoiseTexture;
+    // Loaded or baked once it is enabled, until then the sets bind the empty
+    // texture. noiseVolumeBound marks the sets rewritten since.
+    NoiseVolume noiseVolume;
+    Texture noiseVolumeTexture;
+    Texture emptyNoiseTexture;
+    std::vector<bool> noiseVolumeBound;
+    // Imported smoke density: an empty slot, bound until a frame of the
+    // stream is resident. boundVolumeIds holds the frame id bound to each
+    // compute descriptor set, 0 for the empty slot.
+    Texture brickAtlasTexture;
+    Buffer brickTableBuffer;
+    VolumeStream volumeStream;
+    uint64_t shownVolumeId = 0;
+    std::vector<uint64_t> boundVolumeIds;
     Texture computeCloudBlueNoiseTexture;
 
-    std::vector<VkSemaphore> imageAvailableSemaphores;
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkSemaphore> computeFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    std::vector<VkFence> computeInFlightFences;
-    uint32_t currentFrame = 0;
+    FrameScheduler frameScheduler;
+    uint32_t currentFrame = 0;  // slot of the frame being recorded
     uint32_t frames = 0;
 
     float lastFrameTime = 0.0f;
     bool framebufferResized = false;
     double lastTime = 0.0f;
 
-    UserInterface uiInterface{&core};
-
-    std::vector<Particle> particles;
+    GpuProfiler profiler{&core};
+    UserInterface uiInterface{&core, &profiler};
+
+    // Headless mode: per frame host visible copies of the storage texture
+    std::vector<Buffer> readbackBuffers;
+    std::vector<void *> readbackBuffersMapped;
+    std::vector<bool> readbackPending;
+    std::vector<uint32_t> pendingFrameNumbers;
+    std::vector<uint8_t> headlessFrame;
+    std::vector<double> gpuFrameTimesMs;
+    std::chrono::steady_clock::time_point startTime =
+        std::chrono::steady_clock::now();
+
+    // CPU mode: SIMD ray marchers on a work stealing pool
+    std::unique_ptr<ThreadPool> threadPool;
+    std::unique_ptr<CpuFluidRenderer> cpuFluidRenderer;
+    std::unique_ptr<CpuSmokeRenderer> cpuSmokeRenderer;
+    std::unique_ptr<ParticleIntegrator> particleIntegrator;
+
+    // Smoke particles, packed into the GPU layout only for the upload
+    ParticleStore particles;
 };
@@ -0,0 +1,201 @@
+#include "benchmark.h"
+
+#include <fmt/format.h>
+
+#include <glm/gtc/constants.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Quoted JSON string, driver provided names may contain quotes or
+// backslashes
+std::string jsonString(const std::string& value)
+{
+    std::string quoted = "\"";
+    for (const char c : value) {
+        switch (c) {
+        case '"': quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                quoted += fmt::format("\\u{:04x}", static_cast<int>(c));
+            } else {
+                quoted += c;
+            }
+        }
+    }
+    return quoted + '"';
+}
+
+}  // namespace
+
+void Benchmark::ApplyFrameState(UniformBufferObject& ubo, uint32_t frame,
+                                int pipeline)
+{
+    const float t = static_cast<float>(frame % cameraPathFrames) /
+                    static_cast<float>(cameraPathFrames);
+    const float angle = 2.0f * glm::pi<float>() * t;
+
+    ubo.deltaTime = frameTime * 1000.0f * 2.0f;
+    ubo.totalTime = static_cast<float>(frame) * frameTime;
+    ubo.frame = frame;
+    // Same values as the UI defaults
+    ubo.sunPosition = glm::vec3(2.0f, -15.0f, 4.0f);
+    ubo.windDirection = glm::vec3(0.2f, -0.2f, 1.0f);
+    ubo.particleBasedFluid = 0;
+
+    // Slow sway around the default view at (0, 0, 10)
+    ubo.cameraPosition = glm::vec3(1.5f * std::sin(angle),
+                                   0.25f * std::sin(2.0f * angle),
+                                   10.0f - 1.0f * (1.0f - std::cos(angle)));
+    ubo.rotationY = pipeline == 0 ? 0.3f * std::sin(angle) : 0.0f;
+}
+
+void Benchmark::AddResult(BenchmarkResult result)
+{
+    if (result.gpuTimesMs.empty()) {
+        throw std::runtime_error("benchmark produced no GPU timings!");
+    }
+    results.push_back(std::move(result));
+}
+
+double Benchmark::percentile(const std::vector<double>& sorted, double p)
+{
+    // Linear interpolation between the closest ranks
+    double rank = p * static_cast<double>(sorted.size() - 1);
+    size_t lower = static_cast<size_t>(std::floor(rank));
+    size_t upper = std::min(lower + 1, sorted.size() - 1);
+    double fraction = rank - static_cast<double>(lower);
+    return sorted[lower] + (sorted[upper] - sorted[lower]) * fraction;
+}
+
+Benchmark::Statistics Benchmark::computeStatistics(
+    const std::vector<double>& timesMs) const
+{
+    std::vector<double> sorted = timesMs;
+    std::sort(sorted.begin(), sorted.end());
+
+    Statistics stats;
+    stats.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) /
+                 static_cast<double>(sorted.size());
+    double variance = 0.0;
+    for (double time : sorted) {
+        variance += (time - stats.mean) * (time - stats.mean);
+    }
+    stats.stddev = std::sqrt(variance / static_cast<double>(sorted.size()));
+    stats.min = sorted.front();
+    stats.max = sorted.back();
+    stats.p50 = percentile(sorted, 0.50);
+    stats.p90 = percentile(sorted, 0.90);
+    stats.p95 = percentile(sorted, 0.95);
+    stats.p99 = percentile(sorted, 0.99);
+
+    // One primary ray per marched pixel
+    double rays =
+        static_cast<double>((width + renderScale - 1) / renderScale) *
+        static_cast<double>((height + renderScale - 1) / renderScale);
+    stats.mraysPerSecond = rays / (stats.mean * 1e-3) / 1e6;
+    return stats;
+}
+
+void Benchmark::PrintSummary() const
+{
+    for (const auto& result : results) {
+        Statistics stats = computeStatistics(result.gpuTimesMs);
+        fmt::print(
+            "[BENCH] {:<6} {} frames  mean {:.3f} ms  p50 {:.3f} ms  "
+            "p99 {:.3f} ms  {:.1f} Mrays/s\n",
+            result.pipeline, result.gpuTimesMs.size(), stats.mean, stats.p50,
+            stats.p99, stats.mraysPerSecond);
+        const MarchCounters& counters = result.marchCounters;
+        if (counters.rays > 0) {
+            fmt::print(
+                "[BENCH] {:<6} {:.1f} samples/ray  {:.1f} saved steps/ray  "
+                "{:.1f}% rays cut off\n",
+                result.pipeline,
+                counters.PerRay(counters.marchSamples +
+                                counters.lightSamples +
+                                counters.shadowSamples),
+                counters.PerRay(counters.savedSamples),
+                100.0 * counters.PerRay(counters.terminatedRays +
+                                        counters.exhaustedRays));
+        }
+    }
+}
+
+void Benchmark::WriteJson(const std::string& path,
+                          const std::string& deviceName,
+                          uint32_t driverVersion) const
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    file << "{\n";
+    file << fmt::format("  \"device\": {},\n", jsonString(deviceName));
+    file << fmt::format("  \"driverVersion\": {},\n", driverVersion);
+    file << fmt::format("  \"width\": {},\n", width);
+    file << fmt::format("  \"height\": {},\n", height);
+    file << fmt::format("  \"renderScale\": {},\n", renderScale);
+    file << fmt::format("  \"warmupFrames\": {},\n", warmupFrames);
+    file << "  \"pipelines\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        Statistics stats = computeStatistics(result.gpuTimesMs);
+
+        file << "    {\n";
+        file << fmt::format("      \"name\": {},\n",
+                            jsonString(result.pipeline));
+        file << fmt::format("      \"shader\": {},\n",
+                            jsonString(result.shader));
+        file << fmt::format("      \"frames\": {},\n",
+                            result.gpuTimesMs.size());
+        file << fmt::format("      \"wallSeconds\": {:.6f},\n",
+                            result.wallSeconds);
+        file << fmt::format("      \"meanMs\": {:.6f},\n", stats.mean);
+        file << fmt::format("      \"stddevMs\": {:.6f},\n", stats.stddev);
+        file << fmt::format("      \"minMs\": {:.6f},\n", stats.min);
+        file << fmt::format("      \"maxMs\": {:.6f},\n", stats.max);
+        file << fmt::format("      \"p50Ms\": {:.6f},\n", stats.p50);
+        file << fmt::format("      \"p90Ms\": {:.6f},\n", stats.p90);
+        file << fmt::format("      \"p95Ms\": {:.6f},\n", stats.p95);
+        file << fmt::format("      \"p99Ms\": {:.6f},\n", stats.p99);
+        file << fmt::format("      \"mraysPerSecond\": {:.3f},\n",
+                            stats.mraysPerSecond);
+        const MarchCounters& counters = result.marchCounters;
+        if (counters.rays > 0) {
+            file << fmt::format(
+                "      \"marchCounters\": {{\"rays\": {}, "
+                "\"marchSamplesPerRay\": {:.3f}, "
+                "\"lightSamplesPerRay\": {:.3f}, "
+                "\"shadowSamplesPerRay\": {:.3f}, "
+                "\"savedStepsPerRay\": {:.3f}, "
+                "\"terminatedRays\": {}, \"exhaustedRays\": {}}},\n",
+                counters.rays, counters.PerRay(counters.marchSamples),
+                counters.PerRay(counters.lightSamples),
+                counters.PerRay(counters.shadowSamples),
+                counters.PerRay(counters.savedSamples),
+                counters.terminatedRays, counters.exhaustedRays);
+        }
+        file << "      \"gpuTimesMs\": [";
+        for (size_t j = 0; j < result.gpuTimesMs.size(); ++j) {
+            file << fmt::format("{}{:.6f}", j == 0 ? "" : ", ",
+                                result.gpuTimesMs[j]);
+        }
+        file << "]\n";
+        file << (i + 1 < results.size() ? "    },\n" : "    }\n");
+    }
+    file << "  ]\n";
+    file << "}\n";
+
+    fmt::print("[INFO] Benchmark report written to {}\n", path);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+struct BenchmarkResult {
+    std::string pipeline;
+    std::string shader;
+    std::vector<double> gpuTimesMs;
+    double wallSeconds = 0.0;
+    // Measured frames only, empty for pipelines without counters
+    MarchCounters marchCounters;
+};
+
+class Benchmark {
+public:
+    // Simulated frame time, replaces glfwGetTime() during a benchmark
+    static constexpr float frameTime = 1.0f / 60.0f;
+    // Frames for one loop of the camera path, independent of the run length
+    static constexpr uint32_t cameraPathFrames = 240;
+
+    Benchmark(uint32_t width, uint32_t height, uint32_t warmupFrames,
+              uint32_t renderScale = 1)
+        : width{width},
+          height{height},
+          warmupFrames{warmupFrames},
+          renderScale{renderScale}
+    {
+    }
+
+    // Overrides all time and input driven UBO fields with a fixed script
+    static void ApplyFrameState(UniformBufferObject& ubo, uint32_t frame,
+                                int pipeline);
+
+    void AddResult(BenchmarkResult result);
+    void PrintSummary() const;
+    void WriteJson(const std::string& path, const std::string& deviceName,
+                   uint32_t driverVersion) const;
+
+private:
+    struct Statistics {
+        double mean = 0.0;
+        double stddev = 0.0;
+        double min = 0.0;
+        double max = 0.0;
+        double p50 = 0.0;
+        double p90 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double mraysPerSecond = 0.0;
+    };
+
+    Statistics computeStatistics(const std::vector<double>& timesMs) const;
+    static double percentile(const std::vector<double>& sorted, double p);
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t warmupFrames;
+    uint32_t renderScale;  // rays are marched at 1/renderScale per axis
+    std::vector<BenchmarkResult> results;
+};
@@ -0,0 +1,437 @@
+#include "brick_volume.h"
+
+#include <fmt/format.h>
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+// Atlas slots filled per thread pool task
+constexpr uint32_t bricksPerTask = 64;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+glm::uvec3 bricksFor(const glm::uvec3& size)
+{
+    return (size + glm::uvec3(BrickVolume::brickSize - 1)) /
+           BrickVolume::brickSize;
+}
+
+}  // namespace
+
+void BrickVolume::Write(const std::string& path, const glm::uvec3& size,
+                        const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                        const Sampler& sampler, float threshold)
+{
+    if (glm::any(glm::equal(size, glm::uvec3(0))) ||
+        glm::any(glm::lessThanEqual(boundsMax, boundsMin))) {
+        throw std::runtime_error("brick volume " + path + " has no extent!");
+    }
+    if (glm::any(glm::greaterThan(size, glm::uvec3(maxGridSize)))) {
+        throw std::runtime_error("brick volume " + path + " is too large!");
+    }
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    const glm::uvec3 count = bricksFor(size);
+    std::vector<IndexEntry> entries(static_cast<size_t>(count.x) * count.y *
+                                    count.z);
+    FileHeader header{{'V', 'V', 'B', 'V'},
+                      fileVersion,
+                      brickSize,
+                      {size.x, size.y, size.z},
+                      {boundsMin.x, boundsMin.y, boundsMin.z},
+                      {boundsMax.x, boundsMax.y, boundsMax.z},
+                      0,
+                      0,
+                      sizeof(FileHeader),
+                      0};
+    header.dataOffset =
+        alignUp(header.indexOffset + entries.size() * sizeof(IndexEntry), 16);
+
+    // Bricks go out as they are sampled, the header and index once known
+    out.seekp(static_cast<std::streamoff>(header.dataOffset));
+    std::array<float, brickVoxels> densities{};
+    std::array<uint16_t, brickVoxels> texels{};
+    size_t entry = 0;
+    for (uint32_t bz = 0; bz < count.z; ++bz) {
+        for (uint32_t by = 0; by < count.y; ++by) {
+            for (uint32_t bx = 0; bx < count.x; ++bx, ++entry) {
+                const glm::uvec3 origin = glm::uvec3(bx, by, bz) * brickSize;
+                size_t i = 0;
+                for (uint32_t z = 0; z < brickSize; ++z) {
+                    for (uint32_t y = 0; y < brickSize; ++y) {
+                        for (uint32_t x = 0; x < brickSize; ++x, ++i) {
+                            const glm::uvec3 v = origin + glm::uvec3(x, y, z);
+                            densities[i] = glm::all(glm::lessThan(v, size))
+                                               ? sampler(v.x, v.y, v.z)
+                                               : 0.0f;
+                        }
+                    }
+                }
+
+                auto [lowest, highest] =
+                    std::minmax_element(densities.begin(), densities.end());
+                entries[entry] = {emptyBrick, *lowest, *highest};
+                if (*highest <= threshold) continue;
+
+                for (i = 0; i < brickVoxels; ++i) {
+                    texels[i] =
+                        static_cast<uint16_t>(glm::packHalf1x16(densities[i]));
+                }
+                out.write(reinterpret_cast<const char *>(texels.data()),
+                          sizeof(texels));
+                entries[entry].brick = header.storedBricks++;
+            }
+        }
+    }
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(IndexEntry));
+    if (!out) {
+        throw std::runtime_error("failed to write " + path + "!");
+    }
+}
+
+void BrickVolume::ConvertRaw(const std::string& rawPath,
+                             const std::string& path, const glm::uvec3& size,
+                             const glm::vec3& boundsMin,
+                             const glm::vec3& boundsMax, float threshold,
+                             bool check)
+{
+    if (glm::any(glm::equal(size, glm::uvec3(0))) ||
+        glm::any(glm::greaterThan(size, glm::uvec3(maxGridSize)))) {
+        throw std::runtime_error(fmt::format("invalid grid size {}x{}x{}!",
+                                             size.x, size.y, size.z));
+    }
+    MappedFile raw;
+    raw.Open(rawPath);
+    const uint64_t voxels = static_cast<uint64_t>(size.x) * size.y * size.z;
+    if (raw.GetSize() != voxels * sizeof(float)) {
+        throw std::runtime_error(fmt::format(
+            "{} holds {} bytes, a {}x{}x{} float grid needs {}!", rawPath,
+            raw.GetSize(), size.x, size.y, size.z, voxels * sizeof(float)));
+    }
+
+    const uint8_t *densities = raw.GetData();
+    const Sampler sampler = [&](uint32_t x, uint32_t y, uint32_t z) {
+        float density;
+        std::memcpy(&density,
+                    densities + ((static_cast<size_t>(z) * size.y + y) *
+                                     size.x +
+                                 x) * sizeof(float),
+                    sizeof(float));
+        return density;
+    };
+    Write(path, size, boundsMin, boundsMax, sampler, threshold);
+    fmt::print("[INFO] Brick volume {} written from {}\n", path, rawPath);
+    if (check) verify(path, size, sampler, threshold);
+}
+
+void BrickVolume::verify(const std::string& path, const glm::uvec3& size,
+                         const Sampler& sampler, float threshold)
+{
+    BrickVolume volume;
+    volume.Load(path);
+    if (volume.size != size) {
+        throw std::runtime_error(path + " reads back with another size!");
+    }
+
+    // Same brick walk as Write(), the index and every voxel have to match
+    std::array<float, brickVoxels> densities{};
+    size_t entry = 0;
+    for (uint32_t bz = 0; bz < volume.brickCount.z; ++bz) {
+        for (uint32_t by = 0; by < volume.brickCount.y; ++by) {
+            for (uint32_t bx = 0; bx < volume.brickCount.x; ++bx, ++entry) {
+                const glm::uvec3 origin = glm::uvec3(bx, by, bz) * brickSize;
+                const auto voxelAt = [&](size_t i) {
+                    return origin + glm::uvec3(i % brickSize,
+                                               i / brickSize % brickSize,
+                                               i / (brickSize * brickSize));
+                };
+                for (size_t i = 0; i < brickVoxels; ++i) {
+                    const glm::uvec3 v = voxelAt(i);
+                    densities[i] = glm::all(glm::lessThan(v, size))
+                                       ? sampler(v.x, v.y, v.z)
+                                       : 0.0f;
+                }
+                auto [lowest, highest] =
+                    std::minmax_element(densities.begin(), densities.end());
+                const IndexEntry& stored = volume.index[entry];
+                bool matches = stored.minDensity == *lowest &&
+                               stored.maxDensity == *highest &&
+                               (stored.brick != emptyBrick) ==
+                                   (*highest > threshold);
+                for (size_t i = 0; matches && i < brickVoxels; ++i) {
+                    const uint16_t expected =
+                        stored.brick == emptyBrick
+                            ? 0
+                            : static_cast<uint16_t>(
+                                  glm::packHalf1x16(densities[i]));
+                    matches = volume.voxel(glm::ivec3(voxelAt(i))) == expected;
+                }
+                if (!matches) {
+                    throw std::runtime_error(
+                        fmt::format("{} does not read back: brick ({}, {}, "
+                                    "{})!",
+                                    path, bx, by, bz));
+                }
+            }
+        }
+    }
+    fmt::print("[INFO] Brick volume {} verified: {}x{}x{} voxels, {} of {} "
+               "bricks stored\n",
+               path, size.x, size.y, size.z, volume.storedBricks, entry);
+}
+
+const char *BrickVolume::checkHeader(const FileHeader& header,
+                                     uint64_t fileSize)
+{
+    if (fileSize < sizeof(header)) return "too short";
+    if (std::memcmp(header.magic, "VVBV", 4) != 0) return "bad magic";
+    if (header.version != fileVersion) return "unknown version";
+    if (header.brickSize != brickSize) return "unsupported brick size";
+
+    for (int axis = 0; axis < 3; ++axis) {
+        if (header.size[axis] == 0 ||
+            !(header.boundsMax[axis] > header.boundsMin[axis])) {
+            return "no extent";
+        }
+        if (header.size[axis] > maxGridSize) return "grid too large";
+    }
+
+    // Both tables have to lie inside the file and be aligned for direct
+    // use. The sizes come from the file, so nothing may wrap around.
+    const glm::uvec3 bricks =
+        bricksFor(glm::uvec3(header.size[0], header.size[1], header.size[2]));
+    const uint64_t entryCount =
+        static_cast<uint64_t>(bricks.x) * bricks.y * bricks.z;
+    if (header.indexOffset % alignof(IndexEntry) != 0 ||
+        header.dataOffset % alignof(uint16_t) != 0) {
+        return "misaligned tables";
+    }
+    if (header.indexOffset > fileSize || header.dataOffset > fileSize ||
+        entryCount > (fileSize - header.indexOffset) / sizeof(IndexEntry) ||
+        header.storedBricks > (fileSize - header.dataOffset) /
+                                  (brickVoxels * sizeof(uint16_t))) {
+        return "truncated";
+    }
+    if (header.storedBricks > entryCount) return "more bricks than the grid";
+    return nullptr;
+}
+
+void BrickVolume::Load(const std::string& path)
+{
+    file.Open(path);
+    const size_t fileSize = file.GetSize();
+    FileHeader header{};
+    std::memcpy(&header, file.GetData(), std::min(fileSize, sizeof(header)));
+    if (const char *reason = checkHeader(header, fileSize)) {
+        file.Close();
+        throw std::runtime_error(
+            fmt::format("{} is not a brick volume: {}!", path, reason));
+    }
+
+    size = glm::uvec3(header.size[0], header.size[1], header.size[2]);
+    boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1],
+                          header.boundsMin[2]);
+    boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1],
+                          header.boundsMax[2]);
+    brickCount = bricksFor(size);
+    storedBricks = header.storedBricks;
+    const uint64_t entryCount =
+        static_cast<uint64_t>(brickCount.x) * brickCount.y * brickCount.z;
+    index = reinterpret_cast<const IndexEntry *>(file.GetData() +
+                                                 header.indexOffset);
+    bricks = reinterpret_cast<const uint16_t *>(file.GetData() +
+                                                header.dataOffset);
+    for (uint64_t i = 0; i < entryCount; ++i) {
+        if (index[i].brick != emptyBrick && index[i].brick >= storedBricks) {
+            file.Close();
+            throw std::runtime_error(fmt::format(
+                "{} is not a brick volume: brick index out of range!", path));
+        }
+    }
+}
+
+uint16_t BrickVolume::voxel(const glm::ivec3& v) const
+{
+    const glm::ivec3 extent = glm::ivec3(brickCount * brickSize);
+    if (glm::any(glm::lessThan(v, glm::ivec3(0))) ||
+        glm::any(glm::greaterThanEqual(v, extent))) {
+        return 0;
+    }
+    const glm::uvec3 brick = glm::uvec3(v) / brickSize;
+    const glm::uvec3 local = glm::uvec3(v) % brickSize;
+    const IndexEntry& entry =
+        index[(static_cast<size_t>(brick.z) * brickCount.y + brick.y) *
+                  brickCount.x +
+              brick.x];
+    if (entry.brick == emptyBrick) return 0;
+    return bricks[static_cast<size_t>(entry.brick) * brickVoxels +
+                  (local.z * brickSize + local.y) * brickSize + local.x];
+}
+
+BrickVolume::Footprint BrickVolume::footprintOf(uint32_t storedBricks,
+                                                const glm::uvec3& brickCount,
+                                                uint32_t maxAtlasExtent)
+{
+    // Close to a cube, within the device's 3D image limit
+    Footprint footprint;
+    const uint32_t slotCount = std::max(storedBricks, 1u);
+    const uint32_t maxSlots = maxAtlasExtent / slotSize;
+    glm::uvec3& slots = footprint.atlasSlots;
+    slots.x = std::min(static_cast<uint32_t>(std::ceil(
+                           std::cbrt(static_cast<double>(slotCount)))),
+                       maxSlots);
+    slots.y = std::min(static_cast<uint32_t>(std::ceil(std::sqrt(
+                           static_cast<double>((slotCount + slots.x - 1) /
+                                               slots.x)))),
+                       maxSlots);
+    slots.z = (slotCount + slots.x * slots.y - 1) / (slots.x * slots.y);
+    if (slots.z > maxSlots) {
+        throw std::runtime_error(
+            fmt::format("{} bricks do not fit into a {}^3 atlas!", slotCount,
+                        maxAtlasExtent));
+    }
+
+    const glm::uvec3 extent = footprint.AtlasExtent();
+    footprint.atlasBytes =
+        static_cast<size_t>(extent.x) * extent.y * extent.z * sizeof(uint16_t);
+    const size_t entryCount =
+        static_cast<size_t>(brickCount.x) * brickCount.y * brickCount.z;
+    footprint.tableBytes = sizeof(GpuHeader) +
+                           std::max<size_t>(entryCount, 1) * sizeof(uint32_t);
+    return footprint;
+}
+
+BrickVolume::Footprint BrickVolume::ReadFootprint(const std::string& path,
+                                                  uint32_t maxAtlasExtent)
+{
+    // Same limits as Load(), the staging memory is sized from this
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+    FileHeader header{};
+    in.read(reinterpret_cast<char *>(&header), sizeof(header));
+    const char *reason = in ? checkHeader(header, fileSize) : "too short";
+    if (reason != nullptr) {
+        throw std::runtime_error(
+            fmt::format("{} is not a brick volume: {}!", path, reason));
+    }
+    return footprintOf(
+        header.storedBricks,
+        bricksFor(glm::uvec3(header.size[0], header.size[1], header.size[2])),
+        maxAtlasExtent);
+}
+
+BrickVolume::Footprint BrickVolume::GetFootprint(uint32_t maxAtlasExtent) const
+{
+    return footprintOf(storedBricks, brickCount, maxAtlasExtent);
+}
+
+void BrickVolume::Pack(ThreadPool& pool, const Footprint& footprint,
+                       void *atlas, void *table) const
+{
+    // Slot of every stored brick's grid position, and the largest density
+    const size_t entryCount =
+        static_cast<size_t>(brickCount.x) * brickCount.y * brickCount.z;
+    std::vector<uint32_t> slotBricks(storedBricks);
+    std::vector<uint32_t> slots(std::max<size_t>(entryCount, 1), emptyBrick);
+    float largest = 0.0f;
+    for (size_t i = 0; i < entryCount; ++i) {
+        if (index[i].brick == emptyBrick) continue;
+        slotBricks[index[i].brick] = static_cast<uint32_t>(i);
+        slots[i] = index[i].brick;
+        largest = std::max(largest, index[i].maxDensity);
+    }
+
+    const glm::uvec3 atlasSlots = footprint.atlasSlots;
+    const glm::uvec3 extent = footprint.AtlasExtent();
+    auto *texels = static_cast<uint16_t *>(atlas);
+    const uint32_t tasks = (storedBricks + bricksPerTask - 1) / bricksPerTask;
+    pool.ParallelFor(tasks, [&](uint32_t task, uint32_t) {
+        const uint32_t begin = task * bricksPerTask;
+        const uint32_t end = std::min(begin + bricksPerTask, storedBricks);
+        for (uint32_t slot = begin; slot < end; ++slot) {
+            const uint32_t brick = slotBricks[slot];
+            const glm::ivec3 origin =
+                glm::ivec3(brick % brickCount.x,
+                           (brick / brickCount.x) % brickCount.y,
+                           brick / (brickCount.x * brickCount.y)) *
+                    static_cast<int>(brickSize) -
+                static_cast<int>(apron);
+            const glm::uvec3 texelOrigin =
+                glm::uvec3(slot % atlasSlots.x,
+                           (slot / atlasSlots.x) % atlasSlots.y,
+                           slot / (atlasSlots.x * atlasSlots.y)) *
+                slotSize;
+            // The apron repeats the neighbouring bricks' voxels
+            for (uint32_t z = 0; z < slotSize; ++z) {
+                for (uint32_t y = 0; y < slotSize; ++y) {
+                    uint16_t *row =
+                        &texels[(static_cast<size_t>(texelOrigin.z + z) *
+                                     extent.y +
+                                 texelOrigin.y + y) *
+                                    extent.x +
+                                texelOrigin.x];
+                    for (uint32_t x = 0; x < slotSize; ++x) {
+                        row[x] = voxel(origin + glm::ivec3(x, y, z));
+                    }
+                }
+            }
+        }
+    });
+
+    // The brick table spans whole bricks, so the bounds grow with the
+    // padding of the last brick on each axis
+    GpuHeader header{};
+    if (!IsEmpty()) {
+        const glm::vec3 paddedSize = glm::vec3(brickCount * brickSize);
+        header.boundsMin =
+            glm::vec4(boundsMin, largest > 0.0f ? 1.0f / largest : 0.0f);
+        header.boundsMax = glm::vec4(
+            boundsMin + (boundsMax - boundsMin) * paddedSize / glm::vec3(size),
+            0.0f);
+    }
+    header.brickCount = glm::uvec4(brickCount, storedBricks);
+    header.atlasSlots = glm::uvec4(atlasSlots, 0);
+
+    auto *bytes = static_cast<uint8_t *>(table);
+    std::memcpy(bytes, &header, sizeof(header));
+    std::memcpy(bytes + sizeof(header), slots.data(),
+                slots.size() * sizeof(uint32_t));
+}
+
+void BrickVolume::Pack(ThreadPool& pool, uint32_t maxAtlasExtent)
+{
+    const Footprint footprint = GetFootprint(maxAtlasExtent);
+    atlasExtent = footprint.AtlasExtent();
+    atlasTexels.assign(footprint.atlasBytes / sizeof(uint16_t), 0);
+    brickTable.resize(footprint.tableBytes);
+    Pack(pool, footprint, atlasTexels.data(), brickTable.data());
+
+    if (!IsEmpty()) {
+        fmt::print("[INFO] Brick volume packed: {} bricks into a {}x{}x{} "
+                   "atlas ({:.1f} MiB)\n",
+                   storedBricks, atlasExtent.x, atlasExtent.y, atlasExtent.z,
+                   footprint.atlasBytes / (1024.0 * 1024.0));
+    }
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+// Sparse density grid imported from a simulation cache. The grid is split
+// into brickSize³ voxel bricks and only bricks holding density are stored,
+// as half floats, behind a top-level index with every brick's density range.
+//
+// File layout (little endian):
+//   FileHeader
+//   IndexEntry per brick, x fastest            at header.indexOffset
+//   brickSize³ half floats per stored brick    at header.dataOffset
+//
+// Load() maps the file, nothing is read until Pack() copies the stored
+// bricks into a 3D atlas of slots with a one voxel apron, so the trilinear
+// filter never reads a neighbouring slot. Stored brick n goes to slot n.
+// The brick table maps every brick to its slot; both are read by
+// brick_volume.glsl.
+class BrickVolume {
+public:
+    static constexpr uint32_t brickSize = 8;  // BRICK_SIZE in brick_volume.glsl
+    static constexpr uint32_t apron = 1;
+    static constexpr uint32_t slotSize = brickSize + 2 * apron;
+    static constexpr uint32_t brickVoxels = brickSize * brickSize * brickSize;
+    static constexpr uint32_t emptyBrick = 0xffffffffu;
+
+    struct IndexEntry {
+        uint32_t brick;  // number of the stored brick, emptyBrick if none
+        float minDensity;
+        float maxDensity;
+    };
+
+    // Ahead of the slot per brick in the GPU brick table
+    struct GpuHeader {
+        glm::vec4 boundsMin;   // w: density scale, 1 / largest density
+        glm::vec4 boundsMax;   // of the whole bricks, past the grid size
+        glm::uvec4 brickCount;
+        glm::uvec4 atlasSlots;
+    };
+
+    // Atlas and brick table sizes, known from the file header alone
+    struct Footprint {
+        glm::uvec3 atlasSlots{1};
+        size_t atlasBytes = 0;
+        size_t tableBytes = 0;
+
+        glm::uvec3 AtlasExtent() const { return atlasSlots * slotSize; }
+    };
+
+    // Density of voxel (x, y, z)
+    using Sampler = std::function<float(uint32_t, uint32_t, uint32_t)>;
+
+    // Writes a grid of `size` voxels spanning [boundsMin, boundsMax] one
+    // brick at a time; bricks without a voxel above threshold are not stored
+    static void Write(const std::string& path, const glm::uvec3& size,
+                      const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+                      const Sampler& sampler, float threshold = 0.0f);
+    // Writes a raw grid of little endian float densities, x fastest. With
+    // check the file is loaded back and every voxel checked against the
+    // source, which reads the grid a second time.
+    static void ConvertRaw(const std::string& rawPath, const std::string& path,
+                           const glm::uvec3& size, const glm::vec3& boundsMin,
+                           const glm::vec3& boundsMax, float threshold = 0.0f,
+                           bool check = false);
+
+    // Reads only the header. maxAtlasExtent is the device's largest 3D
+    // image edge, throws if the bricks do not fit.
+    static Footprint ReadFootprint(const std::string& path,
+                                   uint32_t maxAtlasExtent);
+
+    // Maps the file and validates the index, throws if it is not a volume
+    void Load(const std::string& path);
+    Footprint GetFootprint(uint32_t maxAtlasExtent) const;
+    // Atlas texels and brick table of the stored bricks into memory of the
+    // footprint's sizes, such as mapped staging buffers. Atlas slots past
+    // the stored bricks are left as they are.
+    void Pack(ThreadPool& pool, const Footprint& footprint, void *atlas,
+              void *table) const;
+    // Into GetAtlasTexels() and GetBrickTable(). Without a loaded file this
+    // is a single empty slot, so the descriptors stay valid.
+    void Pack(ThreadPool& pool, uint32_t maxAtlasExtent);
+
+    bool IsEmpty() const { return !file.IsOpen(); }
+    uint32_t GetStoredBricks() const { return storedBricks; }
+    glm::uvec3 GetSize() const { return size; }
+
+    glm::uvec3 GetAtlasExtent() const { return atlasExtent; }
+    // R16_SFLOAT, x fastest, ready for a buffer to image copy
+    const std::vector<uint16_t>& GetAtlasTexels() const { return atlasTexels; }
+    // GpuHeader followed by one uint32 slot per brick
+    const std::vector<uint8_t>& GetBrickTable() const { return brickTable; }
+
+private:
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t brickSize;
+        uint32_t size[3];
+        float boundsMin[3];
+        float boundsMax[3];
+        uint32_t storedBricks;
+        uint32_t reserved;
+        uint64_t indexOffset;
+        uint64_t dataOffset;
+    };
+    static constexpr uint32_t fileVersion = 1;
+    // Voxels per axis, keeps every offset computed from a header in range
+    static constexpr uint32_t maxGridSize = 1u << 20;
+
+    // Reason the header does not describe a file of fileSize bytes, null if
+    // it does
+    static const char *checkHeader(const FileHeader& header,
+                                   uint64_t fileSize);
+
+    // Throws unless the file at path holds what Write() got from sampler
+    static void verify(const std::string& path, const glm::uvec3& size,
+                       const Sampler& sampler, float threshold);
+    static Footprint footprintOf(uint32_t storedBricks,
+                                 const glm::uvec3& brickCount,
+                                 uint32_t maxAtlasExtent);
+
+    // Half float of voxel v in the grid, 0 in empty bricks and outside
+    uint16_t voxel(const glm::ivec3& v) const;
+
+    MappedFile file;
+    const IndexEntry *index = nullptr;
+    const uint16_t *bricks = nullptr;
+    glm::uvec3 size{0};
+    glm::uvec3 brickCount{0};
+    glm::vec3 boundsMin{0.0f};
+    glm::vec3 boundsMax{0.0f};
+    uint32_t storedBricks = 0;
+
+    glm::uvec3 atlasExtent{0};
+    std::vector<uint16_t> atlasTexels;
+    std::vector<uint8_t> brickTable;
+};
@@ -15,26 +15,12 @@ Buffer::Buffer(Core* core, VkDeviceSize size, VkBufferUsageFlags usage,
         throw std::runtime_error("failed to create buffer!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(core->device, buffer, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(core->device, &allocInfo, nullptr, &bufferMemory) !=
-        VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
-    }
-
-    vkBindBufferMemory(core->device, buffer, bufferMemory, 0);
+    allocation = core->allocator.AllocateBuffer(buffer, properties);
 }
 
 void Buffer::Cleanup()
 {
     CheckValue();
     vkDestroyBuffer(core->device, buffer, nullptr);
-    vkFreeMemory(core->device, bufferMemory, nullptr);
+    core->allocator.Free(allocation);
 }
@@ -16,41 +16,23 @@ public:
     {
         this->core = other.core;
         this->buffer = other.buffer;
-        this->bufferMemory = other.bufferMemory;
+        this->allocation = other.allocation;
         return *this;
     }
     
     VkBuffer GetBuffer() { return buffer; }
-    VkDeviceMemory GetDeviceMemory() { return bufferMemory; }
+    // Persistently mapped pointer, null unless the memory is host visible
+    void* GetMappedData() { return allocation.mapped; }
     void Cleanup();
 
 private:
     void CheckValue()
     {
-        if (buffer == VK_NULL_HANDLE || bufferMemory == VK_NULL_HANDLE)
+        if (buffer == VK_NULL_HANDLE || allocation.memory == VK_NULL_HANDLE)
             throw std::runtime_error("Something went wrong with buffer");
     }
 
-    uint32_t findMemoryType(uint32_t typeFilter,
-                            VkMemoryPropertyFlags properties)
-    {
-//        CheckValue();
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(core->physicalDevice,
-                                            &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if ((typeFilter & (1 << i)) &&
-                (memProperties.memoryTypes[i].propertyFlags & properties) ==
-                    properties) {
-                return i;
-            }
-        }
-
-        throw std::runtime_error("failed to find suitable memory type!");
-    }
-
     Core* core;
     VkBuffer buffer = VK_NULL_HANDLE;
-    VkDeviceMemory bufferMemory = VK_NULL_HANDLE;
+    Allocation allocation;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #define GLM_FORCE_RADIANS
@@ -14,16 +15,156 @@ struct FilePath {
         "./shaders/volumetric_comp.spv"};
     inline const static std::string computeSmokeShaderPath{
         "./shaders/smoke_comp.spv"};
+    inline const static std::string computeUpsampleShaderPath{
+        "./shaders/upsample_comp.spv"};
+    inline const static std::string computeTemporalShaderPath{
+        "./shaders/temporal_comp.spv"};
+    inline const static std::string computeParticlesShaderPath{
+        "./shaders/particles_comp.spv"};
+    inline const static std::string computeSphHashShaderPath{
+        "./shaders/sph_hash_comp.spv"};
+    inline const static std::string computeSphScanShaderPath{
+        "./shaders/sph_scan_comp.spv"};
+    inline const static std::string computeSphSortShaderPath{
+        "./shaders/sph_sort_comp.spv"};
+    inline const static std::string computeSphDensityShaderPath{
+        "./shaders/sph_density_comp.spv"};
+    inline const static std::string computeSphForceShaderPath{
+        "./shaders/sph_force_comp.spv"};
+    inline const static std::string computeSmokeGridCountShaderPath{
+        "./shaders/smoke_grid_count_comp.spv"};
+    inline const static std::string computeSmokeGridScanShaderPath{
+        "./shaders/smoke_grid_scan_comp.spv"};
+    inline const static std::string computeSmokeGridFillShaderPath{
+        "./shaders/smoke_grid_fill_comp.spv"};
+    inline const static std::string computeSmokeFieldShaderPath{
+        "./shaders/smoke_field_comp.spv"};
+    inline const static std::string computeFluidFieldShaderPath{
+        "./shaders/fluid_field_comp.spv"};
+    inline const static std::string computeLightVolumeShaderPath{
+        "./shaders/light_volume_comp.spv"};
+    inline const static std::string computeAccumulateShaderPath{
+        "./shaders/accumulate_comp.spv"};
     inline const static std::string vertexShaderPath{
         "./shaders/volumetric_vert.spv"};
     inline const static std::string fragmentShaderPath{
         "./shaders/volumetric_frag.spv"};
     inline const static std::string causticTexturePath{
         "./textures/caustic.jpg"};
-    inline const static std::string computeCloudNoiseTexturePath{
-        "./textures/noise.png"};
+    inline const static std::string noiseVolumeCachePath{
+        "./noise_volume.bin"};
     inline const static std::string computeCloudBlueNoiseTexturePath{
         "./textures/blue_noise.png"};
+    inline const static std::string gpuProfileCsvPath{"./gpu_profile.csv"};
+    inline const static std::string pipelineCacheDirectory{"./"};
+};
+
+// Adaptive smoke march in smoke.comp, tunable at runtime through the UBO
+struct MarchPolicy {
+    float transmittanceCutoff = 0.01f;  // stop the ray below, 0 = never
+    float stepGrowth = 0.05f;  // step = MARCH_SIZE * (1 + growth * depth)
+    uint32_t sampleBudget = 1024;  // scene() calls per ray
+    // Upper end of the UI slider and --sample-budget
+    static constexpr uint32_t maxSampleBudget = 4096;
+};
+
+// Smoke frame counters, mostly summed over all rays (march_counters.glsl,
+// binding 21)
+struct MarchCounters {
+    // Counters per frame on the GPU, each a low and a high uint32: one frame
+    // can add pixels * maxSampleBudget samples, past 2^32
+    static constexpr uint32_t count = 8;
+    static constexpr uint32_t words = count * 2;
+
+    uint64_t rays = 0;
+    uint64_t marchSamples = 0;
+    uint64_t lightSamples = 0;
+    uint64_t shadowSamples = 0;
+    uint64_t savedSamples = 0;    // below the fixed MAX_STEPS march
+    uint64_t terminatedRays = 0;  // stopped by the transmittance cutoff
+    uint64_t exhaustedRays = 0;   // stopped by the sample budget
+    uint64_t movedParticles = 0;  // particles.comp, 0 once they all rest
+
+    // Adds one frame's counters in the GPU order above
+    void Add(const uint32_t* frame)
+    {
+        const auto counter = [frame](int i) {
+            return frame[2 * i] | static_cast<uint64_t>(frame[2 * i + 1]) << 32;
+        };
+        rays += counter(0);
+        marchSamples += counter(1);
+        lightSamples += counter(2);
+        shadowSamples += counter(3);
+        savedSamples += counter(4);
+        terminatedRays += counter(5);
+        exhaustedRays += counter(6);
+        movedParticles += counter(7);
+    }
+    double PerRay(uint64_t counter) const
+    {
+        return rays > 0 ? static_cast<double>(counter) / rays : 0.0;
+    }
+};
+
+// Brick volume sequence playback (VolumeStream), the frames are the .vvb
+// files of a directory in name order
+struct VolumePlayback {
+    float fps = 24.0f;
+    uint32_t prefetchFrames = 4;    // loaded ahead into pinned staging
+    uint32_t cacheBudgetMiB = 512;  // uploaded frames kept on the GPU
+};
+
+// Playback state shown below the imported volume checkbox
+struct VolumeStreamStats {
+    uint32_t frameCount = 0;
+    uint32_t shownFrame = 0;
+    uint32_t residentFrames = 0;
+    uint64_t residentBytes = 0;
+    uint64_t uploads = 0;
+    uint64_t evictions = 0;
+    uint64_t stalls = 0;  // updates that kept an older frame on screen
+};
+
+// --convert-volume: raw float grid to a brick volume file, nothing is
+// rendered. The bounds default to the smoke particle grid, SMOKE_GRID_MIN
+// to SMOKE_GRID_MAX in smoke_grid.glsl.
+struct VolumeConversion {
+    std::string rawPath;
+    std::string outputPath;
+    glm::uvec3 size{0};
+    glm::vec3 boundsMin{-5.0f, -5.0f, -5.0f};
+    glm::vec3 boundsMax{5.0f, 3.0f, 5.0f};
+    float threshold = 0.0f;  // bricks up to it are left out
+    bool verify = false;     // read the file back and compare every voxel
+};
+
+struct RenderOptions {
+    bool headless = false;
+    uint32_t width = 0;   // 0 -> half the monitor size / 1280 when headless
+    uint32_t height = 0;  // 0 -> half the monitor size / 720 when headless
+    uint32_t frames = 1;  // number of frames rendered in headless mode
+    int pipeline = 0;     // 0 = fluid, 1 = smoke
+    std::string outputPath;  // headless: last frame is written as PPM
+    uint32_t renderScale = 1;  // ray march at 1/n resolution (1, 2 or 4)
+    uint32_t temporalFrames = 0;  // smoke accumulated over ~n frames, 0 = off
+    uint32_t framesInFlight = 2;  // frames the CPU may record ahead, 1-4
+    uint32_t particleCount = 5;   // smoke particles, simulated on the GPU
+    uint32_t fluidParticleCount = 16384;  // SPH particles of the fluid
+    bool particleFluid = false;  // start with the particle based fluid
+    MarchPolicy marchPolicy;
+    bool renderOnDemand = false;  // start with render on demand
+    bool noiseVolume = false;  // start with the baked noise volume
+    // Brick volume file or directory of frames rendered as the smoke
+    std::string volumePath;
+    VolumePlayback volumePlayback;
+    VolumeConversion volumeConversion;
+
+    bool benchmark = false;   // implies headless, runs every pipeline
+    uint32_t warmupFrames = 10;
+    std::string reportPath = "benchmark.json";
+
+    bool cpu = false;      // implies headless, SIMD ray marchers, no Vulkan
+    uint32_t threads = 0;  // CPU worker threads, 0 -> all hardware threads
 };
 
 struct UniformBufferObject {
@@ -36,6 +177,21 @@ struct UniformBufferObject {
     uint32_t frame = 0;
     int particleBasedFluid;
     float rotationY;
+    int useNoiseVolume = 0;
+    // Temporal accumulation
+    alignas(16) glm::vec3 prevCameraPosition;
+    float prevRotationY = 0.0f;
+    float temporalBlend = 1.0f;  // weight of the current frame, 1 = off
+    int historyValid = 0;
+    int useParticleField = 1;
+    // Adaptive smoke march, MarchPolicy
+    float transmittanceCutoff = 0.01f;
+    float stepGrowth = 0.05f;
+    int sampleBudget = 1024;
+    int useLightVolume = 1;
+    // Render on demand, samples already in the accumulator
+    int accumulatedFrames = 0;
+    int useBrickVolume = 0;  // imported brick volume as the smoke
 };
 
 struct Particle {
@@ -44,3 +200,72 @@ struct Particle {
     alignas(16) glm::vec4 color;
 };
 
+
+// SPH fluid particle, written by shaders/sph_force.comp
+struct FluidParticle {
+    glm::vec4 position;  // position.w -> density
+    glm::vec4 velocity;  // velocity.w -> pressure
+};
+
+// Spatial hash grid of the SPH fluid over the simulation box, one cell per
+// smoothing length. Keep in sync with shaders/sph.glsl.
+struct SphGrid {
+    static constexpr float cellSize = 0.1f;
+    static constexpr uint32_t width = 40;
+    static constexpr uint32_t height = 20;
+    static constexpr uint32_t depth = 40;
+    static constexpr uint32_t cellCount = width * height * depth;
+    static constexpr float particleSpacing = 0.05f;  // at rest density
+    // Occupied cell bounds, six uints ahead of the {count, start} cells
+    static constexpr size_t bufferSize =
+        6 * sizeof(uint32_t) + cellCount * 2 * sizeof(uint32_t);
+};
+
+// Particle distances baked every frame over the active pipeline's domain,
+// size³ voxels. Keep in sync with shaders/particle_field.glsl.
+struct ParticleField {
+    static constexpr uint32_t size = 64;
+};
+
+// Render on demand (accumulate.comp): jittered samples averaged into a still
+// image before the compute passes stop
+struct ProgressiveAccumulation {
+    static constexpr uint32_t maxSamples = 64;
+};
+
+// Sun lighting of the smoke, light_volume.glsl
+struct LightVolume {
+    static constexpr uint32_t width = 64;
+    static constexpr uint32_t height = 48;
+    static constexpr uint32_t depth = 64;
+};
+
+// Everything the light volume depends on besides the particles. Wind scrolls
+// the noise and pushes the particles, so the bake only rests in calm air.
+struct LightVolumeInputs {
+    glm::vec3 sunPosition{};
+    glm::vec3 windDirection{};
+    int useNoiseVolume = 0;
+    int useParticleField = 0;
+    int useBrickVolume = 0;
+    uint64_t volumeId = 0;  // upload of the streamed frame shown
+
+    bool operator==(const LightVolumeInputs&) const = default;
+};
+
+// Uniform grid of the smoke particles for scene() in smoke_scene.glsl, each
+// particle is listed in every cell its reach overlaps. Keep in sync with
+// shaders/smoke_grid.glsl.
+struct SmokeGrid {
+    static constexpr float cellSize = 0.5f;
+    static constexpr uint32_t width = 20;
+    static constexpr uint32_t height = 16;
+    static constexpr uint32_t depth = 20;
+    static constexpr uint32_t cellCount = width * height * depth;
+    // Smooth union width per unit of particle scale
+    static constexpr float blendScale = 2.0f;
+    // Upper limit of the cell list, 32 MiB of particle indices
+    static constexpr uint32_t maxCellParticles = 1u << 23;
+    // {count, start, filled} per cell
+    static constexpr size_t bufferSize = cellCount * 3 * sizeof(uint32_t);
+};
@@ -1,38 +1,119 @@
 #include "core.h"
 
-VkCommandBuffer Core::beginSingleTimeCommands()
-{
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
+#include <fmt/format.h>
 
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+#include <filesystem>
+#include <random>
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+namespace {
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+// Prepended to the driver's blob. Vulkan's own header carries vendor, device
+// and UUID but not the driver version, and a truncated file must be detected
+// before the data reaches the driver.
+struct PipelineCacheHeader {
+    char magic[4];
+    uint32_t dataSize;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t uuid[VK_UUID_SIZE];
+};
 
-    return commandBuffer;
-}
+}  // namespace
 
-void Core::endSingleTimeCommands(VkCommandBuffer commandBuffer)
+void Core::CreatePipelineCache(const std::string& directory)
 {
-    vkEndCommandBuffer(commandBuffer);
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+    std::string uuid;
+    for (uint8_t byte : properties.pipelineCacheUUID) {
+        uuid += fmt::format("{:02x}", byte);
+    }
+    pipelineCachePath =
+        (std::filesystem::path(directory) / ("pipeline_cache_" + uuid + ".bin"))
+            .string();
+
+    std::vector<char> data;
+    std::ifstream file(pipelineCachePath, std::ios::binary);
+    PipelineCacheHeader header{};
+    if (file.is_open() &&
+        file.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+        std::memcmp(header.magic, "VVPC", 4) == 0 &&
+        header.vendorID == properties.vendorID &&
+        header.deviceID == properties.deviceID &&
+        header.driverVersion == properties.driverVersion &&
+        std::memcmp(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) ==
+            0) {
+        // The blob has to be exactly the rest of the file, a size from a
+        // corrupt header must not decide the allocation
+        const std::streampos dataStart = file.tellg();
+        file.seekg(0, std::ios::end);
+        const std::streamoff remaining = file.tellg() - dataStart;
+        if (remaining == static_cast<std::streamoff>(header.dataSize)) {
+            file.seekg(dataStart);
+            data.resize(header.dataSize);
+            if (!file.read(data.data(), data.size())) data.clear();
+        }
+    }
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+    VkPipelineCacheCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = data.size();
+    createInfo.pInitialData = data.empty() ? nullptr : data.data();
 
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    if (vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) !=
+        VK_SUCCESS) {
+        // Retry without the (possibly corrupt) blob
+        createInfo.initialDataSize = 0;
+        createInfo.pInitialData = nullptr;
+        data.clear();
+        if (vkCreatePipelineCache(device, &createInfo, nullptr,
+                                  &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+    std::cout << "[INFO] Pipeline cache "
+              << (data.empty() ? "created empty..." : "loaded from disk...")
+              << std::endl;
+}
+
+void Core::CleanupPipelineCache()
+{
+    if (pipelineCache == VK_NULL_HANDLE) return;
+
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+    std::vector<char> data(dataSize);
+    if (dataSize > 0 && vkGetPipelineCacheData(device, pipelineCache,
+                                               &dataSize,
+                                               data.data()) == VK_SUCCESS) {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        PipelineCacheHeader header{{'V', 'V', 'P', 'C'},
+                                   static_cast<uint32_t>(dataSize),
+                                   properties.vendorID,
+                                   properties.deviceID,
+                                   properties.driverVersion};
+        std::memcpy(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+        // Renderers started side by side in batch jobs share the file, write
+        // a private copy and rename it over the old one
+        std::string tmpPath =
+            pipelineCachePath + "." + std::to_string(std::random_device{}());
+        std::ofstream file(tmpPath, std::ios::binary);
+        if (file.is_open()) {
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(data.data(), dataSize);
+            file.close();
+            std::error_code error;
+            std::filesystem::rename(tmpPath, pipelineCachePath, error);
+            if (error) std::filesystem::remove(tmpPath, error);
+        }
+    }
+
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    pipelineCache = VK_NULL_HANDLE;
 }
 
 void Core::pickPhysicalDevice()
@@ -70,6 +151,10 @@ void Core::pickPhysicalDevice()
         }
     }
 
+    if (suitableDevices.empty()) {
+        throw std::runtime_error("failed to find a suitable GPU!");
+    }
+
     auto device =
         *std::max_element(suitableDevices.begin(), suitableDevices.end(),
                           [](const auto& lhs, const auto& rhs) {
@@ -90,19 +175,50 @@ void Core::createLogicalDevice()
     std::set<uint32_t> uniqueQueueFamilies = {
         indices.graphicsAndComputeFamily.value(),
         indices.presentFamily.value()};
+    if (indices.transferFamily.has_value()) {
+        uniqueQueueFamilies.insert(indices.transferFamily.value());
+    }
+    if (indices.computeFamily.has_value()) {
+        uniqueQueueFamilies.insert(indices.computeFamily.value());
+    }
 
-    float queuePriority = 1.0f;
+    // Without an async compute family, compute gets a second queue of the
+    // graphics family if there is one
+    graphicsQueueFamily = indices.graphicsAndComputeFamily.value();
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount,
+                                             queueFamilies.data());
+    uint32_t graphicsQueueCount =
+        !indices.computeFamily.has_value() &&
+                queueFamilies[graphicsQueueFamily].queueCount > 1
+            ? 2
+            : 1;
+
+    float queuePriorities[] = {1.0f, 1.0f};
     for (uint32_t queueFamily : uniqueQueueFamilies) {
         VkDeviceQueueCreateInfo queueCreateInfo{};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.queueFamilyIndex = queueFamily;
-        queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &queuePriority;
+        queueCreateInfo.queueCount =
+            queueFamily == graphicsQueueFamily ? graphicsQueueCount : 1;
+        queueCreateInfo.pQueuePriorities = queuePriorities;
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    // Core Vulkan 1.2 features, hostQueryReset is used by the GPU profiler
+    // and timeline semaphores by the upload manager
+    VkPhysicalDeviceVulkan12Features vulkan12Features{};
+    vulkan12Features.sType =
+        VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.hostQueryReset = VK_TRUE;
+    vulkan12Features.timelineSemaphore = VK_TRUE;
+
     VkPhysicalDeviceFeatures2 deviceFeatures2{};
     deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    deviceFeatures2.pNext = &vulkan12Features;
 
 #ifdef __APPLE__
     VkPhysicalDevicePortabilitySubsetFeaturesKHR portabilityFeatures{};
@@ -110,7 +226,7 @@ void Core::createLogicalDevice()
     portabilityFeatures.sType =
         VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PORTABILITY_SUBSET_FEATURES_KHR;
 
-    deviceFeatures2.pNext = &portabilityFeatures;
+    vulkan12Features.pNext = &portabilityFeatures;
 #endif
 
     VkPhysicalDeviceFeatures deviceFeatures{};
@@ -126,9 +242,9 @@ void Core::createLogicalDevice()
 
     createInfo.pNext = &deviceFeatures2;
 
-    createInfo.enabledExtensionCount =
-        static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    auto extensions = GetDeviceExtensions();
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+    createInfo.ppEnabledExtensionNames = extensions.data();
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount =
@@ -143,11 +259,33 @@ void Core::createLogicalDevice()
         throw std::runtime_error("failed to create logical core.device!");
     }
 
-    vkGetDeviceQueue(device, indices.graphicsAndComputeFamily.value(), 0,
-                     &graphicsQueue);
-    vkGetDeviceQueue(device, indices.graphicsAndComputeFamily.value(), 0,
-                     &computeQueue);
+    vkGetDeviceQueue(device, graphicsQueueFamily, 0, &graphicsQueue);
     vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+    computeQueueFamily = indices.computeFamily.value_or(graphicsQueueFamily);
+    vkGetDeviceQueue(device, computeQueueFamily,
+                     computeQueueFamily == graphicsQueueFamily
+                         ? graphicsQueueCount - 1
+                         : 0,
+                     &computeQueue);
+    if (computeQueue != graphicsQueue) {
+        std::cout << "[INFO] Compute runs on its own queue of family "
+                  << computeQueueFamily << std::endl;
+    }
+
+    // Uploaded resources are consumed by the compute passes
+    uint32_t transferFamily = computeQueueFamily;
+    transferQueue = computeQueue;
+    if (indices.transferFamily.has_value()) {
+        transferFamily = indices.transferFamily.value();
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+        std::cout << "[INFO] Uploads use transfer queue family "
+                  << transferFamily << std::endl;
+    }
+
+    allocator.Init(device, physicalDevice);
+    uploader.Init(device, &allocator, transferFamily, transferQueue,
+                  computeQueueFamily, computeQueue);
 }
 
 bool Core::isDeviceSuitable(VkPhysicalDevice device)
@@ -156,8 +294,8 @@ bool Core::isDeviceSuitable(VkPhysicalDevice device)
 
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-    bool swapChainAdequate = false;
-    if (extensionsSupported) {
+    bool swapChainAdequate = headless;
+    if (extensionsSupported && !headless) {
         Core::SwapChainSupportDetails swapChainSupport =
             QuerySwapChainSupport(device);
         swapChainAdequate = !swapChainSupport.formats.empty() &&
@@ -186,8 +324,14 @@ Core::QueueFamilyIndices Core::FindQueueFamilies(VkPhysicalDevice device)
         }
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                             &presentSupport);
+        if (headless) {
+            // Nothing is presented, the graphics family stands in for it
+            presentSupport =
+                (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        } else {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
+                                                 &presentSupport);
+        }
 
         if (presentSupport) {
             indices.presentFamily = i;
@@ -200,6 +344,23 @@ Core::QueueFamilyIndices Core::FindQueueFamilies(VkPhysicalDevice device)
         i++;
     }
 
+    // Copies on a family without graphics or compute run on the DMA engines,
+    // next to the frame instead of in between its work. Likewise compute
+    // without graphics overlaps with the graphics queue.
+    for (uint32_t family = 0; family < queueFamilyCount; ++family) {
+        VkQueueFlags flags = queueFamilies[family].queueFlags;
+        if (!indices.transferFamily.has_value() &&
+            (flags & VK_QUEUE_TRANSFER_BIT) &&
+            !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            indices.transferFamily = family;
+        }
+        if (!indices.computeFamily.has_value() &&
+            (flags & VK_QUEUE_COMPUTE_BIT) &&
+            !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            indices.computeFamily = family;
+        }
+    }
+
     return indices;
 }
 bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device)
@@ -212,8 +373,9 @@ bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device)
     vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                          availableExtensions.data());
 
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                             deviceExtensions.end());
+    auto extensions = GetDeviceExtensions();
+    std::set<std::string> requiredExtensions(extensions.begin(),
+                                             extensions.end());
 
     for (const auto& extension : availableExtensions) {
         requiredExtensions.erase(extension.extensionName);
@@ -221,6 +383,20 @@ bool Core::checkDeviceExtensionSupport(VkPhysicalDevice device)
 
     return requiredExtensions.empty();
 }
+
+std::vector<const char *> Core::GetDeviceExtensions() const
+{
+    if (!headless) return deviceExtensions;
+
+    std::vector<const char *> extensions;
+    std::copy_if(deviceExtensions.begin(), deviceExtensions.end(),
+                 std::back_inserter(extensions), [](const char *name) {
+                     return std::strcmp(name,
+                                        VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0;
+                 });
+    return extensions;
+}
+
 Core::SwapChainSupportDetails Core::QuerySwapChainSupport(
     VkPhysicalDevice device)
 {
@@ -11,11 +11,16 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <set>
+#include <string>
 #include <stdexcept>
 #include <vector>
 
+#include "allocator.h"
+#include "upload_manager.h"
+
 const std::vector<const char *> validationLayers = {
     "VK_LAYER_KHRONOS_validation"};
 
@@ -30,45 +35,53 @@ public:
     VkDevice device;
     VkPhysicalDevice physicalDevice;
     VkInstance instance;
-    GLFWwindow *window;
-    VkSurfaceKHR surface;
+    GLFWwindow *window = nullptr;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
 
     VkQueue graphicsQueue;
+    // An async compute family, a second graphics queue or graphicsQueue,
+    // whatever the device has
     VkQueue computeQueue;
     VkQueue presentQueue;
+    // Dedicated transfer queue, computeQueue when the device has none
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t computeQueueFamily = 0;
 
     VkCommandPool commandPool;
+    // Same as commandPool unless compute runs on its own family
+    VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+    // Shared by every vkCreate*Pipelines call and by ImGui
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    // Every Buffer and Texture takes its memory from here
+    GpuAllocator allocator;
+    // Staged buffer and image uploads, copied on transferQueue and usable
+    // on computeQueue
+    UploadManager uploader;
 
     int CurrentPipeline{0};
+    // No window, surface or swapchain: frames are only read back to the host
+    bool headless{false};
+
     void CreateDevices()
     {
         pickPhysicalDevice();
         createLogicalDevice();
     }
 
-    VkCommandBuffer beginSingleTimeCommands();
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
-
-    uint32_t findMemoryType(uint32_t typeFilter,
-                            VkMemoryPropertyFlags properties)
-    {
-        VkPhysicalDeviceMemoryProperties memProperties;
-        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-            if ((typeFilter & (1 << i)) &&
-                (memProperties.memoryTypes[i].propertyFlags & properties) ==
-                    properties) {
-                return i;
-            }
-        }
-
-        throw std::runtime_error("failed to find suitable memory type!");
-    }
+    // Loads <directory>/pipeline_cache_<pipelineCacheUUID>.bin, the cache
+    // starts empty when the file was written by another device or driver
+    void CreatePipelineCache(const std::string& directory);
+    // Writes the cache back and destroys it
+    void CleanupPipelineCache();
 
     struct QueueFamilyIndices {
         std::optional<uint32_t> graphicsAndComputeFamily;
         std::optional<uint32_t> presentFamily;
+        // Transfer only family (the DMA engines), optional
+        std::optional<uint32_t> transferFamily;
+        // Compute without graphics (async compute), optional
+        std::optional<uint32_t> computeFamily;
 
         bool isComplete()
         {
@@ -96,6 +109,7 @@ public:
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
         VK_KHR_SHADER_NON_SEMANTIC_INFO_EXTENSION_NAME};
 #endif
+    std::vector<const char *> GetDeviceExtensions() const;
 
     //----------------------------------------------------------------
     // Static functions
@@ -184,4 +198,6 @@ private:
     bool isDeviceSuitable(VkPhysicalDevice device);
     bool checkDeviceExtensionSupport(VkPhysicalDevice device);
     bool checkInstanceExtensionSupport(VkInstance instance);
+
+    std::string pipelineCachePath;
 };
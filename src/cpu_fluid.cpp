@@ -0,0 +1,306 @@
+#include "cpu_fluid.h"
+
+#include <vector>
+
+#include "cpu_utils.h"
+
+namespace {
+
+using cpu::Float;
+using cpu::Mask;
+using cpu::Vec3;
+
+// Shader params of volumetric.comp
+const glm::vec3 lightColor{1.0f, 1.0f, 1.0f};
+constexpr float ambientFactor = 0.25f;
+constexpr float diffuseFactor = 1.0f;
+constexpr float specularFactor = 0.25f;
+constexpr float intensity = 32.0f;
+constexpr float density = 0.25f;
+constexpr float viscosity = 1.75f;
+constexpr float refractionFactor = 1.33f;
+constexpr float waterShininess = 20.0f;
+constexpr float energyAbsorption = 0.03f;
+
+constexpr int numberOfSteps = 100;
+constexpr float minimumHitDistance = 0.001f;
+constexpr float maximumTraceDistance = 20.0f;
+constexpr float particleSize = 0.66f;
+
+// LiquiSDD: sdf value, gradient and color
+struct Liquid {
+    Float val;
+    Vec3 grad;
+    Vec3 col;
+};
+
+inline Float Diffuse(const Vec3& n, const Vec3& l, float p)
+{
+    return simd::Pow(simd::MulAdd(simd::Dot(n, l), 0.4f, 0.6f), p);
+}
+
+inline Float Specular(const Vec3& n, const Vec3& l, const Vec3& e, float s)
+{
+    float nrm = (s + 8.0f) / (cpu::PI * 8.0f);
+    return simd::Pow(simd::Max(simd::Dot(cpu::Reflect(e, n), l), 0.0f), s) *
+           nrm;
+}
+
+inline Vec3 SkyColor(const Vec3& e)
+{
+    Float y = simd::MulAdd(simd::Max(e.y, 0.0f), 0.8f, 0.2f) * 0.8f;
+    Float oneMinusY = Float(1.0f) - y;
+    return Vec3{oneMinusY * oneMinusY * 1.1f, oneMinusY * 1.1f,
+                simd::MulAdd(oneMinusY, 0.4f, 0.6f) * 1.1f};
+}
+
+// Copyrights to TDM https://www.shadertoy.com/view/Ms2SD1
+inline Vec3 SeaColor(const Vec3& p, const Vec3& n, const Vec3& l,
+                     const Vec3& eye, const Vec3& dist)
+{
+    const Vec3 seaBase = cpu::Splat(glm::vec3(0.0f, 0.09f, 0.18f));
+    const Vec3 seaWaterColor = cpu::Splat(glm::vec3(0.8f, 0.9f, 0.6f) * 0.6f);
+    constexpr float seaHeight = 0.6f;
+
+    Float fresnel = simd::Clamp(Float(1.0f) - simd::Dot(n, -eye), 0.0f, 1.0f);
+    fresnel = simd::Min(simd::Pow(fresnel, 3.0f), 0.5f);
+
+    Vec3 reflected = SkyColor(cpu::Reflect(eye, n));
+    Vec3 refracted = seaBase + seaWaterColor * (Diffuse(n, l, 80.0f) * 0.12f);
+    Vec3 color = simd::Mix(refracted, reflected, fresnel);
+
+    Float atten = simd::Max(Float(1.0f) - simd::Dot(dist, dist) * 0.001f, 0.0f);
+    color = color + seaWaterColor * ((p.y - seaHeight) * 0.18f * atten);
+    return color + Vec3{Specular(n, l, eye, 60.0f), Specular(n, l, eye, 60.0f),
+                        Specular(n, l, eye, 60.0f)};
+}
+
+struct FluidScene {
+    bool particleBased;
+    float totalTime;
+    glm::vec3 windOffset;
+    glm::vec3 sunPosition;
+    std::vector<glm::vec3> centers;  // particle mode spheres
+
+    Liquid Sphere(const Vec3& p, const glm::vec3& c, const Vec3& color) const
+    {
+        Vec3 d = p - cpu::Splat(c);
+        Float length = simd::Length(d);
+        return Liquid{length - particleSize, d * (Float(1.0f) / length),
+                      color};
+    }
+
+    static Liquid SmoothUnion(const Liquid& a, const Liquid& b, float k,
+                              float n)
+    {
+        Float mixFactor;
+        Liquid res;
+        res.val = cpu::SminN(a.val, b.val, k, n, mixFactor);
+        res.grad = simd::Normalize(simd::Mix(a.grad, b.grad, mixFactor));
+        res.col = simd::Mix(a.col, b.col, mixFactor);
+        return res;
+    }
+
+    // sdWater(pos - vec3(0, 1.5, 0)), only the value is used
+    Float Water(const Vec3& pos) const
+    {
+        Float dis = pos.y + 0.1f;
+        float amp = 0.5f;
+        float freq = 1.0f;
+        for (int step = 0; step < 4; ++step) {
+            float i = static_cast<float>(step);
+            Float x = pos.x * freq + i * amp + totalTime * i;
+            Float y = pos.y * freq + i * amp + totalTime * i;
+            Float z = pos.z * freq + -i * amp + totalTime * i;
+            dis = dis + Float(amp) * simd::Sin(x) * simd::Sin(y) * simd::Sin(z);
+            amp *= 0.5f;
+            freq *= 2.0f;
+        }
+        dis = dis + cpu::Fbm(pos * Float(1.25f), windOffset, 2);
+        return -dis;
+    }
+
+    Liquid Map(const Vec3& p) const
+    {
+        if (!particleBased) {
+            const Vec3 waterColor = cpu::Splat(glm::vec3(0.0f, 0.01f, 0.25f));
+            Vec3 q{p.x, p.y - 1.5f, p.z};
+            return Liquid{Water(q), Vec3{0.0f}, waterColor};
+        }
+
+        const Vec3 waterColor = cpu::Splat(glm::vec3(0.0f, 0.125f, 0.5f));
+        Liquid liq = Sphere(p, centers[0], waterColor);
+        for (size_t i = 1; i < centers.size(); ++i) {
+            liq = SmoothUnion(liq, Sphere(p, centers[i], waterColor), 0.5f,
+                              viscosity);
+        }
+        return liq;
+    }
+
+    // Forward differences against the already known map(p).val
+    Vec3 CalcNormal(const Vec3& p, Float dis) const
+    {
+        const float h = 0.01f;
+        Vec3 normal{dis - Map(Vec3{p.x - h, p.y, p.z}).val,
+                    dis - Map(Vec3{p.x, p.y - h, p.z}).val,
+                    dis - Map(Vec3{p.x, p.y, p.z - h}).val};
+        return simd::Normalize(normal);
+    }
+
+    // Not called by volumetric.comp either, kept in sync for when it is
+    [[maybe_unused]] Float Caustic(const Vec3& position) const
+    {
+        float t = totalTime / 3.0f;
+        Vec3 q{position.x / 15.0f + t, position.y / 15.0f + t,
+               position.z / 15.0f + t};
+        Float noise = cpu::Fbm(q, windOffset, 4) * 20.0f;
+        Float waterNoise = simd::Fract(noise);
+        Float s, c;
+        simd::SinCos(waterNoise, s, c);
+        Float x = position.x / 4.0f + totalTime + c * 3.0f;
+        Float y = position.z / 4.0f + (totalTime + 3.0f) + s * 3.0f;
+        constexpr float causticMultiplier = 7.0f;
+        return Float(causticMultiplier * 0.027f) *
+               simd::Pow(cpu::SmoothVoronoi(x, y), 5.0f);
+    }
+
+    Vec3 RayMarch(Vec3 ro, Vec3 rd) const
+    {
+        const Vec3 sunPos = cpu::Splat(sunPosition);
+        const Float stepTransmittance = simd::Exp(Float(-energyAbsorption * density));
+        const float eta = 1.0f / refractionFactor;
+        // normalize(currLightColor), white light of any intensity
+        const Vec3 lightDirection{0.57735026919f};
+
+        Float totalDistance = 0.0f;
+        Float currDistance = 0.0f;
+        Float unabsorbedEnergy = 1.0f;
+        Vec3 color{0.0f};
+        Vec3 result{0.0f};
+        Mask inside = simd::AllFalse();
+        Mask active = simd::AllTrue();
+
+        for (int i = 0; i < numberOfSteps && simd::Any(active); ++i) {
+            Vec3 position = ro + rd * currDistance;
+
+            Liquid liq = Map(position);
+            if (!particleBased) liq.grad = CalcNormal(position, liq.val);
+
+            Mask hit = active & (liq.val < minimumHitDistance);
+            Mask missed = simd::AndNot(active, hit);
+            Mask escaped = missed & (totalDistance > maximumTraceDistance);
+            Mask marching = simd::AndNot(missed, escaped);
+
+            if (simd::Any(hit)) {
+                // Entered the liquid for the first time
+                Mask enter = simd::AndNot(hit, inside);
+                if (simd::Any(enter)) {
+                    currDistance = simd::Select(enter, 0.0f, currDistance);
+                    ro = simd::Select(enter, position, ro);
+                    rd = simd::Select(enter, cpu::Refract(rd, liq.grad, eta), rd);
+                    inside = inside | enter;
+                    if (particleBased) {
+                        Vec3 reflection = cpu::Reflect(rd, liq.grad);
+                        Float spec =
+                            simd::Pow(simd::Max(simd::Dot(reflection,
+                                                          simd::Normalize(sunPos - position)),
+                                                0.0f),
+                                      waterShininess) *
+                            specularFactor;
+                        color = simd::Select(
+                            enter, color + cpu::Splat(lightColor) * spec, color);
+                    }
+                }
+
+                Float prevRestEnergy = unabsorbedEnergy;
+                unabsorbedEnergy = simd::Select(
+                    hit, unabsorbedEnergy * stepTransmittance, unabsorbedEnergy);
+                totalDistance = simd::Select(hit, totalDistance + density,
+                                             totalDistance);
+                currDistance =
+                    simd::Select(hit, currDistance + density, currDistance);
+                Float absorptionThisStep = prevRestEnergy - unabsorbedEnergy;
+
+                // Diffuse light, attenuation 1 / dist
+                Vec3 toLight = sunPos - position;
+                Float lightScale = Float(intensity) / simd::Length(toLight);
+
+                Vec3 newColor;
+                if (particleBased) {
+                    newColor = color + liq.col * cpu::Splat(lightColor) *
+                                           (lightScale * absorptionThisStep *
+                                            diffuseFactor);
+                } else {
+                    Float blend = simd::Pow(
+                        simd::SmoothStep(0.0f, -0.02f, rd.y), 0.2f);
+                    newColor = simd::Mix(
+                        SkyColor(rd),
+                        SeaColor(position, liq.grad, lightDirection, rd, toLight),
+                        blend);
+                }
+                newColor = newColor +
+                           liq.col * (absorptionThisStep * ambientFactor);
+                color = simd::Select(hit, newColor, color);
+
+                Mask absorbed = hit & (unabsorbedEnergy <= 0.0f);
+                result = simd::Select(absorbed, color, result);
+                active = simd::AndNot(active, absorbed);
+            }
+
+            if (simd::Any(escaped)) {
+                // Sky only if the ray never went through liquid
+                Vec3 sky = SkyColor(rd);
+                Vec3 through = color + sky * unabsorbedEnergy;
+                result = simd::Select(escaped,
+                                      simd::Select(unabsorbedEnergy == 1.0f,
+                                                   sky, through),
+                                      result);
+                active = simd::AndNot(active, escaped);
+            }
+
+            if (simd::Any(marching)) {
+                totalDistance = simd::Select(
+                    marching, totalDistance + liq.val, totalDistance);
+                currDistance = simd::Select(marching, currDistance + liq.val,
+                                            currDistance);
+                // Refract when leaving, the traveled distance is kept
+                Mask leave = marching & inside;
+                if (simd::Any(leave)) {
+                    ro = simd::Select(leave, position, ro);
+                    rd = simd::Select(leave, cpu::Refract(rd, liq.grad, eta), rd);
+                    inside = simd::AndNot(inside, leave);
+                }
+            }
+        }
+        return simd::Select(active, color, result);
+    }
+};
+
+}  // namespace
+
+void CpuFluidRenderer::Render(const UniformBufferObject& ubo, uint32_t width,
+                              uint32_t height, uint8_t *rgba) const
+{
+    FluidScene scene;
+    scene.particleBased = ubo.particleBasedFluid == 1;
+    scene.totalTime = ubo.totalTime;
+    scene.windOffset = ubo.totalTime * 0.5f * ubo.windDirection;
+    scene.sunPosition = ubo.sunPosition;
+    // The SPH fluid only runs on the GPU, the particle mode here keeps the
+    // former 5x5 grid of spheres bobbing up and down, phase |x| + |z|
+    for (int z = -2; z <= 2; ++z) {
+        for (int x = -2; x <= 2; ++x) {
+            float phase = static_cast<float>(std::abs(x) + std::abs(z));
+            scene.centers.emplace_back(
+                static_cast<float>(x),
+                std::cos(ubo.totalTime + phase) * 0.25f,
+                static_cast<float>(z));
+        }
+    }
+
+    const Vec3 ro = cpu::Splat(ubo.cameraPosition);
+    cpu::RenderTiles(*pool, width, height, rgba, [&](Float x, Float y) {
+        Vec3 rd = cpu::PrimaryRay(x, y, width, height, ubo.rotationY);
+        return scene.RayMarch(ro, rd);
+    });
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+#include "config.h"
+#include "thread_pool.h"
+
+// CPU port of shaders/volumetric.comp (water surface and the particle based
+// fluid). Each lane of a packet tracks its own refraction state, so rays
+// entering and leaving the liquid diverge under SIMD masks.
+class CpuFluidRenderer {
+public:
+    explicit CpuFluidRenderer(ThreadPool *pool) : pool{pool} {};
+
+    // Writes width * height RGBA8 pixels
+    void Render(const UniformBufferObject& ubo, uint32_t width,
+                uint32_t height, uint8_t *rgba) const;
+
+private:
+    ThreadPool *pool;
+};
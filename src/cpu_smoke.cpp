@@ -0,0 +1,193 @@
+#include "cpu_smoke.h"
+
+#include <stdexcept>
+
+#include "cpu_utils.h"
+#include "noise_volume.h"
+
+namespace {
+
+using cpu::Float;
+using cpu::Mask;
+using cpu::Vec3;
+
+// Constants of smoke.comp
+constexpr int maxSteps = 200;
+constexpr float marchSize = 0.08f;
+constexpr int maxStepsLights = 6;
+constexpr float absorptionCoefficient = 0.9f;
+constexpr float scatteringAniso = 0.3f;
+constexpr float shadowTmin = 0.5f;
+constexpr float shadowTmax = 10.0f;
+constexpr float shadowK = 32.0f;
+
+struct SmokeScene {
+    std::vector<glm::vec4> spheres;  // particle position (xyz) and scale (w)
+    glm::vec3 windOffset;
+    glm::vec3 sunPosition;
+    glm::vec3 sunDirection;
+    const NoiseVolume *noiseVolume = nullptr;  // fbmVolume() when set
+
+    // fbmVolume() of utils.glsl, the texture fetches are done per lane
+    Float FbmVolume(const Vec3& p) const
+    {
+        const float scale = 1.0f / static_cast<float>(NoiseVolume::extent);
+        alignas(64) float x[simd::width], y[simd::width], z[simd::width];
+        alignas(64) float f[simd::width];
+        ((p.x + windOffset.x) * scale).Store(x);
+        ((p.y + windOffset.y) * scale).Store(y);
+        ((p.z + windOffset.z) * scale).Store(z);
+        for (int i = 0; i < simd::width; ++i) {
+            f[i] = noiseVolume->Sample(x[i], y[i], z[i]) +
+                   0.125f * noiseVolume->Sample(x[i] * 8.0f, y[i] * 8.0f,
+                                                z[i] * 8.0f);
+        }
+        return Float::Load(f);
+    }
+
+    // scene(p, flag), ground is set where flag would be 0
+    Float Density(const Vec3& p, Mask& ground) const
+    {
+        Float distance = cpu::SdSphere(p + cpu::Splat(glm::vec3(spheres[0])),
+                                       spheres[0].w);
+        for (size_t i = 1; i < spheres.size(); ++i) {
+            Float d = cpu::SdSphere(p + cpu::Splat(glm::vec3(spheres[i])),
+                                      spheres[i].w);
+            distance =
+                cpu::OpSmoothUnion(d, distance, 2.0f * spheres[i].w);
+        }
+
+        // sdPlane(p, vec3(0, -0.5, 0), 3)
+        Float plane = simd::MulAdd(p.y, -0.5f, 3.0f);
+        Float overlap = simd::Min(distance, plane);
+        ground = plane < distance;
+
+        // Noise only above the ground, skipped when no lane needs it
+        if (simd::All(ground)) return -overlap;
+        Float smoke = -overlap + (noiseVolume ? FbmVolume(p)
+                                              : cpu::Fbm(p, windOffset, 6));
+        return simd::Select(ground, -overlap, smoke);
+    }
+
+    Float LightMarch(Vec3 position, Mask active) const
+    {
+        const Vec3 step = cpu::Splat(sunDirection * 0.03f);
+        Float totalDensity = 0.0f;
+        for (int i = 0; i < maxStepsLights && simd::Any(active); ++i) {
+            position = position + step * Float(static_cast<float>(i));
+            Mask ground;
+            Float lightSample = Density(position, ground);
+            totalDensity =
+                simd::Select(active, totalDensity + lightSample, totalDensity);
+            // Lanes reaching the ground return right away
+            active = simd::AndNot(active, ground);
+        }
+        return cpu::BeersLaw(totalDensity, absorptionCoefficient);
+    }
+
+    Float SoftShadow(const Vec3& ro, const Vec3& rd, Mask active) const
+    {
+        Float res = 1.0f;
+        Float t = shadowTmin;
+        while (simd::Any(active)) {
+            Mask ground;
+            Float h = -Density(ro + rd * t, ground);
+            Mask blocked = active & (h < 0.001f);
+            res = simd::Select(blocked, 0.0f, res);
+            active = simd::AndNot(active, blocked);
+
+            res = simd::Select(active, simd::Min(res, Float(shadowK) * h / t),
+                               res);
+            t = simd::Select(active, t + h, t);
+            active = active & (t < shadowTmax);
+        }
+        return res;
+    }
+
+    Float RayMarch(const Vec3& ro, const Vec3& rd, Float offset) const
+    {
+        const Vec3 sunPos = cpu::Splat(sunPosition);
+        Float depth = Float(marchSize) * offset;
+        Vec3 p = ro + rd * depth;
+
+        Float totalTransmittance = 1.0f;
+        Float lightEnergy = 0.0f;
+        Float phase = cpu::HenyeyGreenstein(
+            scatteringAniso, simd::Dot(rd, cpu::Splat(sunDirection)));
+
+        for (int i = 0; i < maxSteps; ++i) {
+            Mask ground;
+            Float density = Density(p, ground);
+
+            Mask inside = density > 0.0f;
+            if (simd::Any(inside)) {
+                Float lightTransmittance = LightMarch(p, inside);
+                Float luminance = simd::MulAdd(density, phase, 0.025f);
+                Float sd = SoftShadow(p, simd::Normalize(sunPos - p), inside);
+
+                totalTransmittance =
+                    simd::Select(inside, totalTransmittance * lightTransmittance,
+                                 totalTransmittance);
+                Float energy = simd::Select(
+                    ground, totalTransmittance * sd * 0.5f * density,
+                    totalTransmittance * luminance * sd * 0.5f);
+                lightEnergy =
+                    simd::Select(inside, lightEnergy + energy, lightEnergy);
+            }
+
+            depth = depth + marchSize;
+            p = ro + rd * depth;
+        }
+        return simd::Clamp(lightEnergy, 0.0f, 1.0f);
+    }
+};
+
+}  // namespace
+
+void CpuSmokeRenderer::Render(const UniformBufferObject& ubo,
+                              const ParticleStore& particles,
+                              uint32_t width, uint32_t height, uint8_t *rgba,
+                              float blueNoise) const
+{
+    if (particles.IsEmpty()) {
+        throw std::runtime_error("CPU smoke renderer needs particles!");
+    }
+
+    SmokeScene scene;
+    for (uint32_t i = 0; i < particles.Size(); ++i) {
+        scene.spheres.push_back(particles.GetPosition(i));
+    }
+    scene.windOffset = ubo.totalTime * 0.5f * ubo.windDirection;
+    scene.sunPosition = ubo.sunPosition;
+    scene.sunDirection = glm::normalize(ubo.sunPosition);
+    if (ubo.useNoiseVolume == 1 && noiseVolume && !noiseVolume->IsEmpty()) {
+        scene.noiseVolume = noiseVolume;
+    }
+
+    const Vec3 ro = cpu::Splat(ubo.cameraPosition);
+    const Vec3 sunDirection = cpu::Splat(scene.sunDirection);
+    const Vec3 sunColor{Float(1.0f), Float(0.8f), Float(0.6f)};
+    float offset = blueNoise + static_cast<float>(ubo.frame % 32) /
+                                   std::sqrt(0.5f);
+    offset -= std::floor(offset);
+
+    cpu::RenderTiles(*pool, width, height, rgba, [&](Float x, Float y) {
+        Vec3 rd = cpu::PrimaryRay(x, y, width, height, ubo.rotationY);
+
+        // Sun and sky
+        Float sun = simd::Clamp(simd::Dot(sunDirection, rd), 0.0f, 1.0f);
+        Float sunPow = simd::Pow(sun, 10.0f);
+        Vec3 color{Float(0.7f) - Float(0.4f * 0.90f) * rd.y +
+                       Float(0.5f * 1.0f) * sunPow,
+                   Float(0.7f) - Float(0.4f * 0.75f) * rd.y +
+                       Float(0.5f * 0.5f) * sunPow,
+                   Float(0.9f) - Float(0.4f * 0.90f) * rd.y +
+                       Float(0.5f * 0.3f) * sunPow};
+
+        // Cloud
+        Float res = scene.RayMarch(ro, rd, offset);
+        color = color + sunColor * res;
+        return Vec3{simd::Pow(color.x, 1.8f), simd::Pow(color.y, 1.8f),
+                    simd::Pow(color.z, 1.8f)};
+    });
+}
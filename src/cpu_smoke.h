@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+#include "particle_store.h"
+#include "thread_pool.h"
+
+class NoiseVolume;
+
+// CPU port of shaders/smoke.comp. Rays are marched in SIMD packets (see
+// simd.h) and tiles are spread over the thread pool. Used as the GPU-less
+// fallback and as the golden reference for shader changes.
+class CpuSmokeRenderer {
+public:
+    explicit CpuSmokeRenderer(ThreadPool *pool) : pool{pool} {};
+
+    // Volume sampled instead of fbm(p, 6), an approximation, when
+    // ubo.useNoiseVolume is set,
+    // must outlive the renderer
+    void SetNoiseVolume(const NoiseVolume *volume) { noiseVolume = volume; }
+
+    // Writes width * height RGBA8 pixels. blueNoise replaces the binding 4
+    // fetch, which reads one texel per 1024x1024 block on the GPU.
+    void Render(const UniformBufferObject& ubo, const ParticleStore& particles,
+                uint32_t width, uint32_t height, uint8_t *rgba,
+                float blueNoise = 0.0f) const;
+
+private:
+    ThreadPool *pool;
+    const NoiseVolume *noiseVolume = nullptr;
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+// SIMD ports of the helpers in shaders/utils.glsl plus the tile/packet loop
+// shared by the CPU ray marchers. Keep these in sync with the GLSL side,
+// the CPU path is the reference the shaders are validated against.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "config.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace cpu {
+
+using simd::Float;
+using simd::Mask;
+using simd::Vec3;
+
+constexpr float PI = 3.14159265359f;
+
+inline Vec3 Splat(const glm::vec3& v) { return Vec3{Float(v.x), Float(v.y), Float(v.z)}; }
+
+inline Float SdSphere(const Vec3& p, Float radius) { return simd::Length(p) - radius; }
+
+inline Float BeersLaw(Float dist, float absorption)
+{
+    return simd::Exp(-dist * absorption);
+}
+
+inline Float HenyeyGreenstein(float g, Float mu)
+{
+    float gg = g * g;
+    return Float(1.0f / (4.0f * PI)) *
+           (Float(1.0f - gg) /
+            simd::Pow(Float(1.0f + gg) - Float(2.0f * g) * mu, 1.5f));
+}
+
+inline Float OpSmoothUnion(Float d1, Float d2, float k)
+{
+    Float h = simd::Clamp(Float(0.5f) + Float(0.5f / k) * (d2 - d1), 0.0f, 1.0f);
+    return simd::Mix(d2, d1, h) - Float(k) * h * (Float(1.0f) - h);
+}
+
+inline Float Hash1(Float n)
+{
+    return simd::Fract(n * 17.0f * simd::Fract(n * 0.3183099f));
+}
+
+inline Float Noise(const Vec3& x)
+{
+    Vec3 p = simd::Floor(x);
+    Vec3 w = x - p;
+    Vec3 u = w * w * w *
+             Vec3{simd::MulAdd(w.x, simd::MulAdd(w.x, 6.0f, -15.0f), 10.0f),
+                  simd::MulAdd(w.y, simd::MulAdd(w.y, 6.0f, -15.0f), 10.0f),
+                  simd::MulAdd(w.z, simd::MulAdd(w.z, 6.0f, -15.0f), 10.0f)};
+
+    Float n = p.x + Float(317.0f) * p.y + Float(157.0f) * p.z;
+
+    Float a = Hash1(n);
+    Float b = Hash1(n + 1.0f);
+    Float c = Hash1(n + 317.0f);
+    Float d = Hash1(n + 318.0f);
+    Float e = Hash1(n + 157.0f);
+    Float f = Hash1(n + 158.0f);
+    Float g = Hash1(n + 474.0f);
+    Float h = Hash1(n + 475.0f);
+
+    Float k0 = a;
+    Float k1 = b - a;
+    Float k2 = c - a;
+    Float k3 = e - a;
+    Float k4 = a - b - c + d;
+    Float k5 = a - c - e + g;
+    Float k6 = a - b - e + f;
+    Float k7 = -a + b + c - d + e - f - g + h;
+
+    Float sum = k0 + k1 * u.x + k2 * u.y + k3 * u.z + k4 * u.x * u.y +
+                k5 * u.y * u.z + k6 * u.z * u.x + k7 * u.x * u.y * u.z;
+    return Float(-1.0f) + Float(2.0f) * sum;
+}
+
+// fbm(p, iterations) from utils.glsl, windOffset = totalTime * 0.5 * wind
+inline Float Fbm(const Vec3& p, const glm::vec3& windOffset, int iterations)
+{
+    Vec3 q = p + Splat(windOffset);
+    Float f = 0.0f;
+    float scale = 0.5f;
+    float factor = 2.02f;
+    for (int i = 0; i < iterations; ++i) {
+        f = simd::MulAdd(Float(scale), Noise(q), f);
+        q = q * Float(factor);
+        factor += 0.21f;
+        scale *= 0.5f;
+    }
+    return f;
+}
+
+// sminN from utils.glsl, returns the blended distance and the mix factor
+inline Float SminN(Float a, Float b, float k, float n, Float& mixFactor)
+{
+    Float h = simd::Max(Float(k) - simd::Abs(a - b), 0.0f) / k;
+    Float m = simd::Pow(h, n) * 0.5f;
+    Float s = m * (k / n);
+    Mask aSmaller = a < b;
+    mixFactor = simd::Select(aSmaller, m, Float(1.0f) - m);
+    return simd::Select(aSmaller, a - s, b - s);
+}
+
+inline Float SmoothVoronoi(Float x, Float y)
+{
+    Float px = simd::Floor(x);
+    Float py = simd::Floor(y);
+    Float fx = x - px;
+    Float fy = y - py;
+
+    Float res = 0.0f;
+    for (int j = -1; j <= 1; ++j) {
+        for (int i = -1; i <= 1; ++i) {
+            Float n = Noise(Vec3{px + static_cast<float>(i),
+                                 py + static_cast<float>(j), Float(0.0f)});
+            Float rx = Float(static_cast<float>(i)) - fx + n;
+            Float ry = Float(static_cast<float>(j)) - fy + n;
+            Float d = simd::Sqrt(rx * rx + ry * ry);
+            res = res + simd::Exp(d * -32.0f);
+        }
+    }
+    return Float(-1.0f / 32.0f) * simd::Log(res);
+}
+
+// GLSL reflect/refract
+inline Vec3 Reflect(const Vec3& i, const Vec3& n)
+{
+    return i - n * (Float(2.0f) * simd::Dot(n, i));
+}
+
+inline Vec3 Refract(const Vec3& i, const Vec3& n, float eta)
+{
+    Float cosI = simd::Dot(n, i);
+    Float k = Float(1.0f) - Float(eta * eta) * (Float(1.0f) - cosI * cosI);
+    Vec3 refracted =
+        i * Float(eta) - n * (Float(eta) * cosI + simd::Sqrt(simd::Max(k, 0.0f)));
+    return simd::Select(k < 0.0f, Vec3{0.0f}, refracted);
+}
+
+// rotateVector(d, vec3(0, 1, 0), angle) from utils.glsl
+inline Vec3 RotateY(const Vec3& d, float angle)
+{
+    Float c = std::cos(angle);
+    Float s = std::sin(angle);
+    return Vec3{c * d.x - s * d.z, d.y, s * d.x + c * d.z};
+}
+
+// Primary ray of the compute shaders' main()
+inline Vec3 PrimaryRay(Float x, Float y, uint32_t width, uint32_t height,
+                       float angle)
+{
+    Float h = Float(2.0f) * x / static_cast<float>(width) - 1.0f;
+    Float v = Float(2.0f) * y / static_cast<float>(height) - 1.0f;
+    return RotateY(simd::Normalize(Vec3{h, v, Float(-1.0f)}), angle);
+}
+
+// Pixels are handed out in tiles of packets, simd::width pixels of one row
+// per packet. shade(x, y) returns the color a shader would imageStore().
+// Lanes past the right edge are computed but never written.
+constexpr uint32_t tileWidth = 32;
+constexpr uint32_t tileHeight = 8;
+static_assert(tileWidth % simd::width == 0);
+
+template <typename ShadeFn>
+void RenderTiles(ThreadPool& pool, uint32_t width, uint32_t height,
+                 uint8_t *rgba, ShadeFn&& shade)
+{
+    const uint32_t tilesX = (width + tileWidth - 1) / tileWidth;
+    const uint32_t tilesY = (height + tileHeight - 1) / tileHeight;
+
+    pool.ParallelFor(tilesX * tilesY, [&](uint32_t tile, uint32_t) {
+        const uint32_t x0 = (tile % tilesX) * tileWidth;
+        const uint32_t y0 = (tile / tilesX) * tileHeight;
+        const uint32_t x1 = std::min(x0 + tileWidth, width);
+        const uint32_t y1 = std::min(y0 + tileHeight, height);
+
+        alignas(64) float r[simd::width], g[simd::width], b[simd::width];
+        for (uint32_t y = y0; y < y1; ++y) {
+            for (uint32_t x = x0; x < x1; x += simd::width) {
+                Vec3 color = shade(Float::Ramp(static_cast<float>(x)),
+                                   Float(static_cast<float>(y)));
+                color.x.Store(r);
+                color.y.Store(g);
+                color.z.Store(b);
+
+                // rgba8 storage image: clamp and round like the UNORM write
+                auto toUnorm = [](float value) -> uint8_t {
+                    if (!(value > 0.0f)) return 0;  // also catches NaN
+                    if (value >= 1.0f) return 255;
+                    return static_cast<uint8_t>(value * 255.0f + 0.5f);
+                };
+                uint8_t *out = rgba + (static_cast<size_t>(y) * width + x) * 4;
+                const uint32_t count = std::min<uint32_t>(simd::width, x1 - x);
+                for (uint32_t i = 0; i < count; ++i) {
+                    out[i * 4 + 0] = toUnorm(r[i]);
+                    out[i * 4 + 1] = toUnorm(g[i]);
+                    out[i * 4 + 2] = toUnorm(b[i]);
+                    out[i * 4 + 3] = 255;
+                }
+            }
+        }
+    });
+}
+
+}  // namespace cpu
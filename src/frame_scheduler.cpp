@@ -0,0 +1,179 @@
+#include "frame_scheduler.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+VkSemaphore createSemaphore(VkDevice device, VkSemaphoreType type)
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = type;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create frame semaphore!");
+    }
+    return semaphore;
+}
+
+}  // namespace
+
+void FrameScheduler::Init(VkDevice device, uint32_t framesInFlight)
+{
+    if (framesInFlight < 1 || framesInFlight > maxFramesInFlight) {
+        throw std::invalid_argument(fmt::format(
+            "frames in flight must be 1-{}: {}", maxFramesInFlight,
+            framesInFlight));
+    }
+
+    this->device = device;
+    this->framesInFlight = framesInFlight;
+    frameIndex = 0;
+    slot = 0;
+
+    computeTimeline = createSemaphore(device, VK_SEMAPHORE_TYPE_TIMELINE);
+    graphicsTimeline = createSemaphore(device, VK_SEMAPHORE_TYPE_TIMELINE);
+    computeValues.assign(framesInFlight, 0);
+    graphicsValues.assign(framesInFlight, 0);
+
+    imageAvailableSemaphores.resize(framesInFlight);
+    renderFinishedSemaphores.resize(framesInFlight);
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        imageAvailableSemaphores[i] =
+            createSemaphore(device, VK_SEMAPHORE_TYPE_BINARY);
+        renderFinishedSemaphores[i] =
+            createSemaphore(device, VK_SEMAPHORE_TYPE_BINARY);
+    }
+}
+
+void FrameScheduler::Cleanup()
+{
+    if (device == VK_NULL_HANDLE) return;
+
+    WaitIdle();
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+        vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+    }
+    vkDestroySemaphore(device, computeTimeline, nullptr);
+    vkDestroySemaphore(device, graphicsTimeline, nullptr);
+    imageAvailableSemaphores.clear();
+    renderFinishedSemaphores.clear();
+    device = VK_NULL_HANDLE;
+}
+
+uint32_t FrameScheduler::BeginFrame()
+{
+    slot = static_cast<uint32_t>(frameIndex % framesInFlight);
+
+    // Only the queues the slot's previous frame reached have to be waited for
+    VkSemaphore semaphores[2];
+    uint64_t values[2];
+    uint32_t count = 0;
+    if (computeValues[slot] > 0) {
+        semaphores[count] = computeTimeline;
+        values[count++] = computeValues[slot];
+    }
+    if (graphicsValues[slot] > 0) {
+        semaphores[count] = graphicsTimeline;
+        values[count++] = graphicsValues[slot];
+    }
+    if (count == 0) return slot;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = count;
+    waitInfo.pSemaphores = semaphores;
+    waitInfo.pValues = values;
+    if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+        throw std::runtime_error("failed to wait for frame slot!");
+    }
+    return slot;
+}
+
+void FrameScheduler::EndFrame() { ++frameIndex; }
+
+void FrameScheduler::WaitIdle()
+{
+    VkSemaphore semaphores[] = {computeTimeline, graphicsTimeline};
+    uint64_t values[] = {
+        *std::max_element(computeValues.begin(), computeValues.end()),
+        *std::max_element(graphicsValues.begin(), graphicsValues.end())};
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 2;
+    waitInfo.pSemaphores = semaphores;
+    waitInfo.pValues = values;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+}
+
+void FrameScheduler::SubmitCompute(VkQueue queue,
+                                   VkCommandBuffer commandBuffer)
+{
+    uint64_t signalValue = frameIndex + 1;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &computeTimeline;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit compute command buffer!");
+    }
+    computeValues[slot] = signalValue;
+}
+
+void FrameScheduler::SubmitGraphics(VkQueue queue,
+                                    VkCommandBuffer commandBuffer,
+                                    VkPipelineStageFlags computeWaitStage)
+{
+    // Values of binary semaphores are ignored
+    VkSemaphore waitSemaphores[] = {computeTimeline,
+                                    imageAvailableSemaphores[slot]};
+    uint64_t waitValues[] = {computeValues[slot], 0};
+    VkPipelineStageFlags waitStages[] = {
+        computeWaitStage, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+    VkSemaphore signalSemaphores[] = {graphicsTimeline,
+                                      renderFinishedSemaphores[slot]};
+    uint64_t signalValues[] = {frameIndex + 1, 0};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+    timelineInfo.signalSemaphoreValueCount = 2;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 2;
+    submitInfo.pWaitSemaphores = waitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 2;
+    submitInfo.pSignalSemaphores = signalSemaphores;
+
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit draw command buffer!");
+    }
+    graphicsValues[slot] = frameIndex + 1;
+}
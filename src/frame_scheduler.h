@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Paces the CPU against the GPU with one timeline semaphore per queue
+// instead of a fence per frame slot and queue. Frame n signals value n + 1
+// on every queue it was submitted to; its slot (n % framesInFlight) is
+// recorded again once the values of the frame that last used it were
+// reached, a single vkWaitSemaphores over both queues. The CPU can therefore
+// record up to framesInFlight - 1 frames ahead of the GPU.
+//
+// Binary semaphores are only left where the swapchain requires them, for
+// acquiring and presenting images.
+class FrameScheduler {
+public:
+    static constexpr uint32_t maxFramesInFlight = 4;
+
+    void Init(VkDevice device, uint32_t framesInFlight);
+    // Waits for every submitted frame and destroys the semaphores
+    void Cleanup();
+
+    // Blocks until the next frame's slot is no longer used by the GPU and
+    // returns it
+    uint32_t BeginFrame();
+    // Moves on to the next frame, also when it was not (fully) submitted
+    void EndFrame();
+    // Blocks until the GPU finished every submitted frame
+    void WaitIdle();
+
+    // Signals the compute timeline once the frame's compute work is done
+    void SubmitCompute(VkQueue queue, VkCommandBuffer commandBuffer);
+    // Waits for the frame's compute work at `computeWaitStage` and for the
+    // acquired swapchain image, signals the graphics timeline and the
+    // semaphore the present waits for
+    void SubmitGraphics(VkQueue queue, VkCommandBuffer commandBuffer,
+                        VkPipelineStageFlags computeWaitStage);
+
+    VkSemaphore GetImageAvailableSemaphore() const
+    {
+        return imageAvailableSemaphores[slot];
+    }
+    VkSemaphore GetRenderFinishedSemaphore() const
+    {
+        return renderFinishedSemaphores[slot];
+    }
+
+    uint32_t GetFramesInFlight() const { return framesInFlight; }
+    uint32_t GetSlot() const { return slot; }
+    // Index of the current frame counted since Init, never reset
+    uint64_t GetFrameIndex() const { return frameIndex; }
+
+private:
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t framesInFlight = 0;
+    uint64_t frameIndex = 0;
+    uint32_t slot = 0;
+
+    VkSemaphore computeTimeline = VK_NULL_HANDLE;
+    VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+    // Values last signalled by each slot, 0 = nothing to wait for
+    std::vector<uint64_t> computeValues;
+    std::vector<uint64_t> graphicsValues;
+
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+};
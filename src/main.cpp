@@ -1,15 +1,244 @@
 #include <fmt/format.h>
+#include <cstdio>
 #include <filesystem>
+#include <string>
 #include "application.h"
 
+static void printUsage()
+{
+    fmt::print(
+        "Usage: Vulkan_Volumetric_Renderer [options]\n"
+        "  --headless             render offscreen without window/swapchain\n"
+        "  --frames <n>           number of headless frames (default 1)\n"
+        "  --width <px>           output width\n"
+        "  --height <px>          output height\n"
+        "  --pipeline <name>      fluid (default) or smoke\n"
+        "  --output <file.ppm>    headless: write the last frame\n"
+        "  --render-scale <n>     ray march at 1/n resolution: 1, 2 or 4\n"
+        "  --temporal <n>         accumulate the smoke over ~n frames (2-64)\n"
+        "  --frames-in-flight <n> frames queued ahead of the GPU, 1-4 "
+        "(default 2)\n"
+        "  --particles <n>        smoke particle count (default 5)\n"
+        "  --particle-fluid       start the fluid as SPH particles\n"
+        "  --fluid-particles <n>  SPH fluid particle count (default 16384)\n"
+        "  --transmittance-cutoff <f> stop smoke rays below, 0-1 "
+        "(default 0.01)\n"
+        "  --step-growth <f>      smoke step growth per unit depth "
+        "(default 0.05)\n"
+        "  --sample-budget <n>    smoke samples per ray, 1-4096 "
+        "(default 1024)\n"
+        "  --on-demand            only render when the scene changes, refine "
+        "still frames\n"
+        "  --noise-volume         smoke noise from the baked volume, an "
+        "approximation of fbm\n"
+        "  --volume <path>        smoke density from a sparse brick volume, a "
+        ".vvb file or\n"
+        "                         a directory of them played as a sequence\n"
+        "  --volume-fps <f>       volume sequence frame rate (default 24)\n"
+        "  --volume-prefetch <n>  volume frames loaded ahead (default 4)\n"
+        "  --volume-budget <MiB>  GPU memory of cached volume frames "
+        "(default 512)\n"
+        "  --convert-volume <in.raw> <WxHxD> <out.vvb>\n"
+        "                         write a float32 grid (x fastest) as a "
+        "brick volume and exit\n"
+        "  --volume-bounds <x0,y0,z0,x1,y1,z1> world bounds of the converted "
+        "grid\n"
+        "  --volume-threshold <f> converted bricks up to it are left out "
+        "(default 0)\n"
+        "  --verify-volume        debug: read the converted file back and "
+        "compare it\n"
+        "  --benchmark            time every compute pipeline for --frames\n"
+        "  --warmup <n>           unmeasured frames per pipeline (default 10)\n"
+        "  --report <file.json>   benchmark report (default benchmark.json)\n"
+        "  --cpu                  headless on the CPU ray marchers, no GPU\n"
+        "  --threads <n>          CPU worker threads (default all)\n");
+}
+
+static RenderOptions parseArguments(int argc, char **argv)
+{
+    RenderOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(
+                    fmt::format("missing value for {}", arg));
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--frames") {
+            options.frames = std::stoul(nextValue());
+        } else if (arg == "--width") {
+            options.width = std::stoul(nextValue());
+        } else if (arg == "--height") {
+            options.height = std::stoul(nextValue());
+        } else if (arg == "--pipeline") {
+            std::string pipeline = nextValue();
+            if (pipeline == "fluid") {
+                options.pipeline = 0;
+            } else if (pipeline == "smoke") {
+                options.pipeline = 1;
+            } else {
+                throw std::invalid_argument(
+                    fmt::format("unknown pipeline: {}", pipeline));
+            }
+        } else if (arg == "--output") {
+            options.outputPath = nextValue();
+        } else if (arg == "--render-scale") {
+            options.renderScale = std::stoul(nextValue());
+            if (options.renderScale != 1 && options.renderScale != 2 &&
+                options.renderScale != 4) {
+                throw std::invalid_argument(fmt::format(
+                    "render scale must be 1, 2 or 4: {}", options.renderScale));
+            }
+        } else if (arg == "--temporal") {
+            options.temporalFrames = std::stoul(nextValue());
+            if (options.temporalFrames < 2 || options.temporalFrames > 64) {
+                throw std::invalid_argument(
+                    fmt::format("temporal frames must be 2-64: {}",
+                                options.temporalFrames));
+            }
+        } else if (arg == "--frames-in-flight") {
+            options.framesInFlight = std::stoul(nextValue());
+            if (options.framesInFlight < 1 ||
+                options.framesInFlight > FrameScheduler::maxFramesInFlight) {
+                throw std::invalid_argument(
+                    fmt::format("frames in flight must be 1-{}: {}",
+                                FrameScheduler::maxFramesInFlight,
+                                options.framesInFlight));
+            }
+        } else if (arg == "--particles") {
+            options.particleCount = std::stoul(nextValue());
+            // 48 byte particles within the guaranteed 128 MiB storage
+            // buffer range
+            if (options.particleCount < 1 ||
+                options.particleCount > (1u << 21)) {
+                throw std::invalid_argument(fmt::format(
+                    "particle count must be 1-{}: {}", 1u << 21,
+                    options.particleCount));
+            }
+        } else if (arg == "--particle-fluid") {
+            options.particleFluid = true;
+        } else if (arg == "--fluid-particles") {
+            options.fluidParticleCount = std::stoul(nextValue());
+            // The dam break block has to fit into the simulation box
+            if (options.fluidParticleCount < 1 ||
+                options.fluidParticleCount > (1u << 16)) {
+                throw std::invalid_argument(fmt::format(
+                    "fluid particle count must be 1-{}: {}", 1u << 16,
+                    options.fluidParticleCount));
+            }
+        } else if (arg == "--transmittance-cutoff") {
+            options.marchPolicy.transmittanceCutoff = std::stof(nextValue());
+            if (options.marchPolicy.transmittanceCutoff < 0.0f ||
+                options.marchPolicy.transmittanceCutoff > 1.0f) {
+                throw std::invalid_argument(
+                    fmt::format("transmittance cutoff must be 0-1: {}",
+                                options.marchPolicy.transmittanceCutoff));
+            }
+        } else if (arg == "--step-growth") {
+            options.marchPolicy.stepGrowth = std::stof(nextValue());
+            if (options.marchPolicy.stepGrowth < 0.0f) {
+                throw std::invalid_argument(
+                    fmt::format("step growth must not be negative: {}",
+                                options.marchPolicy.stepGrowth));
+            }
+        } else if (arg == "--sample-budget") {
+            const unsigned long budget = std::stoul(nextValue());
+            if (budget < 1 || budget > MarchPolicy::maxSampleBudget) {
+                throw std::invalid_argument(
+                    fmt::format("sample budget must be 1-{}: {}",
+                                MarchPolicy::maxSampleBudget, budget));
+            }
+            options.marchPolicy.sampleBudget = static_cast<uint32_t>(budget);
+        } else if (arg == "--on-demand") {
+            options.renderOnDemand = true;
+        } else if (arg == "--noise-volume") {
+            options.noiseVolume = true;
+        } else if (arg == "--volume") {
+            options.volumePath = nextValue();
+        } else if (arg == "--volume-fps") {
+            options.volumePlayback.fps = std::stof(nextValue());
+            if (!(options.volumePlayback.fps > 0.0f)) {
+                throw std::invalid_argument(
+                    fmt::format("volume frame rate must be positive: {}",
+                                options.volumePlayback.fps));
+            }
+        } else if (arg == "--volume-prefetch") {
+            options.volumePlayback.prefetchFrames = std::stoul(nextValue());
+            if (options.volumePlayback.prefetchFrames < 1) {
+                throw std::invalid_argument(
+                    "volume prefetch must be at least 1 frame");
+            }
+        } else if (arg == "--volume-budget") {
+            options.volumePlayback.cacheBudgetMiB = std::stoul(nextValue());
+        } else if (arg == "--convert-volume") {
+            VolumeConversion& conversion = options.volumeConversion;
+            conversion.rawPath = nextValue();
+            const std::string size = nextValue();
+            if (std::sscanf(size.c_str(), "%ux%ux%u", &conversion.size.x,
+                            &conversion.size.y, &conversion.size.z) != 3) {
+                throw std::invalid_argument(
+                    fmt::format("grid size must be WxHxD: {}", size));
+            }
+            conversion.outputPath = nextValue();
+        } else if (arg == "--volume-bounds") {
+            VolumeConversion& conversion = options.volumeConversion;
+            const std::string bounds = nextValue();
+            if (std::sscanf(bounds.c_str(), "%f,%f,%f,%f,%f,%f",
+                            &conversion.boundsMin.x, &conversion.boundsMin.y,
+                            &conversion.boundsMin.z, &conversion.boundsMax.x,
+                            &conversion.boundsMax.y,
+                            &conversion.boundsMax.z) != 6) {
+                throw std::invalid_argument(fmt::format(
+                    "volume bounds must be x0,y0,z0,x1,y1,z1: {}", bounds));
+            }
+        } else if (arg == "--volume-threshold") {
+            options.volumeConversion.threshold = std::stof(nextValue());
+        } else if (arg == "--verify-volume") {
+            options.volumeConversion.verify = true;
+        } else if (arg == "--benchmark") {
+            options.benchmark = true;
+            options.headless = true;
+        } else if (arg == "--warmup") {
+            options.warmupFrames = std::stoul(nextValue());
+        } else if (arg == "--report") {
+            options.reportPath = nextValue();
+        } else if (arg == "--cpu") {
+            options.cpu = true;
+            options.headless = true;
+        } else if (arg == "--threads") {
+            options.threads = std::stoul(nextValue());
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage();
+            std::exit(EXIT_SUCCESS);
+        } else {
+            throw std::invalid_argument(fmt::format("unknown argument: {}", arg));
+        }
+    }
+    return options;
+}
+
 //----------------------------------------------------------------------------------------
-int main()
+int main(int argc, char **argv)
 {
     auto pwd = std::filesystem::current_path();
     fmt::print("Current path is: {}\n", pwd.generic_string());
 
     try {
-        Application app;
+        RenderOptions options = parseArguments(argc, argv);
+        const VolumeConversion& conversion = options.volumeConversion;
+        if (!conversion.rawPath.empty()) {
+            BrickVolume::ConvertRaw(conversion.rawPath, conversion.outputPath,
+                                    conversion.size, conversion.boundsMin,
+                                    conversion.boundsMax, conversion.threshold,
+                                    conversion.verify);
+            return EXIT_SUCCESS;
+        }
+        Application app{options};
         app.run();
     } catch (const std::exception& e) {
         fmt::print("{}\n", e.what());
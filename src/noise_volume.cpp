@@ -0,0 +1,202 @@
+#include "noise_volume.h"
+
+#include <fmt/format.h>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+float fract(float x) { return x - std::floor(x); }
+
+float hash1(float n) { return fract(n * 17.0f * fract(n * 0.3183099f)); }
+
+int wrap(int i, int period) { return ((i % period) + period) % period; }
+
+// noise() from utils.glsl with the lattice wrapped every `period` cells
+float periodicNoise(const glm::vec3& x, int period)
+{
+    glm::vec3 p = glm::floor(x);
+    glm::vec3 w = x - p;
+    auto fade = [](float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); };
+    glm::vec3 u{fade(w.x), fade(w.y), fade(w.z)};
+
+    int x0 = wrap(static_cast<int>(p.x), period);
+    int y0 = wrap(static_cast<int>(p.y), period);
+    int z0 = wrap(static_cast<int>(p.z), period);
+    int x1 = (x0 + 1) % period;
+    int y1 = (y0 + 1) % period;
+    int z1 = (z0 + 1) % period;
+    auto corner = [](int cx, int cy, int cz) {
+        return hash1(static_cast<float>(cx) + 317.0f * static_cast<float>(cy) +
+                     157.0f * static_cast<float>(cz));
+    };
+
+    float a = corner(x0, y0, z0);
+    float b = corner(x1, y0, z0);
+    float c = corner(x0, y1, z0);
+    float d = corner(x1, y1, z0);
+    float e = corner(x0, y0, z1);
+    float f = corner(x1, y0, z1);
+    float g = corner(x0, y1, z1);
+    float h = corner(x1, y1, z1);
+
+    float k0 = a;
+    float k1 = b - a;
+    float k2 = c - a;
+    float k3 = e - a;
+    float k4 = a - b - c + d;
+    float k5 = a - c - e + g;
+    float k6 = a - b - e + f;
+    float k7 = -a + b + c - d + e - f - g + h;
+
+    return -1.0f + 2.0f * (k0 + k1 * u.x + k2 * u.y + k3 * u.z +
+                           k4 * u.x * u.y + k5 * u.y * u.z + k6 * u.z * u.x +
+                           k7 * u.x * u.y * u.z);
+}
+
+}  // namespace
+
+NoiseVolume::NoiseVolume(uint32_t size) : size{size}
+{
+    if (size == 0 || (size & (size - 1)) != 0) {
+        throw std::runtime_error("noise volume size must be a power of two!");
+    }
+}
+
+void NoiseVolume::LoadOrBake(const std::string& cachePath, ThreadPool& pool)
+{
+    if (Load(cachePath)) {
+        fmt::print("[INFO] Noise volume loaded from {}\n", cachePath);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Bake(pool);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    fmt::print("[INFO] Noise volume {}^3 baked in {:.3f} s\n", size, seconds);
+
+    // A read-only working directory only costs the next start a rebake
+    try {
+        Save(cachePath);
+    } catch (const std::exception& e) {
+        fmt::print("[WARN] {}\n", e.what());
+    }
+}
+
+void NoiseVolume::Bake(ThreadPool& pool)
+{
+    texels.assign(static_cast<size_t>(size) * size * size, 0);
+    const float texelToWorld = static_cast<float>(extent) / static_cast<float>(size);
+
+    pool.ParallelFor(size, [&](uint32_t z, uint32_t) {
+        for (uint32_t y = 0; y < size; ++y) {
+            for (uint32_t x = 0; x < size; ++x) {
+                glm::vec3 p = (glm::vec3(x, y, z) + glm::vec3(0.5f)) * texelToWorld;
+
+                float f = 0.0f;
+                float amplitude = 0.5f;
+                float frequency = 1.0f;
+                int period = static_cast<int>(extent);
+                for (uint32_t octave = 0; octave < octaves; ++octave) {
+                    // Shifted octaves so their lattices do not line up
+                    glm::vec3 offset = static_cast<float>(octave) *
+                                       glm::vec3(31.7f, 17.3f, 23.9f);
+                    f += amplitude * periodicNoise(p * frequency + offset, period);
+                    amplitude *= 0.5f;
+                    frequency *= 2.0f;
+                    period *= 2;
+                }
+                texels[(static_cast<size_t>(z) * size + y) * size + x] =
+                    static_cast<uint16_t>(glm::packHalf1x16(f));
+            }
+        }
+    });
+    decode();
+}
+
+bool NoiseVolume::Load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    FileHeader header{};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, "VVNV", 4) != 0 ||
+        header.version != fileVersion || header.size != size ||
+        header.extent != extent || header.octaves != octaves) {
+        return false;
+    }
+
+    std::vector<uint16_t> data(static_cast<size_t>(size) * size * size);
+    file.read(reinterpret_cast<char *>(data.data()),
+              data.size() * sizeof(uint16_t));
+    if (!file) return false;
+
+    texels = std::move(data);
+    decode();
+    return true;
+}
+
+void NoiseVolume::Save(const std::string& path) const
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    FileHeader header{{'V', 'V', 'N', 'V'}, fileVersion, size, extent, octaves};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(texels.data()),
+               texels.size() * sizeof(uint16_t));
+}
+
+void NoiseVolume::decode()
+{
+    values.resize(texels.size());
+    for (size_t i = 0; i < texels.size(); ++i) {
+        values[i] = glm::unpackHalf1x16(texels[i]);
+    }
+}
+
+float NoiseVolume::Sample(float u, float v, float w) const
+{
+    // size is a power of two, so repeat addressing is a mask
+    const int mask = static_cast<int>(size) - 1;
+    const float n = static_cast<float>(size);
+    auto axis = [&](float coord, size_t& i0, size_t& i1, float& t) {
+        float texel = coord * n - 0.5f;
+        float base = std::floor(texel);
+        t = texel - base;
+        int i = static_cast<int>(base);
+        i0 = static_cast<size_t>(i & mask);
+        i1 = static_cast<size_t>((i + 1) & mask);
+    };
+
+    size_t x0, x1, y0, y1, z0, z1;
+    float tx, ty, tz;
+    axis(u, x0, x1, tx);
+    axis(v, y0, y1, ty);
+    axis(w, z0, z1, tz);
+    y0 *= size;
+    y1 *= size;
+    z0 *= static_cast<size_t>(size) * size;
+    z1 *= static_cast<size_t>(size) * size;
+
+    const float *data = values.data();
+    auto lerp = [](float a, float b, float t) { return a + (b - a) * t; };
+    float c00 = lerp(data[z0 + y0 + x0], data[z0 + y0 + x1], tx);
+    float c10 = lerp(data[z0 + y1 + x0], data[z0 + y1 + x1], tx);
+    float c01 = lerp(data[z1 + y0 + x0], data[z1 + y0 + x1], tx);
+    float c11 = lerp(data[z1 + y1 + x0], data[z1 + y1 + x1], tx);
+    return lerp(lerp(c00, c10, ty), lerp(c01, c11, ty), tz);
+}
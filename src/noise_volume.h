@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Tileable 3D value noise baked into a R16_SFLOAT volume. Each texel holds
+// three fbm octaves (frequency 1, 2, 4 over a tile of `extent` world units);
+// smoke.comp adds octaves 4-6 with a second fetch at 8x the frequency. Two
+// fetches instead of the 48 hash evaluations of fbm(p, 6) per density
+// sample, but only an approximation: tiling needs a factor of exactly 2
+// between octaves where fbm() uses 2.02 + 0.21 * i, so it is opt-in.
+class NoiseVolume {
+public:
+    static constexpr uint32_t defaultSize = 128;
+    static constexpr uint32_t extent = 8;  // NOISE_VOLUME_EXTENT in utils.glsl
+    static constexpr uint32_t octaves = 3;
+
+    // size must be a power of two
+    explicit NoiseVolume(uint32_t size = defaultSize);
+
+    // Reads the cache file, bakes (and writes the cache) if it is missing
+    // or was written with other parameters
+    void LoadOrBake(const std::string& cachePath, ThreadPool& pool);
+    void Bake(ThreadPool& pool);
+    bool Load(const std::string& path);
+    void Save(const std::string& path) const;
+
+    bool IsEmpty() const { return texels.empty(); }
+    uint32_t GetSize() const { return size; }
+    // Half floats, x fastest, ready for a buffer to image copy
+    const std::vector<uint16_t>& GetTexels() const { return texels; }
+
+    // Trilinear lookup with repeat addressing like the GPU sampler,
+    // coordinates are normalized (one tile = [0, 1))
+    float Sample(float u, float v, float w) const;
+
+private:
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t size;
+        uint32_t extent;
+        uint32_t octaves;
+    };
+    static constexpr uint32_t fileVersion = 1;
+
+    void decode();
+
+    uint32_t size;
+    std::vector<uint16_t> texels;
+    std::vector<float> values;  // decoded texels for CPU lookups
+};
@@ -0,0 +1,99 @@
+#include "particle_store.h"
+
+#include <algorithm>
+
+#include "simd.h"
+
+void ParticleStore::Resize(uint32_t newCount)
+{
+    count = newCount;
+    const size_t padded = (static_cast<size_t>(count) + simd::width - 1) /
+                          simd::width * simd::width;
+    for (auto *array : {&positionX, &positionY, &positionZ, &scale, &velocityX,
+                        &velocityY, &velocityZ, &colorR, &colorG, &colorB,
+                        &colorA}) {
+        array->resize(padded, 0.0f);
+    }
+}
+
+void ParticleStore::Set(uint32_t index, const glm::vec4& position,
+                        const glm::vec3& velocity, const glm::vec4& color)
+{
+    positionX[index] = position.x;
+    positionY[index] = position.y;
+    positionZ[index] = position.z;
+    scale[index] = position.w;
+    velocityX[index] = velocity.x;
+    velocityY[index] = velocity.y;
+    velocityZ[index] = velocity.z;
+    colorR[index] = color.r;
+    colorG[index] = color.g;
+    colorB[index] = color.b;
+    colorA[index] = color.a;
+}
+
+glm::vec4 ParticleStore::GetPosition(uint32_t index) const
+{
+    return glm::vec4(positionX[index], positionY[index], positionZ[index],
+                     scale[index]);
+}
+
+std::vector<Particle> ParticleStore::Pack() const
+{
+    std::vector<Particle> packed(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        packed[i].position = GetPosition(i);
+        packed[i].velocity =
+            glm::vec3(velocityX[i], velocityY[i], velocityZ[i]);
+        packed[i].color = glm::vec4(colorR[i], colorG[i], colorB[i], colorA[i]);
+    }
+    return packed;
+}
+
+uint32_t ParticleIntegrator::Advance(ParticleStore& store, ThreadPool& pool,
+                                     const glm::vec3& wind,
+                                     float elapsedSeconds)
+{
+    accumulator += std::max(elapsedSeconds, 0.0f);
+    auto steps = static_cast<uint32_t>(accumulator / fixedTimeStep);
+    accumulator -= static_cast<float>(steps) * fixedTimeStep;
+    steps = std::min(steps, maxStepsPerFrame);
+
+    Step(store, pool, wind, steps);
+    return steps;
+}
+
+void ParticleIntegrator::Step(ParticleStore& store, ThreadPool& pool,
+                              const glm::vec3& wind, uint32_t steps) const
+{
+    if (steps == 0 || store.IsEmpty()) return;
+
+    const uint32_t padded = static_cast<uint32_t>(store.positionX.size());
+    const uint32_t chunks = (padded + chunkSize - 1) / chunkSize;
+    pool.ParallelFor(chunks, [&](uint32_t chunk, uint32_t) {
+        const simd::Float windX = wind.x * windStep;
+        const simd::Float windY = wind.y * windStep;
+        const simd::Float windZ = wind.z * windStep;
+        const uint32_t begin = chunk * chunkSize;
+        const uint32_t end = std::min(begin + chunkSize, padded);
+
+        for (uint32_t i = begin; i < end; i += simd::width) {
+            simd::Float x = simd::Float::Load(&store.positionX[i]);
+            simd::Float y = simd::Float::Load(&store.positionY[i]);
+            simd::Float z = simd::Float::Load(&store.positionZ[i]);
+            // Wind and velocity do not change between steps, the clamp does
+            // not commute with them though
+            simd::Float dx = windX + simd::Float::Load(&store.velocityX[i]);
+            simd::Float dy = windY + simd::Float::Load(&store.velocityY[i]);
+            simd::Float dz = windZ + simd::Float::Load(&store.velocityZ[i]);
+            for (uint32_t step = 0; step < steps; ++step) {
+                x = simd::Clamp(x + dx, boxMin.x, boxMax.x);
+                y = simd::Clamp(y + dy, boxMin.y, boxMax.y);
+                z = simd::Clamp(z + dz, boxMin.z, boxMax.z);
+            }
+            x.Store(&store.positionX[i]);
+            y.Store(&store.positionY[i]);
+            z.Store(&store.positionZ[i]);
+        }
+    });
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "config.h"
+#include "thread_pool.h"
+
+// Smoke particles as structure of arrays for the CPU side. Every array is
+// padded to a whole SIMD packet (simd::width), so the integrator never needs
+// a scalar tail; the padding lanes are integrated but never packed. The
+// 48 byte GPU Particle layout only exists in Pack(), at upload time.
+class ParticleStore {
+public:
+    void Resize(uint32_t count);
+    uint32_t Size() const { return count; }
+    bool IsEmpty() const { return count == 0; }
+
+    void Set(uint32_t index, const glm::vec4& position,
+             const glm::vec3& velocity, const glm::vec4& color);
+    glm::vec4 GetPosition(uint32_t index) const;
+
+    // GPU layout of every particle, for the storage buffer upload
+    std::vector<Particle> Pack() const;
+
+    // Position (xyz), scale (w), velocity and color, paddedCount floats each
+    std::vector<float> positionX, positionY, positionZ, scale;
+    std::vector<float> velocityX, velocityY, velocityZ;
+    std::vector<float> colorR, colorG, colorB, colorA;
+
+private:
+    uint32_t count = 0;
+};
+
+// Wind advection, velocity step and box clamping of the smoke particles,
+// the CPU counterpart of particles.comp. Steps are taken at a fixed rate
+// whatever the frame time, the leftover time is carried to the next frame.
+class ParticleIntegrator {
+public:
+    // One step moves a particle by windStep * wind + velocity, the original
+    // per-frame motion at 60 fps
+    static constexpr float fixedTimeStep = 1.0f / 60.0f;
+    static constexpr float windStep = 0.09f;
+    // Frames slower than this many steps drop the rest instead of piling up
+    static constexpr uint32_t maxStepsPerFrame = 8;
+    // Particles per thread pool task, a multiple of every packet width
+    static constexpr uint32_t chunkSize = 4096;
+
+    ParticleIntegrator(const glm::vec3& boxMin, const glm::vec3& boxMax)
+        : boxMin{boxMin}, boxMax{boxMax} {};
+
+    // Advances by the steps that fit into the elapsed time plus the carry,
+    // returns the number of steps taken
+    uint32_t Advance(ParticleStore& store, ThreadPool& pool,
+                     const glm::vec3& wind, float elapsedSeconds);
+    void Step(ParticleStore& store, ThreadPool& pool, const glm::vec3& wind,
+              uint32_t steps) const;
+    void Reset() { accumulator = 0.0f; }
+
+private:
+    glm::vec3 boxMin;
+    glm::vec3 boxMax;
+    float accumulator = 0.0f;
+};
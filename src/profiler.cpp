@@ -0,0 +1,204 @@
+#include "profiler.h"
+
+#include <fmt/format.h>
+
+void GpuProfiler::Init(uint32_t framesInFlight)
+{
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(core->physicalDevice,
+                                             &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        core->physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    const auto maskOf = [&](uint32_t family) {
+        uint32_t validBits = queueFamilies[family].timestampValidBits;
+        return validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    };
+    timestampMasks[static_cast<size_t>(Queue::Compute)] =
+        maskOf(core->computeQueueFamily);
+    timestampMasks[static_cast<size_t>(Queue::Graphics)] =
+        maskOf(core->graphicsQueueFamily);
+    if (timestampMasks[static_cast<size_t>(Queue::Compute)] == 0 &&
+        timestampMasks[static_cast<size_t>(Queue::Graphics)] == 0) {
+        std::cout << "[WARN] Timestamp queries not supported, GPU profiler "
+                     "disabled"
+                  << std::endl;
+        return;
+    }
+    if (timestampMasks[static_cast<size_t>(Queue::Graphics)] == 0) {
+        std::cout << "[WARN] No timestamps on the graphics queue, its passes "
+                     "are not profiled"
+                  << std::endl;
+    } else if (timestampMasks[static_cast<size_t>(Queue::Compute)] == 0) {
+        std::cout << "[WARN] No timestamps on the compute queue, its passes "
+                     "are not profiled"
+                  << std::endl;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(core->physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo queryPoolInfo{};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = 2 * maxScopesPerFrame * framesInFlight;
+
+    if (vkCreateQueryPool(core->device, &queryPoolInfo, nullptr,
+                          &queryPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+    // Host side reset (Vulkan 1.2), scopes can then be written from any
+    // command buffer, including inside a render pass
+    vkResetQueryPool(core->device, queryPool, 0, queryPoolInfo.queryCount);
+
+    slots.assign(framesInFlight, FrameSlot{});
+    std::cout << "[INFO] Vulkan GPU profiler created..." << std::endl;
+}
+
+void GpuProfiler::Cleanup()
+{
+    if (queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(core->device, queryPool, nullptr);
+        queryPool = VK_NULL_HANDLE;
+    }
+}
+
+size_t GpuProfiler::findOrAddScope(const std::string& name)
+{
+    auto it = std::find(scopeNames.begin(), scopeNames.end(), name);
+    if (it != scopeNames.end()) return it - scopeNames.begin();
+
+    scopeNames.push_back(name);
+    latest.push_back(0.0f);
+    for (auto& row : history) row.push_back(0.0f);
+    return scopeNames.size() - 1;
+}
+
+void GpuProfiler::BeginScope(VkCommandBuffer commandBuffer,
+                             uint32_t frameIndex, const std::string& name,
+                             Queue queue)
+{
+    if (!IsEnabled() || timestampMasks[static_cast<size_t>(queue)] == 0) {
+        return;
+    }
+
+    FrameSlot& slot = slots[frameIndex];
+    if (slot.usedQueries + 2 > 2 * maxScopesPerFrame) {
+        throw std::runtime_error("too many GPU profiler scopes in a frame!");
+    }
+
+    uint32_t query = 2 * maxScopesPerFrame * frameIndex + slot.usedQueries;
+    slot.usedQueries += 2;
+    slot.scopes.push_back({findOrAddScope(name), query, queue});
+    slot.openQueries.push_back(query);
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        queryPool, query);
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                           Queue queue)
+{
+    if (!IsEnabled() || timestampMasks[static_cast<size_t>(queue)] == 0) {
+        return;
+    }
+
+    FrameSlot& slot = slots[frameIndex];
+    if (slot.openQueries.empty()) {
+        throw std::runtime_error("GPU profiler scope ended without begin!");
+    }
+    uint32_t query = slot.openQueries.back();
+    slot.openQueries.pop_back();
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        queryPool, query + 1);
+}
+
+void GpuProfiler::Collect(uint32_t frameIndex)
+{
+    if (!IsEnabled()) return;
+
+    FrameSlot& slot = slots[frameIndex];
+    if (slot.scopes.empty()) return;
+
+    uint32_t firstQuery = 2 * maxScopesPerFrame * frameIndex;
+    std::vector<uint64_t> timestamps(slot.usedQueries);
+    vkGetQueryPoolResults(core->device, queryPool, firstQuery,
+                          slot.usedQueries,
+                          timestamps.size() * sizeof(uint64_t),
+                          timestamps.data(), sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+    std::fill(latest.begin(), latest.end(), 0.0f);
+    for (const auto& [scope, query, queue] : slot.scopes) {
+        uint32_t local = query - firstQuery;
+        uint64_t ticks = (timestamps[local + 1] - timestamps[local]) &
+                         timestampMasks[static_cast<size_t>(queue)];
+        // Scopes opened several times in a frame are summed
+        latest[scope] += static_cast<float>(static_cast<double>(ticks) *
+                                            timestampPeriod * 1e-6);
+    }
+
+    if (history.size() < historySize) {
+        history.emplace_back(latest);
+        historyFrames.push_back(collectedFrames);
+    } else {
+        history[historyHead] = latest;
+        historyFrames[historyHead] = collectedFrames;
+    }
+    historyHead = (historyHead + 1) % historySize;
+    historyCount = std::min(historyCount + 1, historySize);
+    ++collectedFrames;
+
+    vkResetQueryPool(core->device, queryPool, firstQuery, slot.usedQueries);
+    slot = FrameSlot{};
+}
+
+float GpuProfiler::GetLatest(const std::string& name) const
+{
+    auto it = std::find(scopeNames.begin(), scopeNames.end(), name);
+    if (it == scopeNames.end()) return 0.0f;
+    return latest[it - scopeNames.begin()];
+}
+
+std::vector<float> GpuProfiler::GetHistory(size_t scope) const
+{
+    std::vector<float> values;
+    values.reserve(historyCount);
+    size_t oldest = historyCount < historySize ? 0 : historyHead;
+    for (size_t i = 0; i < historyCount; ++i) {
+        values.push_back(history[(oldest + i) % historySize][scope]);
+    }
+    return values;
+}
+
+float GpuProfiler::GetAverage(size_t scope) const
+{
+    if (historyCount == 0) return 0.0f;
+    float sum = 0.0f;
+    for (size_t i = 0; i < historyCount; ++i) sum += history[i][scope];
+    return sum / static_cast<float>(historyCount);
+}
+
+void GpuProfiler::ExportCsv(const std::string& path) const
+{
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open " + path + "!");
+    }
+
+    file << "frame";
+    for (const auto& name : scopeNames) file << "," << name;
+    file << "\n";
+
+    size_t oldest = historyCount < historySize ? 0 : historyHead;
+    for (size_t i = 0; i < historyCount; ++i) {
+        size_t row = (oldest + i) % historySize;
+        file << historyFrames[row];
+        for (float value : history[row]) file << fmt::format(",{:.6f}", value);
+        file << "\n";
+    }
+    fmt::print("[INFO] GPU profile written to {}\n", path);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "core.h"
+
+// Timestamp query based GPU timings for named scopes (passes) per frame.
+// Scopes may be opened in any command buffer of a frame slot, results are
+// collected once every fence of that slot has signaled. The compute and
+// graphics families may differ in timestamp support; scopes on a family
+// without it are skipped.
+class GpuProfiler {
+public:
+    static constexpr uint32_t maxScopesPerFrame = 32;
+    static constexpr size_t historySize = 256;
+
+    // Family of the command buffer a scope is written to
+    enum class Queue { Compute, Graphics };
+
+    explicit GpuProfiler(Core *core) : core{core} {};
+    void Init(uint32_t framesInFlight);
+    void Cleanup();
+    bool IsEnabled() const { return queryPool != VK_NULL_HANDLE; }
+
+    void BeginScope(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                    const std::string& name, Queue queue = Queue::Compute);
+    void EndScope(VkCommandBuffer commandBuffer, uint32_t frameIndex,
+                  Queue queue = Queue::Compute);
+    void Collect(uint32_t frameIndex);
+
+    const std::vector<std::string>& GetScopeNames() const
+    {
+        return scopeNames;
+    }
+    // Time in ms of the most recently collected frame, 0 if not recorded
+    float GetLatest(const std::string& name) const;
+    float GetAverage(size_t scope) const;
+    // Oldest to newest timings of one scope, missing frames are 0
+    std::vector<float> GetHistory(size_t scope) const;
+    void ExportCsv(const std::string& path) const;
+
+private:
+    struct Scope {
+        size_t scope;
+        uint32_t query;
+        Queue queue;
+    };
+    struct FrameSlot {
+        std::vector<Scope> scopes;
+        std::vector<uint32_t> openQueries;
+        uint32_t usedQueries = 0;
+    };
+
+    size_t findOrAddScope(const std::string& name);
+
+    Core *core;
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 1.0f;
+    // Valid timestamp bits per Queue, 0 when the family has no timestamps
+    std::array<uint64_t, 2> timestampMasks{};
+
+    std::vector<FrameSlot> slots;
+    std::vector<std::string> scopeNames;
+
+    // Rolling history, one row per collected frame indexed by scope
+    std::vector<std::vector<float>> history;
+    std::vector<uint64_t> historyFrames;
+    size_t historyHead = 0;
+    size_t historyCount = 0;
+    uint64_t collectedFrames = 0;
+    std::vector<float> latest;
+};
@@ -0,0 +1,504 @@
+#pragma once
+
+// Thin SIMD layer for the CPU ray marchers. One Float holds a packet of
+// rays: 16 lanes with AVX-512, 8 with AVX2/FMA and 8 plain floats as a
+// portable fallback (same results, roughly an order of magnitude slower
+// than AVX2 on x86).
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define VVR_SIMD_AVX512 1
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#include <immintrin.h>
+#define VVR_SIMD_AVX2 1
+#endif
+
+namespace simd {
+
+#if defined(VVR_SIMD_AVX512)
+//----------------------------------------------------------------
+// AVX-512
+//----------------------------------------------------------------
+constexpr int width = 16;
+constexpr const char *name = "AVX-512";
+
+struct Mask {
+    __mmask16 m;
+};
+
+struct Float {
+    __m512 v;
+    Float() = default;
+    Float(float s) : v{_mm512_set1_ps(s)} {}
+    explicit Float(__m512 v) : v{v} {}
+    static Float Load(const float *p) { return Float{_mm512_loadu_ps(p)}; }
+    void Store(float *p) const { _mm512_storeu_ps(p, v); }
+    // Lane i = base + i
+    static Float Ramp(float base)
+    {
+        return Float{_mm512_add_ps(
+            _mm512_set1_ps(base),
+            _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                           15))};
+    }
+};
+
+inline Float operator+(Float a, Float b) { return Float{_mm512_add_ps(a.v, b.v)}; }
+inline Float operator-(Float a, Float b) { return Float{_mm512_sub_ps(a.v, b.v)}; }
+inline Float operator*(Float a, Float b) { return Float{_mm512_mul_ps(a.v, b.v)}; }
+inline Float operator/(Float a, Float b) { return Float{_mm512_div_ps(a.v, b.v)}; }
+inline Float operator-(Float a) { return Float{_mm512_sub_ps(_mm512_setzero_ps(), a.v)}; }
+inline Float MulAdd(Float a, Float b, Float c) { return Float{_mm512_fmadd_ps(a.v, b.v, c.v)}; }
+inline Float Min(Float a, Float b) { return Float{_mm512_min_ps(a.v, b.v)}; }
+inline Float Max(Float a, Float b) { return Float{_mm512_max_ps(a.v, b.v)}; }
+inline Float Sqrt(Float a) { return Float{_mm512_sqrt_ps(a.v)}; }
+inline Float Abs(Float a) { return Float{_mm512_abs_ps(a.v)}; }
+inline Float Floor(Float a)
+{
+    return Float{_mm512_mask_roundscale_ps(a.v, 0xFFFF, a.v,
+                                           _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)};
+}
+
+inline Mask operator<(Float a, Float b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)}; }
+inline Mask operator<=(Float a, Float b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)}; }
+inline Mask operator>(Float a, Float b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)}; }
+inline Mask operator>=(Float a, Float b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)}; }
+inline Mask operator==(Float a, Float b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ)}; }
+
+inline Mask operator&(Mask a, Mask b) { return {static_cast<__mmask16>(a.m & b.m)}; }
+inline Mask operator|(Mask a, Mask b) { return {static_cast<__mmask16>(a.m | b.m)}; }
+inline Mask operator!(Mask a) { return {static_cast<__mmask16>(~a.m)}; }
+inline bool Any(Mask a) { return a.m != 0; }
+inline bool All(Mask a) { return a.m == 0xFFFF; }
+inline Mask AllTrue() { return {0xFFFF}; }
+inline Mask AllFalse() { return {0}; }
+
+// a where mask is set, b elsewhere
+inline Float Select(Mask m, Float a, Float b) { return Float{_mm512_mask_blend_ps(m.m, b.v, a.v)}; }
+
+// 2^n for integer valued n
+inline Float Pow2i(Float n)
+{
+    __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n.v), _mm512_set1_epi32(127));
+    return Float{_mm512_castsi512_ps(_mm512_slli_epi32(e, 23))};
+}
+
+// Splits positive x into mantissa in [0.5, 1) and exponent
+inline Float Frexp(Float x, Float& exponent)
+{
+    __m512i bits = _mm512_castps_si512(x.v);
+    __m512i e = _mm512_sub_epi32(
+        _mm512_and_si512(_mm512_srli_epi32(bits, 23), _mm512_set1_epi32(0xff)),
+        _mm512_set1_epi32(126));
+    exponent = Float{_mm512_cvtepi32_ps(e)};
+    __m512i m = _mm512_or_si512(
+        _mm512_and_si512(bits, _mm512_set1_epi32(0x807fffff)),
+        _mm512_set1_epi32(0x3f000000));
+    return Float{_mm512_castsi512_ps(m)};
+}
+
+#elif defined(VVR_SIMD_AVX2)
+//----------------------------------------------------------------
+// AVX2 + FMA
+//----------------------------------------------------------------
+constexpr int width = 8;
+constexpr const char *name = "AVX2";
+
+struct Mask {
+    __m256 m;
+};
+
+struct Float {
+    __m256 v;
+    Float() = default;
+    Float(float s) : v{_mm256_set1_ps(s)} {}
+    explicit Float(__m256 v) : v{v} {}
+    static Float Load(const float *p) { return Float{_mm256_loadu_ps(p)}; }
+    void Store(float *p) const { _mm256_storeu_ps(p, v); }
+    static Float Ramp(float base)
+    {
+        return Float{_mm256_add_ps(_mm256_set1_ps(base),
+                                   _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7))};
+    }
+};
+
+inline Float operator+(Float a, Float b) { return Float{_mm256_add_ps(a.v, b.v)}; }
+inline Float operator-(Float a, Float b) { return Float{_mm256_sub_ps(a.v, b.v)}; }
+inline Float operator*(Float a, Float b) { return Float{_mm256_mul_ps(a.v, b.v)}; }
+inline Float operator/(Float a, Float b) { return Float{_mm256_div_ps(a.v, b.v)}; }
+inline Float operator-(Float a) { return Float{_mm256_sub_ps(_mm256_setzero_ps(), a.v)}; }
+inline Float MulAdd(Float a, Float b, Float c) { return Float{_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+inline Float Min(Float a, Float b) { return Float{_mm256_min_ps(a.v, b.v)}; }
+inline Float Max(Float a, Float b) { return Float{_mm256_max_ps(a.v, b.v)}; }
+inline Float Sqrt(Float a) { return Float{_mm256_sqrt_ps(a.v)}; }
+inline Float Abs(Float a)
+{
+    return Float{_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+}
+inline Float Floor(Float a) { return Float{_mm256_floor_ps(a.v)}; }
+
+inline Mask operator<(Float a, Float b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline Mask operator<=(Float a, Float b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline Mask operator>(Float a, Float b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline Mask operator>=(Float a, Float b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline Mask operator==(Float a, Float b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ)}; }
+
+inline Mask operator&(Mask a, Mask b) { return {_mm256_and_ps(a.m, b.m)}; }
+inline Mask operator|(Mask a, Mask b) { return {_mm256_or_ps(a.m, b.m)}; }
+inline Mask operator!(Mask a)
+{
+    return {_mm256_xor_ps(a.m, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))};
+}
+inline bool Any(Mask a) { return _mm256_movemask_ps(a.m) != 0; }
+inline bool All(Mask a) { return _mm256_movemask_ps(a.m) == 0xFF; }
+inline Mask AllTrue() { return {_mm256_castsi256_ps(_mm256_set1_epi32(-1))}; }
+inline Mask AllFalse() { return {_mm256_setzero_ps()}; }
+
+inline Float Select(Mask m, Float a, Float b) { return Float{_mm256_blendv_ps(b.v, a.v, m.m)}; }
+
+inline Float Pow2i(Float n)
+{
+    __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+    return Float{_mm256_castsi256_ps(_mm256_slli_epi32(e, 23))};
+}
+
+inline Float Frexp(Float x, Float& exponent)
+{
+    __m256i bits = _mm256_castps_si256(x.v);
+    __m256i e = _mm256_sub_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)),
+        _mm256_set1_epi32(126));
+    exponent = Float{_mm256_cvtepi32_ps(e)};
+    __m256i m = _mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(0x807fffff)),
+        _mm256_set1_epi32(0x3f000000));
+    return Float{_mm256_castsi256_ps(m)};
+}
+
+#else
+//----------------------------------------------------------------
+// Portable fallback
+//----------------------------------------------------------------
+constexpr int width = 8;
+constexpr const char *name = "scalar";
+
+// One full-width lane per element so loops below auto-vectorize
+struct Mask {
+    int32_t m[width];
+};
+
+struct Float {
+    float v[width];
+    Float() = default;
+    Float(float s)
+    {
+        for (int i = 0; i < width; ++i) v[i] = s;
+    }
+    static Float Load(const float *p)
+    {
+        Float r;
+        std::memcpy(r.v, p, sizeof(r.v));
+        return r;
+    }
+    void Store(float *p) const { std::memcpy(p, v, sizeof(v)); }
+    static Float Ramp(float base)
+    {
+        Float r;
+        for (int i = 0; i < width; ++i) r.v[i] = base + static_cast<float>(i);
+        return r;
+    }
+};
+
+#define VVR_SIMD_BINARY(OP, EXPR)                \
+    inline Float OP(Float a, Float b)            \
+    {                                            \
+        Float r;                                 \
+        for (int i = 0; i < width; ++i) {        \
+            float x = a.v[i], y = b.v[i];        \
+            r.v[i] = EXPR;                       \
+        }                                        \
+        return r;                                \
+    }
+VVR_SIMD_BINARY(operator+, x + y)
+VVR_SIMD_BINARY(operator-, x - y)
+VVR_SIMD_BINARY(operator*, x * y)
+VVR_SIMD_BINARY(operator/, x / y)
+VVR_SIMD_BINARY(Min, y < x ? y : x)
+VVR_SIMD_BINARY(Max, x < y ? y : x)
+#undef VVR_SIMD_BINARY
+
+#define VVR_SIMD_UNARY(OP, EXPR)          \
+    inline Float OP(Float a)              \
+    {                                     \
+        Float r;                          \
+        for (int i = 0; i < width; ++i) { \
+            float x = a.v[i];             \
+            r.v[i] = EXPR;                \
+        }                                 \
+        return r;                         \
+    }
+VVR_SIMD_UNARY(operator-, -x)
+VVR_SIMD_UNARY(Sqrt, std::sqrt(x))
+VVR_SIMD_UNARY(Abs, std::fabs(x))
+#undef VVR_SIMD_UNARY
+
+inline Float MulAdd(Float a, Float b, Float c) { return a * b + c; }
+
+// Truncation based so it vectorizes without SSE4.1, floats beyond 2^23
+// are already integral
+inline Float Floor(Float a)
+{
+    Float r;
+    for (int i = 0; i < width; ++i) {
+        float x = a.v[i];
+        float t = std::fabs(x) < 8388608.0f
+                      ? static_cast<float>(static_cast<int32_t>(x))
+                      : x;
+        r.v[i] = t > x ? t - 1.0f : t;
+    }
+    return r;
+}
+
+#define VVR_SIMD_COMPARE(OP)                              \
+    inline Mask operator OP(Float a, Float b)             \
+    {                                                     \
+        Mask r;                                           \
+        for (int i = 0; i < width; ++i) {                 \
+            r.m[i] = a.v[i] OP b.v[i] ? -1 : 0;           \
+        }                                                 \
+        return r;                                         \
+    }
+VVR_SIMD_COMPARE(<)
+VVR_SIMD_COMPARE(<=)
+VVR_SIMD_COMPARE(>)
+VVR_SIMD_COMPARE(>=)
+VVR_SIMD_COMPARE(==)
+#undef VVR_SIMD_COMPARE
+
+#define VVR_SIMD_MASK_BINARY(OP, EXPR)                    \
+    inline Mask OP(Mask a, Mask b)                        \
+    {                                                     \
+        Mask r;                                           \
+        for (int i = 0; i < width; ++i) {                 \
+            int32_t x = a.m[i], y = b.m[i];               \
+            r.m[i] = EXPR;                                \
+        }                                                 \
+        return r;                                         \
+    }
+VVR_SIMD_MASK_BINARY(operator&, x & y)
+VVR_SIMD_MASK_BINARY(operator|, x | y)
+#undef VVR_SIMD_MASK_BINARY
+
+inline Mask operator!(Mask a)
+{
+    Mask r;
+    for (int i = 0; i < width; ++i) r.m[i] = ~a.m[i];
+    return r;
+}
+inline bool Any(Mask a)
+{
+    int32_t any = 0;
+    for (int i = 0; i < width; ++i) any |= a.m[i];
+    return any != 0;
+}
+inline bool All(Mask a)
+{
+    int32_t all = -1;
+    for (int i = 0; i < width; ++i) all &= a.m[i];
+    return all != 0;
+}
+inline Mask AllTrue()
+{
+    Mask r;
+    for (int i = 0; i < width; ++i) r.m[i] = -1;
+    return r;
+}
+inline Mask AllFalse()
+{
+    Mask r;
+    for (int i = 0; i < width; ++i) r.m[i] = 0;
+    return r;
+}
+
+inline Float Select(Mask m, Float a, Float b)
+{
+    Float r;
+    for (int i = 0; i < width; ++i) r.v[i] = m.m[i] ? a.v[i] : b.v[i];
+    return r;
+}
+
+inline Float Pow2i(Float n)
+{
+    Float r;
+    for (int i = 0; i < width; ++i) {
+        uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(n.v[i]) + 127)
+                        << 23;
+        std::memcpy(&r.v[i], &bits, sizeof(float));
+    }
+    return r;
+}
+
+inline Float Frexp(Float x, Float& exponent)
+{
+    Float r;
+    for (int i = 0; i < width; ++i) {
+        uint32_t bits;
+        std::memcpy(&bits, &x.v[i], sizeof(float));
+        exponent.v[i] = static_cast<float>(
+            static_cast<int32_t>((bits >> 23) & 0xff) - 126);
+        bits = (bits & 0x807fffffu) | 0x3f000000u;
+        std::memcpy(&r.v[i], &bits, sizeof(float));
+    }
+    return r;
+}
+#endif
+
+//----------------------------------------------------------------
+// ISA independent math, mirrors the GLSL built-ins we need
+//----------------------------------------------------------------
+inline Mask AndNot(Mask a, Mask b) { return a & !b; }
+inline Mask Xor(Mask a, Mask b) { return AndNot(a, b) | AndNot(b, a); }
+inline Float Fract(Float x) { return x - Floor(x); }
+inline Float Clamp(Float x, Float lo, Float hi) { return Min(Max(x, lo), hi); }
+inline Float Mix(Float a, Float b, Float t) { return MulAdd(b - a, t, a); }
+inline Float SmoothStep(Float e0, Float e1, Float x)
+{
+    Float t = Clamp((x - e0) / (e1 - e0), 0.0f, 1.0f);
+    return t * t * (Float(3.0f) - Float(2.0f) * t);
+}
+
+// Cephes style expf, relative error ~1e-7 over the clamped range
+inline Float Exp(Float x)
+{
+    x = Clamp(x, -87.3f, 88.3f);
+    Float n = Floor(MulAdd(x, 1.44269504088896341f, 0.5f));
+    Float r = x - n * 0.693359375f;
+    r = r + n * 2.12194440e-4f;
+    Float p = 1.9875691500e-4f;
+    p = MulAdd(p, r, 1.3981999507e-3f);
+    p = MulAdd(p, r, 8.3334519073e-3f);
+    p = MulAdd(p, r, 4.1665795894e-2f);
+    p = MulAdd(p, r, 1.6666665459e-1f);
+    p = MulAdd(p, r, 5.0000001201e-1f);
+    p = MulAdd(p * r, r, r) + 1.0f;
+    return p * Pow2i(n);
+}
+
+// Natural logarithm for x > 0
+inline Float Log(Float x)
+{
+    Float e;
+    Float m = Frexp(x, e);
+    Mask small = m < 0.707106781186547524f;
+    e = Select(small, e - 1.0f, e);
+    m = Select(small, m + m, m) - 1.0f;
+
+    Float z = m * m;
+    Float p = 7.0376836292e-2f;
+    p = MulAdd(p, m, -1.1514610310e-1f);
+    p = MulAdd(p, m, 1.1676998740e-1f);
+    p = MulAdd(p, m, -1.2420140846e-1f);
+    p = MulAdd(p, m, 1.4249322787e-1f);
+    p = MulAdd(p, m, -1.6668057665e-1f);
+    p = MulAdd(p, m, 2.0000714765e-1f);
+    p = MulAdd(p, m, -2.4999993993e-1f);
+    p = MulAdd(p, m, 3.3333331174e-1f);
+    Float y = p * m * z;
+    y = MulAdd(e, -2.12194440e-4f, y);
+    y = y - z * 0.5f;
+    return MulAdd(e, 0.693359375f, m + y);
+}
+
+// GLSL pow: undefined for x < 0, 0 for x == 0
+inline Float Pow(Float x, Float y)
+{
+    Mask zero = x <= 0.0f;
+    Float r = Exp(y * Log(Max(x, 1e-30f)));
+    return Select(zero, 0.0f, r);
+}
+
+// Cephes sinf/cosf with three part pi/4 reduction, fine for |x| < ~8e3
+inline void SinCos(Float x, Float& s, Float& c)
+{
+    Mask negative = x < 0.0f;
+    x = Abs(x);
+    Float j = Floor(x * 1.27323954473516f);
+    // Make the octant index even
+    j = j + (j - Floor(j * 0.5f) * 2.0f);
+    Float q = j - Floor(j * 0.125f) * 8.0f;
+
+    Float z = x - j * 0.78515625f;
+    z = z - j * 2.4187564849853515625e-4f;
+    z = z - j * 3.77489497744594108e-8f;
+    Float zz = z * z;
+
+    Float ps = -1.9515295891e-4f;
+    ps = MulAdd(ps, zz, 8.3321608736e-3f);
+    ps = MulAdd(ps, zz, -1.6666654611e-1f);
+    ps = MulAdd(ps * zz, z, z);
+
+    Float pc = 2.443315711809948e-5f;
+    pc = MulAdd(pc, zz, -1.388731625493765e-3f);
+    pc = MulAdd(pc, zz, 4.166664568298827e-2f);
+    pc = MulAdd(pc * zz, zz, Float(1.0f) - zz * 0.5f);
+
+    Mask flipSin = q >= 4.0f;
+    Mask swap = (q == 2.0f) | (q == 6.0f);
+    Mask flipCos = (q == 2.0f) | (q == 4.0f);
+
+    Float sinValue = Select(swap, pc, ps);
+    Float cosValue = Select(swap, ps, pc);
+    sinValue = Select(Xor(flipSin, negative), -sinValue, sinValue);
+    cosValue = Select(flipCos, -cosValue, cosValue);
+    s = sinValue;
+    c = cosValue;
+}
+
+inline Float Sin(Float x)
+{
+    Float s, c;
+    SinCos(x, s, c);
+    return s;
+}
+
+inline Float Cos(Float x)
+{
+    Float s, c;
+    SinCos(x, s, c);
+    return c;
+}
+
+//----------------------------------------------------------------
+// 3 component vectors of packets
+//----------------------------------------------------------------
+struct Vec3 {
+    Float x, y, z;
+    Vec3() = default;
+    Vec3(Float x, Float y, Float z) : x{x}, y{y}, z{z} {}
+    explicit Vec3(float s) : x{s}, y{s}, z{s} {}
+};
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(const Vec3& a, const Vec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator*(const Vec3& a, const Vec3& b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline Vec3 operator*(const Vec3& a, Float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator-(const Vec3& a) { return {-a.x, -a.y, -a.z}; }
+inline Float Dot(const Vec3& a, const Vec3& b) { return MulAdd(a.x, b.x, MulAdd(a.y, b.y, a.z * b.z)); }
+inline Float Length(const Vec3& a) { return Sqrt(Dot(a, a)); }
+inline Vec3 Normalize(const Vec3& a) { return a * (Float(1.0f) / Length(a)); }
+inline Vec3 Floor(const Vec3& a) { return {Floor(a.x), Floor(a.y), Floor(a.z)}; }
+inline Vec3 Abs(const Vec3& a) { return {Abs(a.x), Abs(a.y), Abs(a.z)}; }
+inline Vec3 Select(Mask m, const Vec3& a, const Vec3& b)
+{
+    return {Select(m, a.x, b.x), Select(m, a.y, b.y), Select(m, a.z, b.z)};
+}
+inline Vec3 Mix(const Vec3& a, const Vec3& b, Float t)
+{
+    return {Mix(a.x, b.x, t), Mix(a.y, b.y, t), Mix(a.z, b.z, t)};
+}
+
+}  // namespace simd
@@ -16,55 +16,78 @@ Texture::Texture(Core *core, std::string imagePath, VkFormat format)
         throw std::runtime_error("Failed to load texture image!");
     }
 
-    Buffer stagingBuffer{core, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
-    bufferContainer.push_back(stagingBuffer);
-
-    void *data;
-    vkMapMemory(core->device, stagingBuffer.GetDeviceMemory(), 0, imageSize, 0,
-                &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(core->device, stagingBuffer.GetDeviceMemory());
-    stbi_image_free(pixels);
-
     CreateImage(texWidth, texHeight, format, VK_IMAGE_TILING_OPTIMAL,
                 VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, textureImageMemory);
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation);
 
-    // command buffer: copy buffer to the image
-    TransitionImageLayout(image, VK_FORMAT_R8G8B8A8_UNORM,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    CopyBufferToImage(stagingBuffer.GetBuffer(), image,
-                      static_cast<uint32_t>(texWidth),
-                      static_cast<uint32_t>(texHeight));
-    TransitionImageLayout(image, VK_FORMAT_R8G8B8A8_UNORM,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // pixels are staged right away, the copy runs with the next flush
+    core->uploader.UploadImage(image,
+                               {static_cast<uint32_t>(texWidth),
+                                static_cast<uint32_t>(texHeight), 1},
+                               pixels, imageSize);
+    stbi_image_free(pixels);
 }
 
-Texture::Texture(Core *core, uint32_t width, uint32_t height, VkFormat format)
+Texture::Texture(Core *core, uint32_t width, uint32_t height, VkFormat format,
+                 bool sharedWithGraphics)
     : core{core}, format{format}
 {
     // storage image
     CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
-                    VK_IMAGE_USAGE_STORAGE_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, textureImageMemory);
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation, 1,
+                sharedWithGraphics);
+}
+
+Texture::Texture(Core *core, uint32_t width, uint32_t height, uint32_t depth,
+                 VkFormat format)
+    : core{core}, format{format}, viewType{VK_IMAGE_VIEW_TYPE_3D}
+{
+    CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation,
+                depth);
+}
+
+Texture::Texture(Core *core, uint32_t width, uint32_t height, uint32_t depth,
+                 VkFormat format, const void *texels, VkDeviceSize size)
+    : core{core}, format{format}, viewType{VK_IMAGE_VIEW_TYPE_3D}
+{
+    CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation,
+                depth);
+
+    core->uploader.UploadImage(image, {width, height, depth}, texels, size);
+}
+
+Texture::Texture(Core *core, uint32_t width, uint32_t height, uint32_t depth,
+                 VkFormat format, VkBuffer staging, VkDeviceSize stagingOffset)
+    : core{core}, format{format}, viewType{VK_IMAGE_VIEW_TYPE_3D}
+{
+    CreateImage(width, height, format, VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation,
+                depth);
+
+    core->uploader.CopyImage(staging, stagingOffset, image,
+                             {width, height, depth});
 }
 
 void Texture::CreateImage(uint32_t width, uint32_t height, VkFormat format,
                           VkImageTiling tiling, VkImageUsageFlags usage,
                           VkMemoryPropertyFlags properties, VkImage& image,
-                          VkDeviceMemory& imageMemory)
+                          Allocation& imageAllocation, uint32_t depth,
+                          bool sharedWithGraphics)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.imageType = depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
-    imageInfo.extent.depth = 1;
+    imageInfo.extent.depth = depth;
     imageInfo.mipLevels = 1;
     imageInfo.arrayLayers = 1;
     imageInfo.format = format;
@@ -72,30 +95,23 @@ void Texture::CreateImage(uint32_t width, uint32_t height, VkFormat format,
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     imageInfo.usage = usage;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.sharingMode =
-        VK_SHARING_MODE_EXCLUSIVE;  // we don't use another queue family for the
-                                    // compute shader
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // Written on the compute queue and sampled on the graphics queue every
+    // frame, concurrent sharing instead of two ownership transfers per frame
+    uint32_t queueFamilies[] = {core->computeQueueFamily,
+                                core->graphicsQueueFamily};
+    if (sharedWithGraphics && queueFamilies[0] != queueFamilies[1]) {
+        imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageInfo.queueFamilyIndexCount = 2;
+        imageInfo.pQueueFamilyIndices = queueFamilies;
+    }
 
     if (vkCreateImage(core->device, &imageInfo, nullptr, &image) !=
         VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(core->device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex =
-        core->findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(core->device, &allocInfo, nullptr, &imageMemory) !=
-        VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(core->device, image, imageMemory, 0);
+    imageAllocation = core->allocator.AllocateImage(image, properties);
 }
 
 Texture& Texture::CreateImageView()
@@ -103,7 +119,7 @@ Texture& Texture::CreateImageView()
     VkImageViewCreateInfo imageViewInfo{};
     imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     imageViewInfo.image = image;
-    imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewInfo.viewType = viewType;
     imageViewInfo.format = format;
     imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     imageViewInfo.subresourceRange.baseMipLevel = 0;
@@ -129,7 +145,7 @@ Texture& Texture::CreateImageSampler()
     samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
     samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
     samplerInfo.mipLodBias = 0.0f;
@@ -153,7 +169,8 @@ void Texture::TransitionImageLayout(VkImage image, VkFormat format,
                                     VkImageLayout oldLayout,
                                     VkImageLayout newLayout)
 {
-    auto commandBuffer = core->beginSingleTimeCommands();
+    // recorded into the pending upload batch, ordered after earlier uploads
+    auto commandBuffer = core->uploader.GetCommandBuffer();
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
     barrier.oldLayout = oldLayout;
@@ -218,42 +235,14 @@ void Texture::TransitionImageLayout(VkImage image, VkFormat format,
 
     vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0,
                          nullptr, 0, nullptr, 1, &barrier);
-    core->endSingleTimeCommands(commandBuffer);
-}
-
-void Texture::CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width,
-                                uint32_t height)
-{
-    auto commandBuffer = core->beginSingleTimeCommands();
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
-
-    vkCmdCopyBufferToImage(commandBuffer, buffer, image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    core->endSingleTimeCommands(commandBuffer);
 }
 
 void Texture::Cleanup()
 {
-    if (image != VK_NULL_HANDLE) vkDestroyImage(core->device, image, nullptr);
-    if (textureImageMemory != VK_NULL_HANDLE)
-        vkFreeMemory(core->device, textureImageMemory, nullptr);
     if (imageView != VK_NULL_HANDLE)
         vkDestroyImageView(core->device, imageView, nullptr);
     if (sampler != VK_NULL_HANDLE)
         vkDestroySampler(core->device, sampler, nullptr);
-    for (auto& buffer : bufferContainer) {
-        buffer.Cleanup();
-    }
+    if (image != VK_NULL_HANDLE) vkDestroyImage(core->device, image, nullptr);
+    if (allocation.memory != VK_NULL_HANDLE) core->allocator.Free(allocation);
 }
@@ -4,25 +4,37 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-#include "buffer.h"
 #include "core.h"
 
 class Texture {
 public:
     Texture(Core* core, std::string imagePath, VkFormat format);
-    Texture(Core* core, uint32_t width, uint32_t height, VkFormat format);
+    // storage image, sharedWithGraphics when the graphics queue samples it
+    Texture(Core* core, uint32_t width, uint32_t height, VkFormat format,
+            bool sharedWithGraphics = false);
+    // 3D storage image, written by compute and sampled
+    Texture(Core* core, uint32_t width, uint32_t height, uint32_t depth,
+            VkFormat format);
+    // sampled 3D texture uploaded from tightly packed texels
+    Texture(Core* core, uint32_t width, uint32_t height, uint32_t depth,
+            VkFormat format, const void* texels, VkDeviceSize size);
+    // sampled 3D texture copied from a staging buffer the caller keeps until
+    // the upload completes
+    Texture(Core* core, uint32_t width, uint32_t height, uint32_t depth,
+            VkFormat format, VkBuffer staging, VkDeviceSize stagingOffset);
     Texture(){};
 
     Texture& operator=(const Texture& other)
     {
         this->core = other.core;
         this->image = other.image;
-        this->textureImageMemory = other.textureImageMemory;
+        this->allocation = other.allocation;
         this->imageView = other.imageView;
         this->sampler = other.sampler;
         this->format = other.format;
-        this->bufferContainer = other.bufferContainer;
+        this->viewType = other.viewType;
         return *this;
     }
 
@@ -36,18 +48,17 @@ public:
     void CreateImage(uint32_t width, uint32_t height, VkFormat format,
                      VkImageTiling tiling, VkImageUsageFlags usage,
                      VkMemoryPropertyFlags properties, VkImage& image,
-                     VkDeviceMemory& imageMemory);
+                     Allocation& imageAllocation, uint32_t depth = 1,
+                     bool sharedWithGraphics = false);
     void TransitionImageLayout(VkImage image, VkFormat format,
                                VkImageLayout oldLayout,
                                VkImageLayout newLayout);
 private:
     Core* core = nullptr;
     VkImage image = VK_NULL_HANDLE;
-    VkDeviceMemory textureImageMemory = VK_NULL_HANDLE;
+    Allocation allocation;
     VkImageView imageView = VK_NULL_HANDLE;
     VkSampler sampler = VK_NULL_HANDLE;
     VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-    std::vector<Buffer> bufferContainer;
-
-    void CopyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    VkImageViewType viewType = VK_IMAGE_VIEW_TYPE_2D;
 };
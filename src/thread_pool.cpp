@@ -0,0 +1,115 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    workerCount = threadCount != 0 ? threadCount
+                                   : std::max(1u, std::thread::hardware_concurrency());
+    for (uint32_t i = 0; i < workerCount; ++i) {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (uint32_t i = 1; i < workerCount; ++i) {
+        threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (auto& thread : threads) thread.join();
+}
+
+void ThreadPool::ParallelFor(
+    uint32_t count, const std::function<void(uint32_t, uint32_t)>& function)
+{
+    if (count == 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &function;
+        error = nullptr;
+        remaining.store(count, std::memory_order_relaxed);
+        // Contiguous blocks per worker
+        for (uint32_t w = 0; w < workerCount; ++w) {
+            uint32_t begin = static_cast<uint64_t>(count) * w / workerCount;
+            uint32_t end = static_cast<uint64_t>(count) * (w + 1) / workerCount;
+            std::lock_guard<std::mutex> queueLock(queues[w]->mutex);
+            for (uint32_t i = begin; i < end; ++i) {
+                queues[w]->items.push_back(i);
+            }
+        }
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] {
+        return remaining.load(std::memory_order_acquire) == 0;
+    });
+    task = nullptr;
+    if (error) std::rethrow_exception(error);
+}
+
+void ThreadPool::workerLoop(uint32_t worker)
+{
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] {
+                return stopping || generation != seenGeneration;
+            });
+            if (stopping) return;
+            seenGeneration = generation;
+        }
+        runTasks(worker);
+    }
+}
+
+void ThreadPool::runTasks(uint32_t worker)
+{
+    uint32_t item;
+    while (popLocal(worker, item) || steal(worker, item)) {
+        try {
+            (*task)(item, worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCondition.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::popLocal(uint32_t worker, uint32_t& item)
+{
+    WorkQueue& queue = *queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.items.empty()) return false;
+    item = queue.items.front();
+    queue.items.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(uint32_t worker, uint32_t& item)
+{
+    for (uint32_t offset = 1; offset < workerCount; ++offset) {
+        WorkQueue& victim = *queues[(worker + offset) % workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.items.empty()) continue;
+        // Take from the far end, away from where the owner is working
+        item = victim.items.back();
+        victim.items.pop_back();
+        return true;
+    }
+    return false;
+}
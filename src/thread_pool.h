@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running index ranges (tiles) with work
+// stealing. Each worker starts on a contiguous block of tiles, so
+// neighbouring tiles share caches, and steals from the back of other
+// workers' queues once its own block is done. The calling thread takes
+// part as worker 0.
+class ThreadPool {
+public:
+    // 0 -> one worker per hardware thread
+    explicit ThreadPool(uint32_t threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    uint32_t GetWorkerCount() const { return workerCount; }
+
+    // Calls task(index, worker) for every index in [0, count) and blocks
+    // until all of them ran. The first exception thrown by a task is
+    // rethrown here.
+    void ParallelFor(uint32_t count,
+                     const std::function<void(uint32_t, uint32_t)>& task);
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<uint32_t> items;
+    };
+
+    void workerLoop(uint32_t worker);
+    void runTasks(uint32_t worker);
+    bool popLocal(uint32_t worker, uint32_t& item);
+    bool steal(uint32_t worker, uint32_t& item);
+
+    uint32_t workerCount;
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    const std::function<void(uint32_t, uint32_t)> *task = nullptr;
+    std::atomic<uint32_t> remaining{0};
+    std::exception_ptr error;
+};
@@ -43,7 +43,7 @@ void UserInterface::Init(uint32_t imageCount, VkRenderPass& renderPass)
     init_info.PhysicalDevice = core->physicalDevice;
     init_info.Device = core->device;
     init_info.Queue = core->graphicsQueue;
-    init_info.PipelineCache = VK_NULL_HANDLE;
+    init_info.PipelineCache = core->pipelineCache;
     init_info.DescriptorPool = imguiPool;
     init_info.Subpass = 0;
     init_info.MinImageCount = 2;
@@ -85,6 +85,35 @@ void UserInterface::Render()
     if (core->CurrentPipeline == 0)
         ImGui::Checkbox("Particle/Terrain based fluid simulation",
                         &particleBasedFluid);
+    if (core->CurrentPipeline == 1) {
+        ImGui::Checkbox("Baked noise volume", &useNoiseVolume);
+        ImGui::Checkbox("Baked light volume", &useLightVolume);
+        if (brickVolumeLoaded)
+            ImGui::Checkbox("Imported brick volume", &useBrickVolume);
+        if (brickVolumeLoaded && useBrickVolume) {
+            const VolumeStreamStats& stats = volumeStreamStats;
+            ImGui::Text("Volume frame %u / %u, %u cached (%.0f MiB)",
+                        stats.shownFrame + 1, stats.frameCount,
+                        stats.residentFrames,
+                        static_cast<double>(stats.residentBytes) / (1 << 20));
+            ImGui::Text("Uploads %llu, evictions %llu, stalls %llu",
+                        static_cast<unsigned long long>(stats.uploads),
+                        static_cast<unsigned long long>(stats.evictions),
+                        static_cast<unsigned long long>(stats.stalls));
+        }
+    }
+    if (core->CurrentPipeline == 1 || particleBasedFluid)
+        ImGui::Checkbox("Baked particle field", &useParticleField);
+    if (core->CurrentPipeline == 1) renderMarchPolicy();
+
+    ImGui::Checkbox("Pause time", &pauseTime);
+    ImGui::Checkbox("Render on demand", &renderOnDemand);
+    if (renderOnDemand) {
+        ImGui::Text("Accumulated samples: %u / %u", accumulatedFrames,
+                    ProgressiveAccumulation::maxSamples);
+    }
+
+    renderProfiler();
 
     if (ImGui::CollapsingHeader("Movement")) {
         ImGui::BulletText("WSAD: Forward, Backward, Left, Right");
@@ -109,3 +138,53 @@ void UserInterface::Cleanup()
     ImGui::DestroyContext();
     vkDestroyDescriptorPool(core->device, imguiPool, nullptr);
 }
+
+void UserInterface::renderMarchPolicy()
+{
+    if (!ImGui::CollapsingHeader("Adaptive march")) return;
+
+    ImGui::SliderFloat("Transmittance cutoff", &transmittanceCutoff, 0.0f,
+                       0.2f, "%.3f");
+    ImGui::SliderFloat("Step growth", &stepGrowth, 0.0f, 0.5f, "%.3f");
+    ImGui::SliderInt("Sample budget", &sampleBudget, 1,
+                     static_cast<int>(MarchPolicy::maxSampleBudget));
+
+    const MarchCounters& c = marchCounters;
+    ImGui::Text("Samples / ray: %.1f march, %.1f light, %.1f shadow",
+                c.PerRay(c.marchSamples), c.PerRay(c.lightSamples),
+                c.PerRay(c.shadowSamples));
+    ImGui::Text("Saved steps / ray: %.1f", c.PerRay(c.savedSamples));
+    ImGui::Text("Rays cut off: %.1f%% transmittance, %.1f%% budget",
+                100.0 * c.PerRay(c.terminatedRays),
+                100.0 * c.PerRay(c.exhaustedRays));
+}
+
+void UserInterface::renderProfiler()
+{
+    if (!ImGui::CollapsingHeader("GPU profiler")) return;
+    if (!profiler->IsEnabled()) {
+        ImGui::Text("Timestamp queries are not supported");
+        return;
+    }
+
+    const auto& names = profiler->GetScopeNames();
+    float total = 0.0f;
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::vector<float> values = profiler->GetHistory(i);
+        float average = profiler->GetAverage(i);
+        total += average;
+        std::string label = fmt::format("{}: {:.3f} ms", names[i], average);
+        ImGui::PlotLines(label.c_str(), values.data(),
+                         static_cast<int>(values.size()), 0, nullptr, 0.0f,
+                         FLT_MAX, ImVec2(0, 40));
+    }
+    ImGui::Text("Total GPU: %.3f ms", total);
+
+    if (ImGui::Button("Export CSV")) {
+        try {
+            profiler->ExportCsv(FilePath::gpuProfileCsvPath);
+        } catch (const std::exception& e) {
+            fmt::print("{}\n", e.what());
+        }
+    }
+}
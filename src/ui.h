@@ -7,13 +7,16 @@
 #include <fmt/format.h>
 
 #include <array>
+#include <cfloat>
 
 #include "core.h"
 #include "config.h"
+#include "profiler.h"
 
 class UserInterface {
 public:
-    explicit UserInterface(Core *core) : core{core} {};
+    UserInterface(Core *core, GpuProfiler *profiler)
+        : core{core}, profiler{profiler} {};
     void Init(uint32_t imageCount, VkRenderPass& renderPass);
     void Render();
     void RecordToCommandBuffer(VkCommandBuffer commandBuffer);
@@ -35,13 +38,67 @@ public:
     }
 
     int GetParticleBasedFluid() { return particleBasedFluid; }
+    void SetParticleBasedFluid(bool enabled) { particleBasedFluid = enabled; }
+    int GetUseNoiseVolume() { return useNoiseVolume; }
+    void SetUseNoiseVolume(bool enabled) { useNoiseVolume = enabled; }
+    int GetUseParticleField() { return useParticleField; }
+    int GetUseLightVolume() { return useLightVolume; }
+    int GetUseBrickVolume() { return useBrickVolume; }
+    // Offers the imported volume checkbox, on from the start
+    void SetBrickVolumeLoaded(bool loaded)
+    {
+        brickVolumeLoaded = loaded;
+        useBrickVolume = loaded;
+    }
+    void SetVolumeStreamStats(const VolumeStreamStats& stats)
+    {
+        volumeStreamStats = stats;
+    }
+    bool GetPauseTime() { return pauseTime; }
+    bool GetRenderOnDemand() { return renderOnDemand; }
+    void SetRenderOnDemand(bool enabled) { renderOnDemand = enabled; }
+    void SetAccumulatedFrames(uint32_t frames) { accumulatedFrames = frames; }
+    MarchPolicy GetMarchPolicy()
+    {
+        return {transmittanceCutoff, stepGrowth,
+                static_cast<uint32_t>(sampleBudget)};
+    }
+    void SetMarchPolicy(const MarchPolicy& policy)
+    {
+        transmittanceCutoff = policy.transmittanceCutoff;
+        stepGrowth = policy.stepGrowth;
+        sampleBudget = static_cast<int>(policy.sampleBudget);
+    }
+    // Counters of the latest smoke frame, shown below the march sliders
+    void SetMarchCounters(const MarchCounters& counters)
+    {
+        marchCounters = counters;
+    }
 
 private:
+    void renderProfiler();
+    void renderMarchPolicy();
+
     Core *core;
+    GpuProfiler *profiler;
     VkDescriptorPool imguiPool{};
 
     float uiSunPosition[3] = {2.0f, -10.0f, 4.0f};
     float uiWindDirection[3] = {0.2, -0.2, 1};
     
     bool particleBasedFluid = false;
+    bool useNoiseVolume = false;
+    bool useParticleField = true;
+    bool useLightVolume = true;
+    bool brickVolumeLoaded = false;
+    bool useBrickVolume = false;
+    VolumeStreamStats volumeStreamStats;
+    bool pauseTime = false;
+    bool renderOnDemand = false;
+    uint32_t accumulatedFrames = 0;
+
+    float transmittanceCutoff = 0.01f;
+    float stepGrowth = 0.05f;
+    int sampleBudget = 1024;
+    MarchCounters marchCounters;
 };
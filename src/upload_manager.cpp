@@ -0,0 +1,496 @@
+#include "upload_manager.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Covers bufferOffset alignment of every format we upload
+constexpr VkDeviceSize stagingAlignment = 16;
+
+VkBuffer createStagingBuffer(VkDevice device, VkDeviceSize size)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create staging buffer!");
+    }
+    return buffer;
+}
+
+VkCommandPool createCommandPool(VkDevice device, uint32_t queueFamily)
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                     VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamily;
+
+    VkCommandPool commandPool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload command pool!");
+    }
+    return commandPool;
+}
+
+VkSemaphore createTimeline(VkDevice device)
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    VkSemaphore semaphore;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) !=
+        VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload semaphore!");
+    }
+    return semaphore;
+}
+
+VkCommandBuffer beginCommandBuffer(VkDevice device, VkCommandPool commandPool,
+                                   std::vector<VkCommandBuffer>& freeList)
+{
+    VkCommandBuffer commandBuffer;
+    if (freeList.empty()) {
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) !=
+            VK_SUCCESS) {
+            throw std::runtime_error(
+                "failed to allocate upload command buffer!");
+        }
+    } else {
+        commandBuffer = freeList.back();
+        freeList.pop_back();
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    return commandBuffer;
+}
+
+void submitCommandBuffer(VkQueue queue, VkCommandBuffer commandBuffer,
+                         VkSemaphore waitSemaphore, uint64_t waitValue,
+                         VkSemaphore signalSemaphore, uint64_t signalValue)
+{
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    if (waitSemaphore != VK_NULL_HANDLE) {
+        timelineInfo.waitSemaphoreValueCount = 1;
+        timelineInfo.pWaitSemaphoreValues = &waitValue;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &waitSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &signalSemaphore;
+    if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+}
+
+}  // namespace
+
+void UploadManager::Init(VkDevice device, GpuAllocator *allocator,
+                         uint32_t transferFamily, VkQueue transferQueue,
+                         uint32_t queueFamily, VkQueue queue)
+{
+    this->device = device;
+    this->allocator = allocator;
+    this->transferFamily = transferFamily;
+    this->transferQueue = transferQueue;
+    this->queueFamily = queueFamily;
+    this->queue = queue;
+
+    transferCommandPool = createCommandPool(device, transferFamily);
+    transferTimeline = createTimeline(device);
+    commandPool = transferCommandPool;
+    timeline = transferTimeline;
+    if (ownershipTransfer()) {
+        commandPool = createCommandPool(device, queueFamily);
+        timeline = createTimeline(device);
+    }
+
+    stagingBuffer = createStagingBuffer(device, stagingSize);
+    stagingAllocation = allocator->AllocateBuffer(
+        stagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                           VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+void UploadManager::Cleanup()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    wait(submit());
+
+    // Freed with their pools
+    vkDestroyCommandPool(device, transferCommandPool, nullptr);
+    vkDestroySemaphore(device, transferTimeline, nullptr);
+    if (ownershipTransfer()) {
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        vkDestroySemaphore(device, timeline, nullptr);
+    }
+    freeTransferCommandBuffers.clear();
+    freeCommandBuffers.clear();
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    allocator->Free(stagingAllocation);
+}
+
+void UploadManager::UploadBuffer(VkBuffer buffer, const void *data,
+                                 VkDeviceSize size, VkDeviceSize offset)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    VkBuffer source;
+    VkDeviceSize sourceOffset;
+    std::memcpy(stage(size, source, sourceOffset), data,
+                static_cast<size_t>(size));
+    copyBuffer(source, sourceOffset, buffer, size, offset);
+}
+
+void UploadManager::UploadImage(VkImage image, VkExtent3D extent,
+                                const void *data, VkDeviceSize size,
+                                VkImageLayout finalLayout)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    VkBuffer source;
+    VkDeviceSize sourceOffset;
+    std::memcpy(stage(size, source, sourceOffset), data,
+                static_cast<size_t>(size));
+    copyImage(source, sourceOffset, image, extent, finalLayout);
+}
+
+void UploadManager::CopyBuffer(VkBuffer source, VkDeviceSize sourceOffset,
+                               VkBuffer buffer, VkDeviceSize size,
+                               VkDeviceSize offset)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    copyBuffer(source, sourceOffset, buffer, size, offset);
+}
+
+void UploadManager::CopyImage(VkBuffer source, VkDeviceSize sourceOffset,
+                              VkImage image, VkExtent3D extent,
+                              VkImageLayout finalLayout)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    copyImage(source, sourceOffset, image, extent, finalLayout);
+}
+
+void UploadManager::copyBuffer(VkBuffer source, VkDeviceSize sourceOffset,
+                               VkBuffer buffer, VkDeviceSize size,
+                               VkDeviceSize offset)
+{
+    begin();
+    VkBufferCopy region{};
+    region.srcOffset = sourceOffset;
+    region.dstOffset = offset;
+    region.size = size;
+    vkCmdCopyBuffer(recording.transferCommandBuffer, source, buffer, 1,
+                    &region);
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+    finishBuffer(barrier);
+}
+
+void UploadManager::copyImage(VkBuffer source, VkDeviceSize sourceOffset,
+                              VkImage image, VkExtent3D extent,
+                              VkImageLayout finalLayout)
+{
+    begin();
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(recording.transferCommandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = sourceOffset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = extent;
+    vkCmdCopyBufferToImage(recording.transferCommandBuffer, source, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = finalLayout;
+    finishImage(barrier);
+}
+
+VkCommandBuffer UploadManager::GetCommandBuffer()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    begin();
+    return recording.commandBuffer;
+}
+
+uint64_t UploadManager::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t ticket = submit();
+    collect();
+    return ticket;
+}
+
+bool UploadManager::IsComplete(uint64_t ticket)
+{
+    // Polling has to submit the acquires of finished copies as well
+    std::lock_guard<std::mutex> lock(mutex);
+    collect();
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &value);
+    return value >= ticket;
+}
+
+void UploadManager::Wait(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    wait(ticket);
+}
+
+void *UploadManager::stage(VkDeviceSize size, VkBuffer& buffer,
+                           VkDeviceSize& offset)
+{
+    // Big uploads would stall on the whole ring, they get their own buffer
+    if (size > stagingSize / 2) {
+        buffer = createStagingBuffer(device, size);
+        Allocation allocation = allocator->AllocateBuffer(
+            buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        begin();
+        recording.ownStaging.emplace_back(buffer, allocation);
+        offset = 0;
+        return allocation.mapped;
+    }
+
+    collect();
+    while (!reserve(size, offset)) {
+        // The ring is held by the batch being recorded and the ones in
+        // flight, oldest first
+        if (submitted.empty()) submit();
+        wait(submitted.front().ticket);
+    }
+    buffer = stagingBuffer;
+    return static_cast<char *>(stagingAllocation.mapped) + offset;
+}
+
+bool UploadManager::reserve(VkDeviceSize size, VkDeviceSize& offset)
+{
+    if (used == 0) head = tail = 0;
+
+    VkDeviceSize start =
+        (head + stagingAlignment - 1) & ~(stagingAlignment - 1);
+    VkDeviceSize end;
+    if (used == 0 || head > tail) {
+        // Free space is [head, stagingSize) and [0, tail)
+        if (start + size <= stagingSize) {
+            end = start + size;
+        } else if (size <= tail) {
+            start = 0;
+            end = size;
+        } else {
+            return false;
+        }
+    } else {
+        // Wrapped, free space is [head, tail)
+        if (start + size > tail) return false;
+        end = start + size;
+    }
+
+    VkDeviceSize bytes = end >= head ? end - head : stagingSize - head + end;
+    used += bytes;
+    head = end;
+    begin();
+    recording.ringBytes += bytes;
+    recording.ringEnd = head;
+    offset = start;
+    return true;
+}
+
+void UploadManager::begin()
+{
+    if (recording.transferCommandBuffer != VK_NULL_HANDLE) return;
+
+    recording.transferCommandBuffer = beginCommandBuffer(
+        device, transferCommandPool, freeTransferCommandBuffers);
+    recording.commandBuffer = recording.transferCommandBuffer;
+    if (ownershipTransfer()) {
+        recording.commandBuffer =
+            beginCommandBuffer(device, commandPool, freeCommandBuffers);
+    }
+}
+
+uint64_t UploadManager::submit()
+{
+    if (recording.transferCommandBuffer == VK_NULL_HANDLE) return lastTicket;
+
+    vkEndCommandBuffer(recording.transferCommandBuffer);
+    recording.ticket = ++lastTicket;
+    submitCommandBuffer(transferQueue, recording.transferCommandBuffer,
+                        VK_NULL_HANDLE, 0, transferTimeline, recording.ticket);
+    recording.acquireSubmitted = !ownershipTransfer();
+
+    submitted.push_back(std::move(recording));
+    recording = Batch{};
+    return lastTicket;
+}
+
+void UploadManager::submitAcquire(Batch& batch)
+{
+    vkEndCommandBuffer(batch.commandBuffer);
+    submitCommandBuffer(queue, batch.commandBuffer, transferTimeline,
+                        batch.ticket, timeline, batch.ticket);
+    batch.acquireSubmitted = true;
+}
+
+void UploadManager::wait(uint64_t ticket)
+{
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pValues = &ticket;
+    if (ownershipTransfer()) {
+        // The acquire is only submitted once the copies are done
+        waitInfo.pSemaphores = &transferTimeline;
+        vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+        collect();
+    }
+    waitInfo.pSemaphores = &timeline;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    collect();
+}
+
+void UploadManager::collect()
+{
+    if (ownershipTransfer()) {
+        // Submitting the acquire early would make `queue` wait for the
+        // copies, in between frames
+        uint64_t copied = 0;
+        vkGetSemaphoreCounterValue(device, transferTimeline, &copied);
+        for (auto& batch : submitted) {
+            if (batch.acquireSubmitted) continue;
+            if (batch.ticket > copied) break;
+            submitAcquire(batch);
+        }
+    }
+
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(device, timeline, &value);
+    while (!submitted.empty() && submitted.front().ticket <= value) {
+        Batch& batch = submitted.front();
+        if (batch.ringBytes > 0) {
+            used -= batch.ringBytes;
+            tail = batch.ringEnd;
+        }
+        for (auto& [buffer, allocation] : batch.ownStaging) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            allocator->Free(allocation);
+        }
+        vkResetCommandBuffer(batch.transferCommandBuffer, 0);
+        freeTransferCommandBuffers.push_back(batch.transferCommandBuffer);
+        if (ownershipTransfer()) {
+            vkResetCommandBuffer(batch.commandBuffer, 0);
+            freeCommandBuffers.push_back(batch.commandBuffer);
+        }
+        submitted.pop_front();
+    }
+}
+
+void UploadManager::finishBuffer(VkBufferMemoryBarrier barrier)
+{
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    if (!ownershipTransfer()) {
+        vkCmdPipelineBarrier(recording.commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0,
+                             nullptr, 1, &barrier, 0, nullptr);
+        return;
+    }
+
+    // Release on the transfer queue, the destination access only counts on
+    // the acquiring side
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = queueFamily;
+    VkBufferMemoryBarrier release = barrier;
+    release.dstAccessMask = 0;
+    vkCmdPipelineBarrier(recording.transferCommandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         1, &release, 0, nullptr);
+    barrier.srcAccessMask = 0;
+    vkCmdPipelineBarrier(recording.commandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+}
+
+void UploadManager::finishImage(VkImageMemoryBarrier barrier)
+{
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    if (!ownershipTransfer()) {
+        vkCmdPipelineBarrier(recording.commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0,
+                             nullptr, 0, nullptr, 1, &barrier);
+        return;
+    }
+
+    // The layout transition is part of the pair, both sides name it
+    barrier.srcQueueFamilyIndex = transferFamily;
+    barrier.dstQueueFamilyIndex = queueFamily;
+    VkImageMemoryBarrier release = barrier;
+    release.dstAccessMask = 0;
+    vkCmdPipelineBarrier(recording.transferCommandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         0, nullptr, 1, &release);
+    barrier.srcAccessMask = 0;
+    vkCmdPipelineBarrier(recording.commandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "allocator.h"
+
+// Batches buffer and image uploads into one command buffer per Flush()
+// instead of a vkQueueWaitIdle per copy. Data is staged in a persistently
+// mapped ring buffer; a batch's part of the ring is recycled once the
+// timeline semaphore reaches the batch's ticket. Uploads that do not fit the
+// ring get a staging buffer of their own, freed the same way.
+//
+// The copies run on the transfer queue. When that is a different family
+// than the queue the resources are used on, every upload is released by the
+// transfer queue and acquired on `queue` in a second submission, which is
+// only made once the copies finished so the frames on `queue` never wait
+// for them. A ticket is complete once the resources are usable on `queue`.
+class UploadManager {
+public:
+    static constexpr VkDeviceSize stagingSize = VkDeviceSize{32} << 20;
+
+    void Init(VkDevice device, GpuAllocator *allocator,
+              uint32_t transferFamily, VkQueue transferQueue,
+              uint32_t queueFamily, VkQueue queue);
+    // Waits for every batch and releases the staging memory
+    void Cleanup();
+
+    // The destination must not be in use by work already submitted
+    void UploadBuffer(VkBuffer buffer, const void *data, VkDeviceSize size,
+                      VkDeviceSize offset = 0);
+    // Whole image, tightly packed texels, UNDEFINED -> finalLayout
+    void UploadImage(VkImage image, VkExtent3D extent, const void *data,
+                     VkDeviceSize size,
+                     VkImageLayout finalLayout =
+                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Same from a host visible buffer the caller fills and keeps unchanged
+    // until the batch's ticket completes, saves the copy into the ring
+    void CopyBuffer(VkBuffer source, VkDeviceSize sourceOffset, VkBuffer buffer,
+                    VkDeviceSize size, VkDeviceSize offset = 0);
+    void CopyImage(VkBuffer source, VkDeviceSize sourceOffset, VkImage image,
+                   VkExtent3D extent,
+                   VkImageLayout finalLayout =
+                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Command buffer of the current batch on `queue`, for barriers and other
+    // setup work that should ride along with the uploads
+    VkCommandBuffer GetCommandBuffer();
+
+    // Submits the current batch and the acquires of finished copies.
+    // Returns the batch's ticket, or the last ticket when nothing was
+    // recorded
+    uint64_t Flush();
+    // Also submits the acquires of finished copies, so polling progresses
+    bool IsComplete(uint64_t ticket);
+    void Wait(uint64_t ticket);
+
+private:
+    struct Batch {
+        VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+        // Same as transferCommandBuffer without an ownership transfer
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        uint64_t ticket = 0;
+        bool acquireSubmitted = false;
+        VkDeviceSize ringEnd = 0;    // head of the ring after this batch
+        VkDeviceSize ringBytes = 0;  // including padding and wrap-around
+        std::vector<std::pair<VkBuffer, Allocation>> ownStaging;
+    };
+
+    // The helpers below expect the mutex to be held
+
+    // Staging space for `size` bytes, returns the buffer and offset to copy
+    // from and the host pointer to write to
+    void *stage(VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset);
+    bool reserve(VkDeviceSize size, VkDeviceSize& offset);
+    void begin();
+    void copyBuffer(VkBuffer source, VkDeviceSize sourceOffset, VkBuffer buffer,
+                    VkDeviceSize size, VkDeviceSize offset);
+    void copyImage(VkBuffer source, VkDeviceSize sourceOffset, VkImage image,
+                   VkExtent3D extent, VkImageLayout finalLayout);
+    uint64_t submit();
+    void submitAcquire(Batch& batch);
+    void wait(uint64_t ticket);
+    // Submits pending acquires and retires batches whose ticket was reached
+    void collect();
+
+    // Both barriers of the release/acquire pair
+    void finishBuffer(VkBufferMemoryBarrier barrier);
+    void finishImage(VkImageMemoryBarrier barrier);
+
+    bool ownershipTransfer() const { return transferFamily != queueFamily; }
+
+    VkDevice device = VK_NULL_HANDLE;
+    GpuAllocator *allocator = nullptr;
+    uint32_t transferFamily = 0;
+    uint32_t queueFamily = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    // Signalled by the copies and by the submission that makes a batch
+    // usable on `queue`, the same semaphore without an ownership transfer
+    VkSemaphore transferTimeline = VK_NULL_HANDLE;
+    VkSemaphore timeline = VK_NULL_HANDLE;
+
+    VkBuffer stagingBuffer = VK_NULL_HANDLE;
+    Allocation stagingAllocation;
+    VkDeviceSize head = 0;  // next free byte
+    VkDeviceSize tail = 0;  // oldest byte still in use
+    VkDeviceSize used = 0;
+
+    std::mutex mutex;
+    Batch recording;
+    std::deque<Batch> submitted;
+    std::vector<VkCommandBuffer> freeTransferCommandBuffers;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    uint64_t lastTicket = 0;
+};
@@ -0,0 +1,343 @@
+#include "volume_stream.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <stdexcept>
+
+#include "thread_pool.h"
+
+VkDeviceSize VolumeStream::tableOffset(const BrickVolume::Footprint& footprint)
+{
+    return (footprint.atlasBytes + 15) / 16 * 16;
+}
+
+void VolumeStream::Init(Core *core, const std::string& path,
+                        const VolumePlayback& playback, uint32_t framesInFlight,
+                        uint32_t threads, bool blocking)
+{
+    this->core = core;
+    this->framesInFlight = framesInFlight;
+    this->threads = threads;
+    this->blocking = blocking;
+    fps = playback.fps;
+    budget = VkDeviceSize{playback.cacheBudgetMiB} << 20;
+
+    namespace fs = std::filesystem;
+    if (fs::is_directory(path)) {
+        for (const auto& entry : fs::directory_iterator(path)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".vvb") {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    } else {
+        paths.push_back(path);
+    }
+    if (paths.empty()) {
+        throw std::runtime_error("no .vvb files in " + path + "!");
+    }
+
+    // Staging for the largest frame, known from the headers alone
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(core->physicalDevice, &properties);
+    maxAtlasExtent = properties.limits.maxImageDimension3D;
+    for (const auto& framePath : paths) {
+        const auto footprint =
+            BrickVolume::ReadFootprint(framePath, maxAtlasExtent);
+        slotBytes =
+            std::max(slotBytes, tableOffset(footprint) + footprint.tableBytes);
+    }
+    slots.resize(std::max(playback.prefetchFrames, 1u));
+    for (auto& slot : slots) {
+        slot.buffer = Buffer{core, slotBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                             VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT};
+        slot.mapped = slot.buffer.GetMappedData();
+    }
+    stats.frameCount = static_cast<uint32_t>(paths.size());
+
+    ioThread = std::thread(&VolumeStream::ioLoop, this);
+    fmt::print("[INFO] Volume sequence {}: {} frames at {} fps, {} prefetched "
+               "into {:.1f} MiB of staging, {} MiB cache\n",
+               path, paths.size(), fps, slots.size(),
+               static_cast<double>(slotBytes * slots.size()) / (1 << 20),
+               playback.cacheBudgetMiB);
+}
+
+void VolumeStream::Cleanup()
+{
+    if (ioThread.joinable()) {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        requested.notify_all();
+        ioThread.join();
+    }
+    for (auto& frame : frames) {
+        frame->atlas.Cleanup();
+        frame->table.Cleanup();
+    }
+    frames.clear();
+    shown = nullptr;
+    for (auto& slot : slots) slot.buffer.Cleanup();
+    slots.clear();
+    paths.clear();
+}
+
+void VolumeStream::ioLoop()
+{
+    // Packs with a pool of its own, the main thread keeps recording
+    ThreadPool pool{threads};
+    std::unique_lock lock(mutex);
+    while (true) {
+        requested.wait(lock, [this] { return stopping || !ioQueue.empty(); });
+        if (stopping) return;
+        Slot& slot = slots[ioQueue.front()];
+        ioQueue.pop_front();
+        slot.state = SlotState::Loading;
+        const std::string path = paths[slot.frame];
+        lock.unlock();
+
+        std::string error;
+        BrickVolume::Footprint footprint;
+        try {
+            BrickVolume volume;
+            volume.Load(path);
+            footprint = volume.GetFootprint(maxAtlasExtent);
+            if (tableOffset(footprint) + footprint.tableBytes > slotBytes) {
+                throw std::runtime_error(path + " grew since it was opened!");
+            }
+            volume.Pack(pool, footprint, slot.mapped,
+                        static_cast<uint8_t *>(slot.mapped) +
+                            tableOffset(footprint));
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+
+        lock.lock();
+        if (error.empty()) {
+            slot.footprint = footprint;
+            slot.state = SlotState::Loaded;
+        } else {
+            ioError = error;
+            slot.state = SlotState::Free;
+        }
+        loaded.notify_all();
+    }
+}
+
+VolumeStream::Frame *VolumeStream::resident(uint32_t number)
+{
+    for (auto& frame : frames) {
+        if (frame->number == number) return frame.get();
+    }
+    return nullptr;
+}
+
+bool VolumeStream::pending(uint32_t number) const
+{
+    return std::any_of(slots.begin(), slots.end(), [number](const Slot& slot) {
+        return slot.state != SlotState::Free &&
+               slot.state != SlotState::Uploading && slot.frame == number;
+    });
+}
+
+bool VolumeStream::inWindow(uint32_t number, uint32_t wanted) const
+{
+    const size_t count = paths.size();
+    return (number + count - wanted) % count <= slots.size();
+}
+
+void VolumeStream::retireUploads()
+{
+    for (auto& slot : slots) {
+        if (slot.state == SlotState::Uploading &&
+            core->uploader.IsComplete(slot.ticket)) {
+            slot.state = SlotState::Free;
+        }
+    }
+}
+
+void VolumeStream::upload(Slot& slot)
+{
+    const BrickVolume::Footprint& footprint = slot.footprint;
+    auto frame = std::make_unique<Frame>();
+    frame->number = slot.frame;
+    frame->id = ++nextId;
+    frame->bytes = footprint.atlasBytes + footprint.tableBytes;
+
+    const glm::uvec3 extent = footprint.AtlasExtent();
+    frame->atlas = Texture{core,
+                           extent.x,
+                           extent.y,
+                           extent.z,
+                           VK_FORMAT_R16_SFLOAT,
+                           slot.buffer.GetBuffer(),
+                           0};
+    frame->atlas.CreateImageView().CreateImageSampler();
+    frame->table = Buffer{core, footprint.tableBytes,
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                              VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+    core->uploader.CopyBuffer(slot.buffer.GetBuffer(), tableOffset(footprint),
+                              frame->table.GetBuffer(), footprint.tableBytes);
+    // Submitted now so the copies overlap the frames being recorded
+    frame->ticket = core->uploader.Flush();
+
+    slot.ticket = frame->ticket;
+    slot.state = SlotState::Uploading;
+    stats.residentBytes += frame->bytes;
+    ++stats.uploads;
+    frames.push_back(std::move(frame));
+}
+
+bool VolumeStream::evict(uint32_t wanted, uint64_t frameIndex)
+{
+    // Least recently shown, outside the prefetch window and done with
+    Frame *victim = nullptr;
+    for (auto& frame : frames) {
+        if (frame.get() == shown || inWindow(frame->number, wanted) ||
+            frame->lastFrameIndex + framesInFlight > frameIndex ||
+            !core->uploader.IsComplete(frame->ticket)) {
+            continue;
+        }
+        if (victim == nullptr || frame->lastShown < victim->lastShown) {
+            victim = frame.get();
+        }
+    }
+    if (victim == nullptr) return false;
+
+    victim->atlas.Cleanup();
+    victim->table.Cleanup();
+    stats.residentBytes -= victim->bytes;
+    ++stats.evictions;
+    frames.erase(std::find_if(frames.begin(), frames.end(),
+                              [victim](const auto& candidate) {
+                                  return candidate.get() == victim;
+                              }));
+    return true;
+}
+
+void VolumeStream::uploadLoaded(uint32_t wanted, uint64_t frameIndex)
+{
+    // Frames the playback moved past are not uploaded
+    for (auto& slot : slots) {
+        if (slot.state == SlotState::Loaded && !inWindow(slot.frame, wanted)) {
+            slot.state = SlotState::Free;
+        }
+    }
+    // In playback order, the wanted frame even past the budget
+    for (size_t ahead = 0; ahead <= slots.size(); ++ahead) {
+        const uint32_t number =
+            static_cast<uint32_t>((wanted + ahead) % paths.size());
+        auto slot = std::find_if(slots.begin(), slots.end(),
+                                 [number](const Slot& candidate) {
+                                     return candidate.state ==
+                                                SlotState::Loaded &&
+                                            candidate.frame == number;
+                                 });
+        if (slot == slots.end()) continue;
+
+        const VkDeviceSize bytes =
+            slot->footprint.atlasBytes + slot->footprint.tableBytes;
+        while (stats.residentBytes + bytes > budget &&
+               evict(wanted, frameIndex)) {
+        }
+        if (stats.residentBytes + bytes > budget && number != wanted) break;
+        upload(*slot);
+    }
+}
+
+void VolumeStream::request(uint32_t wanted)
+{
+    bool queued = false;
+    for (size_t ahead = 0; ahead <= slots.size(); ++ahead) {
+        const uint32_t number =
+            static_cast<uint32_t>((wanted + ahead) % paths.size());
+        if (resident(number) != nullptr || pending(number)) continue;
+        auto slot = std::find_if(slots.begin(), slots.end(), [](const Slot& candidate) {
+            return candidate.state == SlotState::Free;
+        });
+        if (slot == slots.end() && number == wanted) {
+            // A frame loaded ahead that did not fit the budget makes room
+            slot = std::find_if(slots.begin(), slots.end(), [](const Slot& candidate) {
+                return candidate.state == SlotState::Loaded;
+            });
+        }
+        if (slot == slots.end()) break;
+        slot->state = SlotState::Requested;
+        slot->frame = number;
+        ioQueue.push_back(static_cast<size_t>(slot - slots.begin()));
+        queued = true;
+    }
+    if (queued) requested.notify_one();
+}
+
+VolumeStream::Frame *VolumeStream::Update(double time, uint64_t frameIndex)
+{
+    ++updates;
+    const uint32_t wanted = static_cast<uint32_t>(
+        static_cast<uint64_t>(std::max(time, 0.0) * fps) % paths.size());
+
+    std::unique_lock lock(mutex);
+    Frame *frame = nullptr;
+    while (true) {
+        if (!ioError.empty()) {
+            throw std::runtime_error("failed to stream volume: " + ioError);
+        }
+        retireUploads();
+        uploadLoaded(wanted, frameIndex);
+        request(wanted);
+
+        frame = resident(wanted);
+        if (frame != nullptr && core->uploader.IsComplete(frame->ticket)) break;
+        if (!blocking) {
+            frame = nullptr;
+            break;
+        }
+        // The I/O thread only signals `loaded` for slots it was given
+        const bool loading =
+            std::any_of(slots.begin(), slots.end(), [](const Slot& slot) {
+                return slot.state == SlotState::Requested ||
+                       slot.state == SlotState::Loading;
+            });
+        if (frame == nullptr && loading) {
+            loaded.wait(lock);
+            continue;
+        }
+        // Either the wanted upload or, with every slot still copying a
+        // frame ahead, the oldest of those to free its slot
+        uint64_t ticket = frame != nullptr ? frame->ticket : 0;
+        for (const auto& slot : slots) {
+            if (frame == nullptr && slot.state == SlotState::Uploading &&
+                (ticket == 0 || slot.ticket < ticket)) {
+                ticket = slot.ticket;
+            }
+        }
+        if (ticket == 0) {
+            throw std::runtime_error("volume frame " + std::to_string(wanted) +
+                                     " cannot be streamed!");
+        }
+        lock.unlock();
+        core->uploader.Wait(ticket);
+        lock.lock();
+    }
+
+    if (frame != nullptr) {
+        shown = frame;
+    } else if (shown != nullptr) {
+        ++stats.stalls;
+    }
+    if (shown != nullptr) {
+        shown->lastShown = updates;
+        shown->lastFrameIndex = frameIndex;
+        stats.shownFrame = shown->number;
+    }
+    stats.residentFrames = static_cast<uint32_t>(frames.size());
+    return shown;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "brick_volume.h"
+#include "buffer.h"
+#include "config.h"
+#include "core.h"
+#include "texture.h"
+
+// Playback of a brick volume sequence, one file per frame, that neither
+// waits for the disk nor for uploads. An I/O thread maps the files of the
+// next prefetchFrames frames and packs their bricks straight into
+// persistently mapped staging buffers. The main thread copies finished ones
+// on the transfer queue while frames render and keeps the uploaded frames
+// in a GPU cache; past the budget, the least recently shown frame that no
+// frame in flight reads is evicted. A frame that is not resident in time
+// keeps the previous one on screen.
+class VolumeStream {
+public:
+    struct Frame {
+        uint32_t number = 0;
+        uint64_t id = 0;  // unique per upload, for descriptor updates
+        Texture atlas;
+        Buffer table;
+        VkDeviceSize bytes = 0;
+        uint64_t ticket = 0;          // of the upload
+        uint64_t lastShown = 0;       // Update() call, for the LRU
+        uint64_t lastFrameIndex = 0;  // last frame in flight reading it
+    };
+
+    // path: a .vvb file or a directory of them. Blocking streams wait for
+    // every frame instead of skipping, for headless runs.
+    void Init(Core *core, const std::string& path,
+              const VolumePlayback& playback, uint32_t framesInFlight,
+              uint32_t threads, bool blocking);
+    // The frames must not be in use by the GPU any more
+    void Cleanup();
+    bool IsOpen() const { return !paths.empty(); }
+
+    // Frame to show at `time` seconds in the frame with index frameIndex:
+    // the wanted one once it is resident, the last shown one until then,
+    // null before the first upload. Rethrows errors of the I/O thread.
+    Frame *Update(double time, uint64_t frameIndex);
+    const VolumeStreamStats& GetStats() const { return stats; }
+
+private:
+    enum class SlotState { Free, Requested, Loading, Loaded, Uploading };
+    // Pinned staging for one frame: atlas texels, then the brick table at
+    // tableOffset
+    struct Slot {
+        Buffer buffer;
+        void *mapped = nullptr;
+        SlotState state = SlotState::Free;
+        uint32_t frame = 0;
+        BrickVolume::Footprint footprint;
+        uint64_t ticket = 0;
+    };
+
+    static VkDeviceSize tableOffset(const BrickVolume::Footprint& footprint);
+
+    void ioLoop();
+    // The rest run on the main thread with the mutex held
+    Frame *resident(uint32_t number);
+    bool pending(uint32_t number) const;
+    bool inWindow(uint32_t number, uint32_t wanted) const;
+    void retireUploads();
+    void uploadLoaded(uint32_t wanted, uint64_t frameIndex);
+    void upload(Slot& slot);
+    bool evict(uint32_t wanted, uint64_t frameIndex);
+    void request(uint32_t wanted);
+
+    Core *core = nullptr;
+    std::vector<std::string> paths;
+    float fps = 24.0f;
+    VkDeviceSize budget = 0;
+    uint32_t framesInFlight = 1;
+    uint32_t threads = 0;
+    uint32_t maxAtlasExtent = 0;
+    VkDeviceSize slotBytes = 0;  // largest frame's atlas and table
+    bool blocking = false;
+
+    std::vector<Slot> slots;
+    std::vector<std::unique_ptr<Frame>> frames;
+    Frame *shown = nullptr;
+    uint64_t updates = 0;
+    uint64_t nextId = 0;
+    VolumeStreamStats stats;
+
+    std::mutex mutex;
+    std::condition_variable requested;
+    std::condition_variable loaded;
+    std::deque<size_t> ioQueue;  // slots to load, oldest request first
+    std::string ioError;
+    bool stopping = false;
+    std::thread ioThread;
+};